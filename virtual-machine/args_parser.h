@@ -0,0 +1,80 @@
+#ifndef ARGS_PARSER_H
+#define ARGS_PARSER_H
+
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+class ArgsParser
+{
+    std::vector<std::string_view> args;
+
+    static bool isOption(const std::string_view &arg)
+    {
+        return arg.starts_with("--");
+    }
+
+    static bool isFlag(const std::string_view &arg)
+    {
+        return arg.starts_with('-') && !isOption(arg);
+    }
+
+public:
+    static constexpr std::string_view OPTION_HELP = "help";
+    static constexpr std::string_view OPTION_TRACE = "trace";
+    static constexpr std::string_view OPTION_DUMP_BYTECODE = "dump-bytecode";
+    static constexpr std::string_view OPTION_STACK_SIZE = "stack-size";
+    static constexpr std::string_view OPTION_BACKEND = "backend";
+    static constexpr std::string_view OPTION_IR = "ir";
+    static constexpr std::string_view OPTION_GC_STRESS = "gc-stress";
+    static constexpr std::string_view OPTION_GC_STATS = "gc-stats";
+    static constexpr char FLAG_OPTIMIZATION_LEVEL = 'O';
+
+    ArgsParser(const int argc, const char *argv[]): args(argv + 1, argv + argc)
+    {
+    }
+
+    [[nodiscard]] std::optional<std::string_view> getFileToRun() const
+    {
+        const auto file = std::ranges::find_if(args, [](const auto &arg) { return !isOption(arg) && !isFlag(arg); });
+        return file == args.end() ? std::nullopt : std::make_optional(*file);
+    }
+
+    [[nodiscard]] bool hasOption(const std::string_view &option) const
+    {
+        return std::ranges::any_of(args, [&](const auto &arg)
+        {
+            return isOption(arg) && arg.substr(2) == option;
+        });
+    }
+
+    [[nodiscard]] std::optional<std::string_view> getOptionValue(const std::string_view &option) const
+    {
+        for (const auto &arg: args)
+        {
+            if (isOption(arg) && arg.substr(2).starts_with(option) && arg.substr(2 + option.length()).starts_with('='))
+            {
+                return arg.substr(3 + option.length());
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    // Single-dash flags carry their value directly, as in -O2.
+    [[nodiscard]] std::optional<std::string_view> getFlagValue(const char flag) const
+    {
+        for (const auto &arg: args)
+        {
+            if (isFlag(arg) && arg.length() > 1 && arg[1] == flag)
+            {
+                return arg.substr(2);
+            }
+        }
+
+        return std::nullopt;
+    }
+};
+
+#endif //ARGS_PARSER_H
@@ -1,24 +1,71 @@
 #include <iostream>
 
+#include "args_parser.h"
 #include "runner.h"
 #include "src/include/chunk.h"
 #include "src/include/vm.h"
 
 int main(const int argc, const char *argv[])
 {
+    const ArgsParser argsParser{argc, argv};
+    if (argsParser.hasOption(ArgsParser::OPTION_HELP))
+    {
+        std::cout << "Usage : yaupl [path] [--help] [--dump-bytecode] [--trace[=file]] [--stack-size=slots] [-O0|-O1|-O2] [--backend=stack|register] [--ir] [--gc-stress] [--gc-stats]" << std::endl;
+        return 0;
+    }
+
     Runner runner{};
-    if (argc == 1)
+    if (argsParser.hasOption(ArgsParser::OPTION_DUMP_BYTECODE))
     {
-        runner.repl();
+        runner.enableBytecodeDump();
     }
-    else if (argc == 2)
+
+    if (const auto stackSize = argsParser.getOptionValue(ArgsParser::OPTION_STACK_SIZE); stackSize.has_value())
+    {
+        runner.setStackLimit(stackSize.value());
+    }
+
+    if (const auto backend = argsParser.getOptionValue(ArgsParser::OPTION_BACKEND); backend.has_value())
     {
-        runner.runFile(argv[1]);
+        runner.setBackend(backend.value());
+    }
+
+    if (argsParser.hasOption(ArgsParser::OPTION_IR))
+    {
+        runner.enableIr();
+    }
+
+    if (argsParser.hasOption(ArgsParser::OPTION_GC_STRESS))
+    {
+        runner.enableGcStress();
+    }
+
+    if (argsParser.hasOption(ArgsParser::OPTION_GC_STATS))
+    {
+        runner.enableGcStats();
+    }
+
+    if (const auto level = argsParser.getFlagValue(ArgsParser::FLAG_OPTIMIZATION_LEVEL); level.has_value())
+    {
+        runner.setOptimizationLevel(level.value());
+    }
+
+    if (const auto traceFile = argsParser.getOptionValue(ArgsParser::OPTION_TRACE); traceFile.has_value())
+    {
+        runner.enableTracing(traceFile.value());
+    }
+    else if (argsParser.hasOption(ArgsParser::OPTION_TRACE))
+    {
+        runner.enableTracing(Runner::DEFAULT_TRACE_FILE);
+    }
+
+    if (const auto file = argsParser.getFileToRun(); file.has_value())
+    {
+        runner.runFile(file.value());
     }
     else
     {
-        std::cerr << "Usage : yaupl [path]" << std::endl;
-        exit(64);
+        runner.repl();
     }
 
     return 0;
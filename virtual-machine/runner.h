@@ -1,18 +1,148 @@
 #ifndef RUNNER_H
 #define RUNNER_H
+#include <charconv>
+#include <format>
 #include <fstream>
 
+#include "src/include/common.h"
 #include "src/include/interpret_result.h"
+#include "src/include/register_vm.h"
+#include "src/include/tracer.h"
 #include "src/include/vm.h"
 
 class Runner
 {
     VM vm{};
+    RegisterVM registerVM{};
+    bool useRegisterBackend = false;
+    bool printGcStats = false;
+    CompilePipeline filePipeline = CompilePipeline::SINGLE_PASS;
 
 public:
-    InterpretResult interpret(const std::string &source)
+    static constexpr std::string_view DEFAULT_TRACE_FILE = "yaupl-trace.csv";
+
+    void enableBytecodeDump()
+    {
+        vm.dumpBytecode = true;
+        registerVM.dumpBytecode = true;
+    }
+
+    void setStackLimit(const std::string_view &slots)
     {
-        return vm.interpret(source);
+        auto limit = 0;
+        const auto [end, error] = std::from_chars(slots.data(), slots.data() + slots.size(), limit);
+        if (error != std::errc{} || end != slots.data() + slots.size() || limit <= 0)
+        {
+            std::cerr << "Invalid stack size " << slots << std::endl;
+            exit(64);
+        }
+
+        vm.stackLimit = limit;
+        registerVM.stackLimit = limit;
+    }
+
+    void setBackend(const std::string_view &backend)
+    {
+        if (backend != "stack" && backend != "register")
+        {
+            std::cerr << "Invalid backend " << backend << std::endl;
+            exit(64);
+        }
+
+        useRegisterBackend = backend == "register";
+    }
+
+    void setOptimizationLevel(const std::string_view &level)
+    {
+        auto value = 0;
+        const auto [end, error] = std::from_chars(level.data(), level.data() + level.size(), value);
+        if (error != std::errc{} || end != level.data() + level.size() || value < 0 || value > Optimizer::MAX_LEVEL)
+        {
+            std::cerr << "Invalid optimization level " << level << std::endl;
+            exit(64);
+        }
+
+        vm.compiler.setOptimizationLevel(value);
+        vm.irCompiler.setOptimizationLevel(value);
+    }
+
+    // Only files go through the IR: REPL lines are compiled in a single pass, where compile time matters more. The IR
+    // is lowered to stack bytecode only, so it cannot be combined with the register backend, which is chosen first.
+    void enableIr()
+    {
+        if (useRegisterBackend)
+        {
+            std::cerr << "The IR pipeline is only available with the stack backend" << std::endl;
+            exit(64);
+        }
+
+        filePipeline = CompilePipeline::IR;
+    }
+
+    void enableGcStress()
+    {
+        vm.heap.enableStressMode();
+        registerVM.heap.enableStressMode();
+    }
+
+    void enableGcStats()
+    {
+        printGcStats = true;
+    }
+
+    // Written to stderr when the program or the REPL ends, so the output of the script itself stays unchanged.
+    void reportGcStats() const
+    {
+        if (!printGcStats)
+        {
+            return;
+        }
+
+        const auto &stats = useRegisterBackend ? registerVM.heap.gcStats() : vm.heap.gcStats();
+        std::cerr << std::format("gc: {} objects promoted", stats.promotedObjects) << std::endl;
+        const std::pair<std::string_view, PauseHistogram> kinds[] = {
+            {"minor", stats.minor}, {"remark", stats.remark}, {"full", stats.full}, {"all", stats.all()}
+        };
+
+        for (const auto &[kind, pauses]: kinds)
+        {
+            const auto micros = [](const uint64_t nanoseconds) { return static_cast<double>(nanoseconds) / 1000; };
+            std::cerr << std::format("gc {:<6} {:>7} pauses, total {:.1f} us, p50 {:.1f} us, p90 {:.1f} us, "
+                                     "p99 {:.1f} us, max {:.1f} us",
+                                     kind, pauses.count(), micros(pauses.totalNanoseconds()),
+                                     micros(pauses.percentile(0.5)), micros(pauses.percentile(0.9)),
+                                     micros(pauses.percentile(0.99)), micros(pauses.maxNanoseconds())) << std::endl;
+        }
+    }
+
+    void enableTracing(const std::string_view &path)
+    {
+        if (!TRACING_AVAILABLE)
+        {
+            std::cerr << "Execution tracing is not available in this build." << std::endl;
+            exit(64);
+        }
+
+        auto tracer = std::make_unique<Tracer>(std::string{path});
+        if (!tracer->isOpen())
+        {
+            std::cerr << "Failed to open trace file " << path << std::endl;
+            exit(74);
+        }
+
+        if (useRegisterBackend)
+        {
+            registerVM.tracer = std::move(tracer);
+        }
+        else
+        {
+            vm.tracer = std::move(tracer);
+        }
+    }
+
+    InterpretResult interpret(const std::string &source, const CompilePipeline pipeline)
+    {
+        return useRegisterBackend ? registerVM.interpret(source) : vm.interpret(source, pipeline);
     }
 
     void repl()
@@ -28,14 +158,17 @@ public:
                 break;
             }
 
-            interpret(line);
+            interpret(line, CompilePipeline::SINGLE_PASS);
         }
+
+        reportGcStats();
     }
 
     void runFile(const std::string_view &path)
     {
         const auto source = util::readFile(path);
-        const auto result = interpret(source);
+        const auto result = interpret(source, filePipeline);
+        reportGcStats();
 
         if (result == InterpretResult::COMPILE_ERROR)
         {
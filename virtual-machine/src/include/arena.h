@@ -0,0 +1,90 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+
+#include "memory.h"
+
+// A bump allocator for what only lives as long as one compilation: the code, line tables and constants of the
+// chunks being emitted and the IR tree. Allocations are carved out of large blocks and never freed one by one;
+// release hands every block back at once. Blocks are mapped from the system on their own, so releasing them returns
+// the memory instead of leaving holes under what was allocated after them. It is a memory
+// resource so that standard containers can allocate from it too. Blocks are not counted in bytesAllocated, since no
+// garbage collection can free them.
+class Arena : public std::pmr::memory_resource
+{
+    struct Block
+    {
+        Block *previous;
+        size_t capacity;
+    };
+
+    // Block headers are padded to the largest fundamental alignment, so any allocation can start right after one.
+    static constexpr size_t HEADER_SIZE = (sizeof(Block) + alignof(std::max_align_t) - 1)
+                                          & ~(alignof(std::max_align_t) - 1);
+
+    Block *current = nullptr;
+    uint8_t *top = nullptr;
+    uint8_t *limit = nullptr;
+
+    void addBlock(size_t minimum);
+
+    static void freeBlock(Block *block);
+
+    void *do_allocate(size_t size, size_t alignment) override;
+
+    void do_deallocate(void *, size_t, size_t) override
+    {
+    }
+
+    [[nodiscard]] bool do_is_equal(const memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+public:
+    static constexpr size_t BLOCK_SIZE = 1024 * 1024;
+
+    Arena() = default;
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    ~Arena() override;
+
+    // Extends the allocation in place when nothing was allocated after it, and copies it otherwise.
+    template<typename T>
+    T *grow(T *pointer, const size_t oldCount, const size_t newCount)
+    {
+        if (pointer != nullptr && reinterpret_cast<uint8_t *>(pointer + oldCount) == top
+            && reinterpret_cast<uint8_t *>(pointer + newCount) <= limit)
+        {
+            top = reinterpret_cast<uint8_t *>(pointer + newCount);
+            return pointer;
+        }
+
+        const auto result = static_cast<T *>(allocate(sizeof(T) * newCount, alignof(T)));
+        if (oldCount > 0)
+        {
+            std::memcpy(result, pointer, sizeof(T) * std::min(oldCount, newCount));
+        }
+
+        return result;
+    }
+
+    void release();
+};
+
+// Grows storage in the arena when there is one, and through reallocate otherwise.
+template<typename T>
+T *growArray(Arena *arena, T *pointer, const size_t oldCount, const size_t newCount)
+{
+    return arena != nullptr ? arena->grow(pointer, oldCount, newCount) : growArray(pointer, oldCount, newCount);
+}
+
+#endif //ARENA_H
@@ -0,0 +1,105 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "environment.h"
+#include "heap.h"
+#include "object.h"
+#include "table.h"
+
+// What a native is called with: its receiver, which is the collection a bound method was read from and the native
+// itself otherwise, and its arguments, which stay on the caller's stack. It sets result, or error when it fails.
+struct NativeCall
+{
+    Heap &heap;
+    Value receiver;
+    Value *args;
+    int argCount;
+    Value result;
+    std::string &error;
+};
+
+// The collection types: the Array, List and Set constructors, declared as constant globals, the native methods of
+// their instances and the operations both VMs run on them. Every native is a root for as long as the Builtins live.
+// An operation that fails returns false and leaves the message of its runtime error in error().
+class Builtins : public RootSet
+{
+    Heap &heap;
+    std::vector<ObjNative *> natives{};
+    StringTable<ObjNative *> arrayMethods{};
+    StringTable<ObjNative *> listMethods{};
+    StringTable<ObjNative *> setMethods{};
+    ObjString *lengthName = nullptr;
+    std::string message{};
+
+    ObjNative *define(std::string_view name, NativeFn function, int arity);
+
+    void defineMethod(StringTable<ObjNative *> &methods, std::string_view name, NativeFn function, int arity);
+
+    [[nodiscard]] bool getIndexSlow(Value target, Value index, Value &result);
+
+    [[nodiscard]] bool setIndexSlow(Value target, Value index);
+
+public:
+    Builtins(Heap &heap, Environment &globals);
+
+    Builtins(const Builtins &) = delete;
+
+    Builtins &operator=(const Builtins &) = delete;
+
+    ~Builtins();
+
+    void markRoots(Heap &heap) override;
+
+    [[nodiscard]] const std::string &error() const
+    {
+        return message;
+    }
+
+    // Indexing an array or list by an integer is a bounds check and a load; strings, fractions, errors and every other
+    // case go through getIndexSlow. The bounds are checked first, so the conversion to int is always defined.
+    [[nodiscard]] bool getIndex(const Value target, const Value index, Value &result)
+    {
+        if (isSequence(target) && index.isNumber())
+        {
+            const auto sequence = asSequence(target);
+            if (const auto position = index.asNumber(); position >= 0 && position < sequence->count
+                                                        && static_cast<int>(position) == position)
+            {
+                result = sequence->values[static_cast<int>(position)];
+                return true;
+            }
+        }
+
+        return getIndexSlow(target, index, result);
+    }
+
+    [[nodiscard]] bool setIndex(const Value target, const Value index, const Value value)
+    {
+        if (isSequence(target) && index.isNumber())
+        {
+            const auto sequence = asSequence(target);
+            if (const auto position = index.asNumber(); position >= 0 && position < sequence->count
+                                                        && static_cast<int>(position) == position)
+            {
+                sequence->values[static_cast<int>(position)] = value;
+                heap.writeBarrier(sequence, value);
+                return true;
+            }
+        }
+
+        return setIndexSlow(target, index);
+    }
+
+    // A collection's length, or one of its methods bound to it.
+    [[nodiscard]] bool getProperty(Value receiver, ObjString *name, Value &result);
+
+    // Calls a native or bound native held in base, with the argCount arguments that follow it; the result replaces
+    // the callee in base.
+    [[nodiscard]] bool callNative(Value callee, Value *base, int argCount);
+};
+
+#endif //BUILTINS_H
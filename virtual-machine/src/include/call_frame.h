@@ -0,0 +1,15 @@
+#ifndef CALL_FRAME_H
+#define CALL_FRAME_H
+#include <cstdint>
+
+#include "object.h"
+
+// An active call. slots is the frame's window onto the value stack: slot 0 holds the callee, followed by its
+// arguments and locals. ip is only kept up to date for frames that are not executing.
+struct CallFrame
+{
+    ObjClosure *closure;
+    uint8_t *ip;
+    Value *slots;
+};
+#endif //CALL_FRAME_H
@@ -4,33 +4,119 @@
 #include <cstdint>
 #include <cstdlib>
 #include <iomanip>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
+#include "line_table.h"
 #include "value.h"
 
+// Operands that do not fit in a byte are encoded on three bytes, least significant first.
+constexpr int MAX_LONG_OPERAND = (1 << 24) - 1;
+
+inline int readLongOperand(const uint8_t *operand)
+{
+    return operand[0] | operand[1] << 8 | operand[2] << 16;
+}
+
+// Jump distances are encoded on two bytes, least significant first, and counted from the end of the jump.
+constexpr int MAX_JUMP = UINT16_MAX;
+
+inline int readShortOperand(const uint8_t *operand)
+{
+    return operand[0] | operand[1] << 8;
+}
+
+// The header of a block holding the code, line tables and constants of several chunks, which Chunk::pack moved out
+// of the arena they were compiled in. The last of those chunks to be freed frees the block.
+struct PackedBlock
+{
+    size_t size;
+    int chunks;
+};
+
+struct ObjString;
+
+// A local declared in a chunk, so a type error can name it. Locals are told apart by their slot and where they were
+// declared in the source, which the optimizer preserves, unlike offsets.
+struct LocalName
+{
+    ObjString *name;
+    SourceLocation declared;
+    int slot;
+};
+
+// While a chunk is compiled, everything it grows is allocated from the compiler's arena. Once its compilation unit
+// is finished, it is packed with the unit's other chunks. Its operands, constants and line table never change after
+// that, but the VM still quickens and dequickens opcodes in place, so packed code has to stay writable.
 struct Chunk
 {
     uint8_t *code;
-    int *lines;
+    LineTable lines;
     ValueArray constants;
+    std::pmr::unordered_map<uint64_t, int> constantIndices;
+    LocalName *localNames;
+    int localNameCount;
+    int localNameCapacity;
     int count;
     int capacity;
+    int maxStackDepth;
+    Arena *arena;
+    PackedBlock *packed;
+
+    explicit Chunk(Arena *arena = nullptr);
+
+    Chunk(const Chunk &) = delete;
 
-    Chunk();
+    Chunk &operator=(const Chunk &) = delete;
 
-    void write(uint8_t opcode, int line);
+    ~Chunk();
 
-    int addConstant(const Value &value);
+    void write(uint8_t opcode, SourceLocation location);
+
+    int addConstant(Value value);
+
+    void patchShortOperand(int offset, int value) const;
+
+    void addLocalName(ObjString *name, SourceLocation declared, int slot);
+
+    [[nodiscard]] std::string_view localName(int offset, int slot) const;
+
+    void swapCode(Chunk &other) noexcept;
+
+    void useArena(Arena *owner);
 
     void free();
 
+    // Copies the chunks, all compiled in the same arena, into one block sized to fit them exactly, with each chunk's
+    // constants, local names, code and line table next to each other. The arena can be released afterwards.
+    static void pack(const std::vector<Chunk *> &chunks);
+
+    [[nodiscard]] int computeStackDepth(int entryDepth) const;
+
     void disassemble(const std::string &name) const;
 
     [[nodiscard]] int disassembleInstruction(int offset) const;
 
+    [[nodiscard]] int disassembleOpcode(int offset) const;
+
+    static void printLocation(int offset, SourceLocation location, bool sameLine);
+
     [[nodiscard]] static int simpleInstruction(const std::string &name, int offset);
 
+    [[nodiscard]] int byteInstruction(const std::string &name, int offset) const;
+
+    [[nodiscard]] int longInstruction(const std::string &name, int offset) const;
+
+    [[nodiscard]] int jumpInstruction(const std::string &name, int sign, int offset) const;
+
     [[nodiscard]] int constantInstruction(const std::string &name, int offset) const;
+
+    [[nodiscard]] int longConstantInstruction(const std::string &name, int offset) const;
+
+    [[nodiscard]] int byteConstantInstruction(const std::string &name, int offset) const;
 };
 
 
@@ -1,7 +1,12 @@
 #ifndef COMMON_H
 #define COMMON_H
 
-#define DEBUG_TRACE_EXECUTION
-#define DEBUG_PRINT_CODE
+// Execution tracing is compiled in only when the build defines YAUPL_TRACING (every CMake configuration except
+// the release ones). Without it the VM has a single, uninstrumented dispatch loop.
+#ifdef YAUPL_TRACING
+constexpr bool TRACING_AVAILABLE = true;
+#else
+constexpr bool TRACING_AVAILABLE = false;
+#endif
 
 #endif //COMMON_H
@@ -1,26 +1,32 @@
 #ifndef COMPILER_H
 #define COMPILER_H
 #include <array>
+#include <optional>
 #include <string>
 
 #include "chunk.h"
-#include "parser.h"
+#include "compiler_base.h"
+#include "opcode.h"
+#include "optimizer.h"
 #include "parse_rule.h"
 #include "precedence.h"
-#include "scanner.h"
 #include "util.h"
 
-class Compiler
+class Compiler : public CompilerBase
 {
-    Parser parser;
+    int optimizationLevel = Optimizer::DEFAULT_LEVEL;
+    // Where the last OP_CALL ended, to spot a return value that is a call.
+    int lastCallEnd = -1;
+    // The type the expression compiled last has whenever it does not fail, if it is known at compile time.
+    std::optional<ValueType> expressionType{};
 
-    Chunk *compilingChunk = nullptr;
+    ObjFunction *endFunction();
 
-    Scanner scanner{""};
+    void declaration();
 
-    void advance();
+    void functionDeclaration();
 
-    void declaration();
+    void function(FunctionType);
 
     void statement();
 
@@ -30,6 +36,24 @@ class Compiler
 
     void printStatement();
 
+    void ifStatement();
+
+    void whileStatement();
+
+    void doWhileStatement();
+
+    void forStatement();
+
+    void breakStatement();
+
+    void continueStatement();
+
+    void returnStatement();
+
+    void block();
+
+    void endScope();
+
     void expressionStatement();
 
     void expression();
@@ -42,59 +66,74 @@ class Compiler
 
     void binary(bool);
 
-    void literal(bool);
+    void call(bool);
 
-    void string(bool);
+    void arrayLiteral(bool);
 
-    void variable(bool);
+    void subscript(bool);
 
-    void namedVariable(const Token &, bool);
+    void dot(bool);
+
+    void logicalAnd(bool);
 
-    void consume(TokenType, const std::string &);
+    void logicalOr(bool);
 
-    [[nodiscard]] bool match(TokenType);
+    void logicalXor(bool);
 
-    [[nodiscard]] bool check(TokenType) const;
+    void logicalNand(bool);
 
-    void errorAtCurrent(const std::string &);
+    void logicalNor(bool);
 
-    void error(const std::string &);
+    [[nodiscard]] uint8_t argumentList();
 
-    void errorAt(const Token &, const std::string &);
+    void literal(bool);
+
+    void string(bool);
+
+    void variable(bool);
+
+    void namedVariable(const Token &, bool);
 
     void emitByte(uint8_t) const;
 
     void emitByte(uint8_t, uint8_t) const;
 
-    void emitConstant(const Value&);
+    void emitIndexed(OpCode, OpCode, int) const;
 
-    [[ nodiscard]] uint8_t makeConstant(const Value &);
+    [[nodiscard]] int emitJump(OpCode) const;
 
-    void endCompiler() const;
+    void patchJump(int);
 
-    void synchronize();
+    void emitLoop(int);
 
-    void emitReturn() const;
+    void popLocalsAbove(int depth) const;
 
-    void parsePrecedence(Precedence);
+    void emitConstant(Value);
+
+    [[ nodiscard]] int makeConstant(Value);
+
+
+    void emitReturn() const;
 
-    void defineVariable(uint8_t) const;
+    [[nodiscard]] OpCode selectOperator(OpCode opcode, bool numbers) const;
 
-    void defineConstant(uint8_t) const;
+    void parsePrecedence(Precedence);
 
-    uint8_t parseVariable(const std::string &);
+    void defineVariable(int);
 
-    uint8_t identifierConstant(const Token &);
+    void defineConstant(int);
 
     [[ nodiscard]] ParseRule getRule(TokenType) const;
 
     std::array<ParseRule, static_cast<std::underlying_type_t<TokenType>>(TokenType::COUNT)> rules = {
-        ParseRule{&Compiler::grouping, nullptr, Precedence::None}, // Left paren
+        ParseRule{&Compiler::grouping, &Compiler::call, Precedence::Call}, // Left paren
         ParseRule{nullptr, nullptr, Precedence::None}, // Right paren
         ParseRule{nullptr, nullptr, Precedence::None}, // Left brace
         ParseRule{nullptr, nullptr, Precedence::None}, // Right brace
+        ParseRule{&Compiler::arrayLiteral, &Compiler::subscript, Precedence::Call}, // Left bracket
+        ParseRule{nullptr, nullptr, Precedence::None}, // Right bracket
         ParseRule{nullptr, nullptr, Precedence::None}, // Comma
-        ParseRule{nullptr, nullptr, Precedence::None}, // Dot
+        ParseRule{nullptr, &Compiler::dot, Precedence::Call}, // Dot
         ParseRule{&Compiler::unary, &Compiler::binary, Precedence::Term}, // Minus
         ParseRule{nullptr, &Compiler::binary, Precedence::Term}, // Plus
         ParseRule{nullptr, nullptr, Precedence::None}, // Semicolon
@@ -116,7 +155,7 @@ class Compiler
         ParseRule{&Compiler::variable, nullptr, Precedence::None}, // Identifier
         ParseRule{&Compiler::string, nullptr, Precedence::None}, // String
         ParseRule{&Compiler::number, nullptr, Precedence::None}, // Number
-        ParseRule{nullptr, nullptr, Precedence::None}, // And
+        ParseRule{nullptr, &Compiler::logicalAnd, Precedence::And}, // And
         ParseRule{nullptr, nullptr, Precedence::None}, // Class
         ParseRule{nullptr, nullptr, Precedence::None}, // Else
         ParseRule{&Compiler::literal, nullptr, Precedence::None}, // False
@@ -124,10 +163,10 @@ class Compiler
         ParseRule{nullptr, nullptr, Precedence::None}, // Fun
         ParseRule{nullptr, nullptr, Precedence::None}, // If
         ParseRule{&Compiler::literal, nullptr, Precedence::None}, // Nil
-        ParseRule{nullptr, nullptr, Precedence::None}, // Or
-        ParseRule{nullptr, nullptr, Precedence::None}, // Nand
-        ParseRule{nullptr, nullptr, Precedence::None}, // Nor
-        ParseRule{nullptr, nullptr, Precedence::None}, // Xor
+        ParseRule{nullptr, &Compiler::logicalOr, Precedence::Or}, // Or
+        ParseRule{nullptr, &Compiler::logicalNand, Precedence::Nand}, // Nand
+        ParseRule{nullptr, &Compiler::logicalNor, Precedence::Nor}, // Nor
+        ParseRule{nullptr, &Compiler::logicalXor, Precedence::Xor}, // Xor
         ParseRule{nullptr, nullptr, Precedence::None}, // Print
         ParseRule{nullptr, nullptr, Precedence::None}, // Return
         ParseRule{nullptr, nullptr, Precedence::None}, // Super
@@ -146,7 +185,13 @@ class Compiler
     };
 
 public:
-    bool compile(const std::string &source, Chunk *chunk);
+    Compiler(Heap &heap, Environment &globals): CompilerBase(heap, globals)
+    {
+    }
+
+    [[nodiscard]] ObjFunction *compile(const std::string &source);
+
+    void setOptimizationLevel(int level);
 };
 
 #endif //COMPILER_H
@@ -0,0 +1,103 @@
+#ifndef COMPILER_BASE_H
+#define COMPILER_BASE_H
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "chunk.h"
+#include "environment.h"
+#include "function_scope.h"
+#include "heap.h"
+#include "parser.h"
+#include "scanner.h"
+
+// The parts of compilation that do not depend on the instruction format: scanning and parsing helpers, error
+// reporting and the resolution of names to locals, upvalues and global slots. Each backend's compiler builds on it.
+// The functions still being compiled are roots of the heap, since nothing else refers to them yet. Code and constants
+// are emitted into them without write barriers, so they are traced again by every collection, and once more by the
+// next one after they are left. Their chunks grow in the compiler's arena until finishCompilation packs every chunk
+// of the compilation unit into one block; until then the unit's functions are kept alive, so none is freed while its
+// chunk still points into the arena.
+class CompilerBase : public RootSet
+{
+protected:
+    Heap &heap;
+
+    Environment &globals;
+
+    Parser parser;
+
+    FunctionScope *current = nullptr;
+
+    Scanner scanner{""};
+
+    Arena arena{};
+
+    std::vector<ObjFunction *> unitFunctions{};
+
+    // Whether locals are named in the chunk as they are declared. The IR only knows their slots once it is lowered.
+    bool namesLocals;
+
+    CompilerBase(Heap &heap, Environment &globals, const bool namesLocals = true): heap(heap), globals(globals),
+                                                                                  namesLocals(namesLocals)
+    {
+        heap.addRoots(this);
+    }
+
+    ~CompilerBase()
+    {
+        heap.removeRoots(this);
+    }
+
+    CompilerBase(const CompilerBase &) = delete;
+
+    CompilerBase &operator=(const CompilerBase &) = delete;
+
+    [[nodiscard]] Chunk *currentChunk() const;
+
+    void beginFunction(FunctionScope &scope, FunctionType type);
+
+    void leaveFunction();
+
+    void finishCompilation();
+
+    void advance();
+
+    void beginScope();
+
+    void consume(TokenType, std::string_view);
+
+    [[nodiscard]] bool match(TokenType);
+
+    [[nodiscard]] bool check(TokenType) const;
+
+    void errorAtCurrent(std::string_view);
+
+    void error(std::string_view);
+
+    void errorAt(const Token &, std::string_view);
+
+    void synchronize();
+
+    int parseVariable(std::string_view, bool constant = false);
+
+    void declareLocal(bool constant);
+
+    void addLocal(const Token &, bool constant);
+
+    void markInitialized();
+
+    [[nodiscard]] int resolveLocal(FunctionScope *, const Token &);
+
+    [[nodiscard]] int resolveUpvalue(FunctionScope *, const Token &);
+
+    [[nodiscard]] int addUpvalue(FunctionScope *, int index, bool isLocal, bool constant);
+
+    int globalSlot(const Token &);
+
+public:
+    void markRoots(Heap &heap) override;
+};
+
+#endif //COMPILER_BASE_H
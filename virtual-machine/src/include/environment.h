@@ -1,29 +1,91 @@
 #ifndef ENVIRONMENT_H
 #define ENVIRONMENT_H
 
-#include <optional>
-#include <unordered_map>
-#include <string>
-#include <unordered_set>
+#include <vector>
 
+#include "object.h"
+#include "table.h"
 #include "value.h"
 
+class Heap;
+
 enum class EnvironmentSetResult { OK, NOT_DEFINED, CONSTANT_NOT_REASSIGNABLE, TYPE_MISMATCH };
 
 enum class EnvironmentDeclareResult { OK, ALREADY_DEFINED };
 
+struct GlobalSlot
+{
+    Value value;
+    ObjString *name;
+    ValueType type;
+    bool defined;
+    bool constant;
+    bool dirty;
+};
+
+// Globals live in a dense array. The compiler resolves every global name to its slot once, so the VM only ever
+// indexes into slots and never hashes a name at runtime. Slots that were given an object since the last collection
+// are listed as dirty, which is all a minor collection needs to scan: everything the others hold has been promoted.
 class Environment
 {
-    std::unordered_map<std::string, Value> bindings{};
-    std::unordered_set<std::string> constants{};
+    std::vector<GlobalSlot> slots{};
+    StringTable<int> indices{};
+    std::vector<int> dirtySlots{};
+
+    void markDirty(const int index)
+    {
+        if (!slots[index].dirty)
+        {
+            slots[index].dirty = true;
+            dirtySlots.push_back(index);
+        }
+    }
 
 public:
     Environment() = default;
 
-    EnvironmentDeclareResult declare(const std::string &name, const Value &value, bool constant = false);
+    int resolve(ObjString *name);
+
+    EnvironmentDeclareResult declare(int index, Value value, bool constant = false);
+
+    EnvironmentSetResult set(const int index, const Value value)
+    {
+        auto &slot = slots[index];
+        if (!slot.defined)
+        {
+            return EnvironmentSetResult::NOT_DEFINED;
+        }
+
+        if (slot.constant)
+        {
+            return EnvironmentSetResult::CONSTANT_NOT_REASSIGNABLE;
+        }
+
+        const auto type = typeOf(value);
+        if (!isAssignable(slot.type, type))
+        {
+            return EnvironmentSetResult::TYPE_MISMATCH;
+        }
+
+        if (type != ValueType::NIL)
+        {
+            slot.type = type;
+        }
+
+        slot.value = value;
+        if (value.isObject())
+        {
+            markDirty(index);
+        }
+
+        return EnvironmentSetResult::OK;
+    }
 
-    EnvironmentSetResult set(const std::string &name, const Value &value);
+    [[nodiscard]] const GlobalSlot &get(const int index) const
+    {
+        return slots[index];
+    }
 
-    std::optional<Value> get(const std::string &name) const;
+    void markRoots(Heap &heap);
 };
 #endif //ENVIRONMENT_H
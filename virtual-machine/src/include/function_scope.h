@@ -0,0 +1,31 @@
+#ifndef FUNCTION_SCOPE_H
+#define FUNCTION_SCOPE_H
+#include <array>
+#include <cstdint>
+
+#include "local.h"
+#include "loop.h"
+#include "object.h"
+
+enum class FunctionType { FUNCTION, SCRIPT };
+
+// Compilation state of one function. Nested function declarations push a new scope that points back at the
+// enclosing one, which is where upvalues are resolved.
+struct FunctionScope
+{
+    static constexpr int MAX_LOCALS = UINT8_MAX + 1;
+
+    FunctionScope *enclosing;
+    ObjFunction *function;
+    FunctionType type;
+    std::array<Local, MAX_LOCALS> locals{};
+    int localCount = 0;
+    int scopeDepth = 0;
+    Loop *innermostLoop = nullptr;
+
+    // Register allocation, only used by the register compiler: locals occupy the registers below localCount and
+    // temporaries are allocated above them, in stack order.
+    int nextRegister = 0;
+    int maxRegisters = 0;
+};
+#endif //FUNCTION_SCOPE_H
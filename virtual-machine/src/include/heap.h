@@ -0,0 +1,207 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "object.h"
+#include "pause_histogram.h"
+#include "table.h"
+
+class Heap;
+
+// Holds references to objects that no other object does, such as a VM's stack and globals or the functions a
+// compiler has not finished. Every collection starts by asking each registered root set to mark them.
+class RootSet
+{
+public:
+    virtual void markRoots(Heap &heap) = 0;
+
+protected:
+    ~RootSet() = default;
+};
+
+enum class PauseKind { MINOR, REMARK, FULL };
+
+// Pause times of each kind of collection. Minor pauses include the incremental marking step or the root scan that
+// starts a marking cycle, when one is taken with them.
+struct GcStats
+{
+    PauseHistogram minor{};
+    PauseHistogram remark{};
+    PauseHistogram full{};
+    uint64_t promotedObjects = 0;
+
+    [[nodiscard]] PauseHistogram all() const
+    {
+        auto histogram = minor;
+        histogram.merge(remark);
+        histogram.merge(full);
+        return histogram;
+    }
+};
+
+// Owns every object and collects the ones no root reaches, precisely and without moving anything. New objects are
+// allocated into the nursery, which is collected on its own once NURSERY_SIZE bytes have been allocated since it was
+// last emptied: only roots and remembered old objects are traced, the nursery's survivors are promoted into the old
+// generation and everything else in it is freed. Old objects are never traced by a minor collection, so a store of a
+// reference into one must go through writeBarrier, which puts the object in the remembered set.
+//
+// Once the heap has grown past a multiple of what survived the last full marking, the old generation is marked
+// incrementally: the roots are scanned once, and each minor collection after that traces up to MARK_STEP objects.
+// While marking runs, the barrier also remembers old objects that gain a reference to an old one, and objects
+// promoted in the meantime are already marked. When no gray objects are left, a remark pause scans the roots and
+// the remembered set again and sweeps both generations.
+//
+// Collections only run before an object is allocated, so no other code needs to keep the objects it is working on
+// reachable while it grows an array. Interned strings are weak references: a string nothing else reaches is dropped
+// from the intern table when it is freed.
+class Heap
+{
+    Obj *nursery = nullptr;
+    Obj *oldObjects = nullptr;
+    StringTable<std::monostate> strings{};
+    std::vector<RootSet *> rootSets{};
+    std::vector<Obj *> grayYoung{};
+    std::vector<Obj *> grayOld{};
+    std::vector<Obj *> remembered{};
+    size_t nurseryStart = 0;
+    size_t nextMarking = FIRST_MARKING;
+    bool tracingNursery = false;
+    bool minorCollection = false;
+    bool marking = false;
+    bool stressMode = false;
+    GcStats stats{};
+
+    void collectIfDue();
+
+    template<typename T>
+    T *allocateObject(ObjType type);
+
+    template<typename T>
+    T *placeObject(ObjType type);
+
+    void collectNursery();
+
+    void beginMarking();
+
+    void finishMarking();
+
+    void markRootSets();
+
+    void traceRemembered();
+
+    void traceGray(size_t budget);
+
+    void blacken(Obj *object);
+
+    void sweepNursery();
+
+    void sweepOldObjects();
+
+    void release(Obj *object);
+
+    ObjString *allocateString(char *chars, int length, uint32_t hash);
+
+    ObjString *newLeaf(ObjString *a, ObjString *b);
+
+    ObjString *newRope(ObjString *left, ObjString *right);
+
+    static void freeObject(Obj *object);
+
+    static void freeList(Obj *object);
+
+public:
+    static constexpr size_t NURSERY_SIZE = 256 * 1024;
+    static constexpr size_t FIRST_MARKING = 1024 * 1024;
+    static constexpr size_t GROWTH_FACTOR = 2;
+    static constexpr size_t MARK_STEP = 4096;
+    static constexpr size_t STRESS_MARK_STEP = 8;
+    static constexpr int MIN_ROPE_LENGTH = 64;
+    static constexpr int ROPE_LEAF_SIZE = 256;
+
+    Heap() = default;
+
+    Heap(const Heap &) = delete;
+
+    Heap &operator=(const Heap &) = delete;
+
+    ~Heap();
+
+    ObjString *copyString(const std::string_view &chars);
+
+    ObjString *takeString(char *chars, int length);
+
+    // The caller keeps a and b reachable, since a rope still refers to them after the allocation.
+    ObjString *concatenate(ObjString *a, ObjString *b);
+
+    ObjFunction *newFunction();
+
+    ObjClosure *newClosure(ObjFunction *function);
+
+    ObjUpvalue *newUpvalue(Value *slot);
+
+    // Elements start out null.
+    ObjArray *newArray(int count);
+
+    ObjList *newList(int capacity);
+
+    ObjSet *newSet();
+
+    ObjNative *newNative(NativeFn function, ObjString *name, int arity);
+
+    // The caller keeps the receiver reachable.
+    ObjBoundNative *newBoundNative(Value receiver, ObjNative *method);
+
+    void freeObjects();
+
+    void addRoots(RootSet *roots);
+
+    void removeRoots(RootSet *roots);
+
+    void markValue(Value value);
+
+    void markObject(Obj *object);
+
+    // For an object written without a barrier, such as a function a compiler is still emitting code into: it is
+    // traced again by the next collection, whatever its generation and mark.
+    void rescanObject(Obj *object);
+
+    void writeBarrier(Obj *owner, const Obj *object)
+    {
+        if (owner->old && !owner->remembered && object != nullptr && (marking || !object->old))
+        {
+            rescanObject(owner);
+        }
+    }
+
+    void writeBarrier(Obj *owner, const Value value)
+    {
+        if (value.isObject())
+        {
+            writeBarrier(owner, value.asObject());
+        }
+    }
+
+    // Root sets that are cheap to scan in part, like the globals, only need to mark what changed since the last
+    // collection during a minor one.
+    [[nodiscard]] bool isMinorCollection() const
+    {
+        return minorCollection;
+    }
+
+    // Marks everything reachable and sweeps both generations in one pause, finishing a marking cycle in progress.
+    void collectGarbage();
+
+    // Runs a minor collection before every allocation and keeps a marking cycle in progress with small steps, so
+    // that any object left unreachable while still in use, or missed by a barrier, is freed at once.
+    void enableStressMode();
+
+    [[nodiscard]] const GcStats &gcStats() const
+    {
+        return stats;
+    }
+};
+
+#endif //HEAP_H
@@ -0,0 +1,166 @@
+#ifndef IR_H
+#define IR_H
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "heap.h"
+#include "line_table.h"
+#include "object.h"
+#include "opcode.h"
+#include "value.h"
+
+enum class IrKind: uint8_t
+{
+    // Expressions, which leave one value.
+    CONSTANT,
+    GET_LOCAL,
+    SET_LOCAL,
+    GET_UPVALUE,
+    SET_UPVALUE,
+    GET_GLOBAL,
+    SET_GLOBAL,
+    UNARY,
+    BINARY,
+    LOGICAL,
+    CALL,
+    CLOSURE,
+    ARRAY,
+    INDEX_GET,
+    INDEX_SET,
+    GET_PROPERTY,
+
+    // Statements.
+    EXPRESSION,
+    PRINT,
+    DECLARE_LOCAL,
+    DEFINE_GLOBAL,
+    BLOCK,
+    IF,
+    LOOP,
+    BREAK,
+    CONTINUE,
+    RETURN
+};
+
+// while and for test their condition before the body, do while after it. A for loop's increment runs between the
+// body and the next test, and is where its continue statements go.
+enum class IrLoopForm: uint8_t { WHILE, DO_WHILE, FOR };
+
+struct IrFunction;
+
+// One node of the tree IrCompiler builds. Which fields are used depends on the kind:
+// - index is the variable of GET_LOCAL, SET_LOCAL and DECLARE_LOCAL, the upvalue of GET_UPVALUE and SET_UPVALUE and
+//   the global slot of GET_GLOBAL, SET_GLOBAL and DEFINE_GLOBAL;
+// - operand is the assigned or declared value, the operand of UNARY, the callee of CALL, the receiver of
+//   GET_PROPERTY, whose name is value, the value of EXPRESSION, PRINT and RETURN and the condition of IF and LOOP;
+// - left and right are the operands of BINARY and LOGICAL and the collection and index of INDEX_GET. opcode is the
+//   operator of UNARY and BINARY, and the jump that short-circuits a LOGICAL: OP_JUMP_IF_FALSE_OR_POP for and and
+//   nand, OP_JUMP_IF_TRUE_OR_POP for or and nor, with negated set for nand and nor;
+// - body and alternative are the branches of IF and the body of LOOP, whose increment is increment;
+// - children are the statements of BLOCK, the arguments of CALL, the elements of ARRAY and the collection, index and
+//   value of INDEX_SET.
+// location is where the single-pass compiler would have emitted the node's instruction, so runtime errors report
+// the same positions with either pipeline.
+struct IrNode
+{
+    IrKind kind;
+    SourceLocation location;
+    OpCode opcode = OpCode::OP_RETURN;
+    Value value = Value::null();
+    int index = 0;
+    bool constant = false;
+    bool negated = false;
+    IrLoopForm form = IrLoopForm::WHILE;
+    IrNode *operand = nullptr;
+    IrNode *left = nullptr;
+    IrNode *right = nullptr;
+    IrNode *body = nullptr;
+    IrNode *alternative = nullptr;
+    IrNode *increment = nullptr;
+    IrFunction *function = nullptr;
+    std::vector<IrNode *> children{};
+};
+
+// A local variable. Variables are numbered per function, and only get a stack slot when the tree is lowered, so
+// passes are free to add or remove them. Captured variables may change behind any call, through a closure.
+struct IrVariable
+{
+    std::string_view name;
+    SourceLocation declared;
+    bool constant;
+    bool captured;
+};
+
+// Variable 0 stands for the reserved slot 0, the parameters follow it. For each of the function's upvalues that
+// captures a local of the enclosing function, upvalueVariables holds that local's variable, and -1 otherwise.
+struct IrFunction
+{
+    ObjFunction *function;
+    IrNode *body = nullptr;
+    std::vector<IrVariable> variables{};
+    std::vector<int> upvalueVariables{};
+};
+
+// Owns every node and function of one compilation; the tree itself only holds plain pointers. They are allocated
+// from the compiler's arena, and the pool only has to run their destructors before the arena is released.
+class IrPool
+{
+    Arena &arena;
+    std::vector<IrNode *> nodes;
+    std::vector<IrFunction *> functions;
+
+public:
+    explicit IrPool(Arena &arena): arena(arena)
+    {
+    }
+
+    IrPool(const IrPool &) = delete;
+
+    IrPool &operator=(const IrPool &) = delete;
+
+    ~IrPool()
+    {
+        clear();
+    }
+
+    IrNode *node(const IrKind kind, const SourceLocation location)
+    {
+        nodes.push_back(new(arena.allocate(sizeof(IrNode), alignof(IrNode))) IrNode{kind, location});
+        return nodes.back();
+    }
+
+    IrFunction *function(ObjFunction *function)
+    {
+        functions.push_back(new(arena.allocate(sizeof(IrFunction), alignof(IrFunction))) IrFunction{function});
+        return functions.back();
+    }
+
+    void clear()
+    {
+        for (const auto node: nodes)
+        {
+            std::destroy_at(node);
+        }
+
+        for (const auto function: functions)
+        {
+            std::destroy_at(function);
+        }
+
+        nodes.clear();
+        functions.clear();
+    }
+
+    // Constants only live in the tree until it is lowered.
+    void markRoots(Heap &heap) const
+    {
+        for (const auto node: nodes)
+        {
+            heap.markValue(node->value);
+        }
+    }
+};
+
+#endif //IR_H
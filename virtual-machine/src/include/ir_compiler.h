@@ -0,0 +1,253 @@
+#ifndef IR_COMPILER_H
+#define IR_COMPILER_H
+#include <array>
+#include <string>
+#include <vector>
+
+#include "compiler_base.h"
+#include "ir.h"
+#include "opcode.h"
+#include "optimizer.h"
+#include "precedence.h"
+
+// The optimizing pipeline of the stack backend. Instead of emitting bytes while parsing, it builds an IrFunction tree
+// per function, runs the IrOptimizer passes over the whole program and only then lowers the trees to the same
+// bytecode the single-pass Compiler produces, peephole optimizer included.
+class IrCompiler : public CompilerBase
+{
+    using ParseFn = IrNode *(IrCompiler::*)(bool, IrNode *);
+
+    struct Rule
+    {
+        ParseFn prefix;
+        ParseFn infix;
+        Precedence precedence;
+    };
+
+    // Parsing state of one function, next to its FunctionScope: the variable each local slot currently stands for.
+    struct FunctionState
+    {
+        FunctionState *enclosing;
+        IrFunction *ir;
+        std::array<int, FunctionScope::MAX_LOCALS> localVariables{};
+        int loopDepth = 0;
+    };
+
+    // Lowering state of one function. slots maps variables to stack slots, live lists the variables occupying the
+    // stack in slot order.
+    struct LoweringLoop
+    {
+        int liveCount;
+        int continueTarget;
+        std::vector<int> breakJumps{};
+        std::vector<int> continueJumps{};
+    };
+
+    struct Lowering
+    {
+        IrFunction *ir;
+        std::vector<int> slots;
+        Lowering *enclosing;
+        std::vector<int> live{};
+        std::vector<LoweringLoop> loops{};
+    };
+
+    IrPool pool{arena};
+    FunctionState *state = nullptr;
+    Lowering *lowering = nullptr;
+    int optimizationLevel = Optimizer::DEFAULT_LEVEL;
+
+    void beginIrFunction(FunctionScope &scope, FunctionState &functionState, FunctionType type);
+
+    IrFunction *endIrFunction();
+
+    [[nodiscard]] IrNode *node(IrKind kind);
+
+    void declareVariable(int localCountBefore, bool constant);
+
+    void retireLocal(int slot) const;
+
+    [[nodiscard]] IrNode *declaration();
+
+    [[nodiscard]] IrNode *functionDeclaration();
+
+    [[nodiscard]] IrNode *function(FunctionType);
+
+    [[nodiscard]] IrNode *statement();
+
+    [[nodiscard]] IrNode *variableDeclaration();
+
+    [[nodiscard]] IrNode *constantDeclaration();
+
+    [[nodiscard]] IrNode *defineVariable(int global, IrNode *value, bool constant);
+
+    [[nodiscard]] IrNode *printStatement();
+
+    [[nodiscard]] IrNode *ifStatement();
+
+    [[nodiscard]] IrNode *whileStatement();
+
+    [[nodiscard]] IrNode *doWhileStatement();
+
+    [[nodiscard]] IrNode *forStatement();
+
+    [[nodiscard]] IrNode *loopBody();
+
+    [[nodiscard]] IrNode *breakStatement();
+
+    [[nodiscard]] IrNode *continueStatement();
+
+    [[nodiscard]] IrNode *returnStatement();
+
+    IrNode *block(IrNode *statements);
+
+    [[nodiscard]] IrNode *scopedBlock();
+
+    void endScope();
+
+    [[nodiscard]] IrNode *expressionStatement();
+
+    [[nodiscard]] IrNode *expression();
+
+    [[nodiscard]] IrNode *parsePrecedence(Precedence);
+
+    IrNode *number(bool, IrNode *);
+
+    IrNode *grouping(bool, IrNode *);
+
+    IrNode *unary(bool, IrNode *);
+
+    IrNode *binary(bool, IrNode *);
+
+    IrNode *call(bool, IrNode *);
+
+    IrNode *arrayLiteral(bool, IrNode *);
+
+    IrNode *subscript(bool, IrNode *);
+
+    IrNode *dot(bool, IrNode *);
+
+    IrNode *logicalAnd(bool, IrNode *);
+
+    IrNode *logicalOr(bool, IrNode *);
+
+    IrNode *logicalXor(bool, IrNode *);
+
+    IrNode *logicalNand(bool, IrNode *);
+
+    IrNode *logicalNor(bool, IrNode *);
+
+    IrNode *literal(bool, IrNode *);
+
+    IrNode *string(bool, IrNode *);
+
+    IrNode *variable(bool, IrNode *);
+
+    [[nodiscard]] IrNode *namedVariable(const Token &, bool);
+
+    [[nodiscard]] IrNode *constantNode(Value value);
+
+    [[nodiscard]] IrNode *logical(IrNode *left, OpCode jump, Precedence precedence, bool negated);
+
+    [[nodiscard]] Rule getRule(TokenType) const;
+
+    void lowerFunction(IrFunction *ir);
+
+    void lowerStatement(const IrNode *statement);
+
+    void lowerExpression(const IrNode *expression);
+
+    void lowerConstant(Value value, SourceLocation location);
+
+    void lowerLoop(const IrNode *loop);
+
+    void declareSlot(int variable);
+
+    void popLiveAbove(int liveCount, SourceLocation location);
+
+    void emitByte(uint8_t, SourceLocation) const;
+
+    void emitIndexed(OpCode, OpCode, int, SourceLocation) const;
+
+    [[nodiscard]] int emitJump(OpCode, SourceLocation) const;
+
+    void patchJump(int offset, SourceLocation location);
+
+    void emitLoop(int loopStart, SourceLocation location);
+
+    [[nodiscard]] int makeConstant(Value, SourceLocation);
+
+    void loweringError(SourceLocation location, std::string_view message);
+
+    std::array<Rule, static_cast<std::underlying_type_t<TokenType>>(TokenType::COUNT)> rules = {
+        Rule{&IrCompiler::grouping, &IrCompiler::call, Precedence::Call}, // Left paren
+        Rule{nullptr, nullptr, Precedence::None}, // Right paren
+        Rule{nullptr, nullptr, Precedence::None}, // Left brace
+        Rule{nullptr, nullptr, Precedence::None}, // Right brace
+        Rule{&IrCompiler::arrayLiteral, &IrCompiler::subscript, Precedence::Call}, // Left bracket
+        Rule{nullptr, nullptr, Precedence::None}, // Right bracket
+        Rule{nullptr, nullptr, Precedence::None}, // Comma
+        Rule{nullptr, &IrCompiler::dot, Precedence::Call}, // Dot
+        Rule{&IrCompiler::unary, &IrCompiler::binary, Precedence::Term}, // Minus
+        Rule{nullptr, &IrCompiler::binary, Precedence::Term}, // Plus
+        Rule{nullptr, nullptr, Precedence::None}, // Semicolon
+        Rule{nullptr, &IrCompiler::binary, Precedence::Factor}, // Slash
+        Rule{nullptr, &IrCompiler::binary, Precedence::Factor}, // Star
+        Rule{nullptr, &IrCompiler::binary, Precedence::Exponent}, // Exponent
+        Rule{nullptr, &IrCompiler::binary, Precedence::Factor}, // Modulo
+        Rule{nullptr, nullptr, Precedence::None}, // Colon
+        Rule{&IrCompiler::unary, nullptr, Precedence::None}, // Bang
+        Rule{nullptr, &IrCompiler::binary, Precedence::Equality}, // Bang equal
+        Rule{nullptr, nullptr, Precedence::None}, // Equal
+        Rule{nullptr, &IrCompiler::binary, Precedence::Equality}, // Equal equal
+        Rule{nullptr, &IrCompiler::binary, Precedence::Comparison}, // Greater
+        Rule{nullptr, &IrCompiler::binary, Precedence::Comparison}, // Greater equal
+        Rule{nullptr, &IrCompiler::binary, Precedence::Comparison}, // Less
+        Rule{nullptr, &IrCompiler::binary, Precedence::Comparison}, // Less equal
+        Rule{nullptr, nullptr, Precedence::None}, // Left shift
+        Rule{nullptr, nullptr, Precedence::None}, // Right shift
+        Rule{&IrCompiler::variable, nullptr, Precedence::None}, // Identifier
+        Rule{&IrCompiler::string, nullptr, Precedence::None}, // String
+        Rule{&IrCompiler::number, nullptr, Precedence::None}, // Number
+        Rule{nullptr, &IrCompiler::logicalAnd, Precedence::And}, // And
+        Rule{nullptr, nullptr, Precedence::None}, // Class
+        Rule{nullptr, nullptr, Precedence::None}, // Else
+        Rule{&IrCompiler::literal, nullptr, Precedence::None}, // False
+        Rule{nullptr, nullptr, Precedence::None}, // For
+        Rule{nullptr, nullptr, Precedence::None}, // Fun
+        Rule{nullptr, nullptr, Precedence::None}, // If
+        Rule{&IrCompiler::literal, nullptr, Precedence::None}, // Nil
+        Rule{nullptr, &IrCompiler::logicalOr, Precedence::Or}, // Or
+        Rule{nullptr, &IrCompiler::logicalNand, Precedence::Nand}, // Nand
+        Rule{nullptr, &IrCompiler::logicalNor, Precedence::Nor}, // Nor
+        Rule{nullptr, &IrCompiler::logicalXor, Precedence::Xor}, // Xor
+        Rule{nullptr, nullptr, Precedence::None}, // Print
+        Rule{nullptr, nullptr, Precedence::None}, // Return
+        Rule{nullptr, nullptr, Precedence::None}, // Super
+        Rule{nullptr, nullptr, Precedence::None}, // This
+        Rule{&IrCompiler::literal, nullptr, Precedence::None}, // True
+        Rule{nullptr, nullptr, Precedence::None}, // Let
+        Rule{nullptr, nullptr, Precedence::None}, // While
+        Rule{nullptr, nullptr, Precedence::None}, // Break
+        Rule{nullptr, nullptr, Precedence::None}, // Continue
+        Rule{nullptr, nullptr, Precedence::None}, // Do
+        Rule{nullptr, nullptr, Precedence::None}, // Const
+        Rule{nullptr, nullptr, Precedence::None}, // Import
+        Rule{nullptr, nullptr, Precedence::None}, // Static
+        Rule{nullptr, nullptr, Precedence::None}, // EOF
+        Rule{nullptr, nullptr, Precedence::None}, // Error
+    };
+
+public:
+    IrCompiler(Heap &heap, Environment &globals): CompilerBase(heap, globals, false)
+    {
+    }
+
+    [[nodiscard]] ObjFunction *compile(const std::string &source);
+
+    void setOptimizationLevel(int level);
+
+    void markRoots(Heap &heap) override;
+};
+
+#endif //IR_COMPILER_H
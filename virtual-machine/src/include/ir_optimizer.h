@@ -0,0 +1,95 @@
+#ifndef IR_OPTIMIZER_H
+#define IR_OPTIMIZER_H
+#include <vector>
+
+#include "heap.h"
+#include "ir.h"
+
+// The passes IrCompiler runs before lowering, over every function of the program:
+// - constant folding, with the peephole optimizer's rules, which also resolves branches and loops on constants;
+// - copy propagation: a local that is never reassigned and starts as a constant or as another such local is
+//   replaced by it wherever it is read;
+// - common subexpression elimination: a pure expression already computed into a local that is still valid is read
+//   from that local instead of being computed again;
+// - loop-invariant code motion: a pure expression that cannot fail and only reads locals the loop never assigns is
+//   computed once into a new local before the loop;
+// - dead code elimination: statements after a return, break or continue, expression statements without effects and
+//   locals that are never used;
+// - type selection: arithmetic and comparisons on operands proven to be numbers use the unchecked OP_NUM_ operators.
+// Calls are free to change captured locals through their upvalues, so only uncaptured locals are ever reasoned about.
+// An expression "cannot fail" when it could not raise a runtime error: every operand of arithmetic is known to be a
+// number, from the values ever assigned to the locals it reads.
+class IrOptimizer
+{
+    struct Usage
+    {
+        int reads = 0;
+        int writes = 0;
+        IrNode *declaration = nullptr;
+        std::vector<IrNode *> assignedValues{};
+        bool numeric = false;
+    };
+
+    // A pure expression whose value is held by a local.
+    struct Available
+    {
+        const IrNode *expression;
+        int variable;
+    };
+
+    Heap &heap;
+    IrPool &pool;
+    IrFunction *function = nullptr;
+    std::vector<Usage> usages{};
+
+    void optimize(IrFunction *ir);
+
+    void optimizeNested(IrNode *node);
+
+    void analyze();
+
+    void count(IrNode *node);
+
+    void inferNumbers();
+
+    [[nodiscard]] IrNode *fold(IrNode *node);
+
+    void propagateCopies();
+
+    void eliminateCommonSubexpressions(IrNode *statement, std::vector<Available> &available);
+
+    void replaceAvailable(IrNode *&expression, const std::vector<Available> &available);
+
+    void hoistLoopInvariants(IrNode *&statement);
+
+    void hoistFromLoop(IrNode *&expression, const std::vector<bool> &assigned, std::vector<IrNode *> &hoisted);
+
+    [[nodiscard]] bool eliminateDeadCode(IrNode *statement);
+
+    [[nodiscard]] bool isDead(const IrNode *statement) const;
+
+    void selectNumberOperators(IrNode *node);
+
+    [[nodiscard]] std::vector<bool> assignedIn(IrNode *node) const;
+
+    [[nodiscard]] bool isNumeric(const IrNode *expression) const;
+
+    [[nodiscard]] bool cannotFail(const IrNode *expression) const;
+
+    [[nodiscard]] bool isPure(const IrNode *expression) const;
+
+    [[nodiscard]] bool isInvariant(const IrNode *expression, const std::vector<bool> &assigned) const;
+
+    [[nodiscard]] bool isCaptured(int variable) const;
+
+    [[nodiscard]] IrNode *constant(Value value, SourceLocation location);
+
+    [[nodiscard]] IrNode *readLocal(int variable, SourceLocation location);
+
+public:
+    IrOptimizer(Heap &heap, IrPool &pool);
+
+    void run(IrFunction *program);
+};
+
+#endif //IR_OPTIMIZER_H
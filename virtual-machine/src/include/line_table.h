@@ -0,0 +1,86 @@
+#ifndef LINE_TABLE_H
+#define LINE_TABLE_H
+
+#include <compare>
+#include <cstdint>
+
+#include "arena.h"
+
+struct SourceLocation
+{
+    int line;
+    int column;
+
+    auto operator<=>(const SourceLocation &) const = default;
+};
+
+// Maps bytecode offsets back to source locations. Instead of one entry per byte, the table stores a run for every
+// offset at which the location changes, delta-encoded as variable-length integers: the distance from the previous
+// run's offset, the line delta (zigzag encoded, since it can be negative) and the column. Lookups decode from the
+// start, which is fine because they only happen when reporting errors or disassembling.
+class LineTable
+{
+    uint8_t *bytes = nullptr;
+    int count = 0;
+    int capacity = 0;
+    int lastOffset = 0;
+    SourceLocation last{0, 0};
+    bool empty = true;
+    Arena *arena = nullptr;
+
+    void writeByte(uint8_t byte);
+
+    void writeVarint(uint32_t value);
+
+public:
+    // Walks the runs forward. Seeking to an offset before the current run starts over from the beginning, so a
+    // cursor stays cheap for the mostly increasing offsets of a disassembly or a trace.
+    class Cursor
+    {
+        const LineTable *table;
+        int position = 0;
+        int runOffset = 0;
+        SourceLocation location{0, 0};
+
+        bool decodeNext(int &offset, SourceLocation &next, int &end) const;
+
+        uint32_t readVarint(int &at) const;
+
+        void restart();
+
+    public:
+        explicit Cursor(const LineTable &table);
+
+        [[nodiscard]] SourceLocation seek(int offset);
+    };
+
+    LineTable() = default;
+
+    LineTable(const LineTable &) = delete;
+
+    LineTable &operator=(const LineTable &) = delete;
+
+    ~LineTable();
+
+    void add(int offset, SourceLocation location);
+
+    [[nodiscard]] SourceLocation lookup(int offset) const;
+
+    [[nodiscard]] int size() const;
+
+    void swap(LineTable &other) noexcept;
+
+    // The table's bytes are then allocated from the arena, which owns them.
+    void useArena(Arena *owner);
+
+    // Copies the bytes to storage with room for size() of them, which some other block of memory owns: the table is
+    // then released with forget rather than free.
+    void relocate(uint8_t *storage);
+
+    void free();
+
+    // Drops the bytes without freeing them, for bytes some other block of memory owns.
+    void forget();
+};
+
+#endif //LINE_TABLE_H
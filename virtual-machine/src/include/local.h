@@ -0,0 +1,19 @@
+#ifndef LOCAL_H
+#define LOCAL_H
+#include <optional>
+
+#include "object.h"
+#include "token.h"
+
+// A local variable lives in a stack slot. Its depth is the scope it was declared in, or -1 while its initializer is
+// still being compiled. Captured locals are moved off the stack into their upvalue when they go out of scope. type is
+// only known for constants.
+struct Local
+{
+    Token name;
+    int depth;
+    bool constant;
+    bool captured;
+    std::optional<ValueType> type{};
+};
+#endif //LOCAL_H
@@ -0,0 +1,15 @@
+#ifndef LOOP_H
+#define LOOP_H
+#include <vector>
+
+// The loop a break or continue statement belongs to. Jumps whose target is not known yet are recorded so they can be
+// patched once the loop is compiled: breaks always, continues only when the continue target follows the body.
+struct Loop
+{
+    Loop *enclosing;
+    int scopeDepth;
+    int continueTarget;
+    std::vector<int> breakJumps{};
+    std::vector<int> continueJumps{};
+};
+#endif //LOOP_H
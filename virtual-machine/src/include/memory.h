@@ -2,7 +2,9 @@
 #define MEMORY_H
 
 #include <concepts>
+#include <cstdint>
 #include <cstdlib>
+#include <memory>
 
 template<typename T>
     requires std::integral<T>
@@ -11,9 +13,15 @@ T growCapacity(T capacity)
     return capacity < 8 ? 8 : capacity * 2;
 }
 
+// Every block allocated through reallocate is counted here, which is what the garbage collector measures the heap
+// against: objects themselves as well as the arrays they, chunks and value stacks own.
+inline size_t bytesAllocated = 0;
+
 template<typename T>
 T *reallocate(T *pointer, const size_t oldSize, const size_t newSize)
 {
+    bytesAllocated += newSize;
+    bytesAllocated -= oldSize;
     if (newSize == 0)
     {
         free(pointer);
@@ -41,4 +49,13 @@ T *freeArray(T *pointer, const size_t oldSize)
     return reallocate(pointer, sizeof(T) * oldSize, 0);
 }
 
+// Runs an object's destructor and releases its memory as bytes, so realloc is never instantiated on a type that is
+// not trivially copyable.
+template<typename T>
+void destroyObject(T *object)
+{
+    std::destroy_at(object);
+    reallocate(reinterpret_cast<uint8_t *>(object), sizeof(T), 0);
+}
+
 #endif //MEMORY_H
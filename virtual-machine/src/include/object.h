@@ -0,0 +1,327 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <string_view>
+#include <vector>
+
+#include "chunk.h"
+#include "value.h"
+
+enum class ObjType: uint8_t
+{
+    STRING,
+    FUNCTION,
+    CLOSURE,
+    UPVALUE,
+    ARRAY,
+    LIST,
+    SET,
+    NATIVE,
+    BOUND_NATIVE
+};
+
+// Every object is on one of the heap's generation lists through next. old is set once the object survives a
+// nursery collection; marked is only set while a collection or a marking cycle is running, and remembered while the
+// object is in the heap's remembered set.
+struct Obj
+{
+    ObjType type;
+    bool marked = false;
+    bool old = false;
+    bool remembered = false;
+    Obj *next;
+};
+
+// Strings made by a long concatenation are ropes: chars stays null and the string is left followed by right, until
+// view needs the characters and flattens them into one buffer. Only interned strings can be compared by identity;
+// ropes, flattened or not, and the leaves built for them are never interned and have no hash.
+struct ObjString : Obj
+{
+    int length;
+    uint32_t hash;
+    char *chars;
+    ObjString *left = nullptr;
+    ObjString *right = nullptr;
+    bool interned = false;
+
+    [[nodiscard]] bool isRope() const
+    {
+        return chars == nullptr;
+    }
+
+    [[nodiscard]] std::string_view view()
+    {
+        if (isRope())
+        {
+            flatten();
+        }
+
+        return {chars, static_cast<size_t>(length)};
+    }
+
+    [[nodiscard]] bool equals(ObjString *other)
+    {
+        if (this == other)
+        {
+            return true;
+        }
+
+        if ((interned && other->interned) || length != other->length)
+        {
+            return false;
+        }
+
+        return view() == other->view();
+    }
+
+private:
+    void flatten();
+};
+
+// Where a closure finds a captured variable when it is created: a local slot of the enclosing function, or one of
+// the enclosing closure's own upvalues. Constness is only used by the compiler to reject assignments.
+struct UpvalueDescriptor
+{
+    uint8_t index;
+    bool isLocal;
+    bool constant;
+};
+
+struct ObjFunction : Obj
+{
+    int arity = 0;
+    Chunk chunk{};
+    ObjString *name = nullptr;
+    std::vector<UpvalueDescriptor> upvalues{};
+};
+
+// A captured variable. While open it points into the value stack; once the variable goes out of scope, the value is
+// moved into closed and location points there instead.
+struct ObjUpvalue : Obj
+{
+    Value *location;
+    Value closed;
+    ObjUpvalue *nextOpen;
+};
+
+struct ObjClosure : Obj
+{
+    ObjFunction *function;
+    ObjUpvalue **upvalues;
+    int upvalueCount;
+};
+
+// Arrays and lists keep their elements in one contiguous buffer, so indexing either is a bounds check and a load.
+// An array's length is fixed when it is created; a list grows its buffer like every other growable array.
+struct ObjArray : Obj
+{
+    Value *values;
+    int count;
+};
+
+struct ObjList : ObjArray
+{
+    int capacity;
+};
+
+// A slot of a set's index: where in values the element with this hash is, or -1 for an empty slot.
+struct SetSlot
+{
+    uint32_t hash;
+    int index;
+};
+
+// Elements are kept contiguous too, in the order they were added, and found through slots: an open-addressed index
+// probed linearly by hash, at most MAX_LOAD_PERCENT full, whose removals shift later entries back instead of leaving
+// tombstones. Removing an element moves the last one into its place, so the order is only insertion order until then.
+struct ObjSet : Obj
+{
+    static constexpr int MAX_LOAD_PERCENT = 75;
+
+    Value *values = nullptr;
+    int count = 0;
+    int capacity = 0;
+    SetSlot *slots = nullptr;
+    int slotCapacity = 0;
+
+    [[nodiscard]] bool contains(Value value);
+
+    // Both return whether the set changed.
+    bool insert(Value value);
+
+    bool erase(Value value);
+
+    void clear();
+
+private:
+    [[nodiscard]] SetSlot *findSlot(Value value, uint32_t hash);
+
+    void growSlots();
+};
+
+struct NativeCall;
+
+using NativeFn = bool (*)(NativeCall &call);
+
+// A function implemented in C++. arity is -1 for natives taking any number of arguments.
+struct ObjNative : Obj
+{
+    NativeFn function;
+    ObjString *name;
+    int arity;
+};
+
+// A native method read off the collection it is called on, which it receives as its receiver.
+struct ObjBoundNative : Obj
+{
+    Value receiver;
+    ObjNative *method;
+};
+
+inline uint32_t hashString(const std::string_view &chars)
+{
+    uint32_t hash = 2166136261u;
+    for (const auto c: chars)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+inline bool isObjType(const Value value, const ObjType type)
+{
+    return value.isObject() && value.asObject()->type == type;
+}
+
+inline bool isString(const Value value)
+{
+    return isObjType(value, ObjType::STRING);
+}
+
+inline ObjString *asString(const Value value)
+{
+    return static_cast<ObjString *>(value.asObject());
+}
+
+inline bool isClosure(const Value value)
+{
+    return isObjType(value, ObjType::CLOSURE);
+}
+
+// Arrays and lists, which index the same way.
+inline bool isSequence(const Value value)
+{
+    return value.isObject()
+           && (value.asObject()->type == ObjType::ARRAY || value.asObject()->type == ObjType::LIST);
+}
+
+inline ObjArray *asSequence(const Value value)
+{
+    return static_cast<ObjArray *>(value.asObject());
+}
+
+inline bool isNative(const Value value)
+{
+    return value.isObject()
+           && (value.asObject()->type == ObjType::NATIVE || value.asObject()->type == ObjType::BOUND_NATIVE);
+}
+
+// Interned strings are equal only when they are the same object, so only strings that are not interned need their
+// characters compared.
+inline bool valuesEqual(const Value x, const Value y)
+{
+    if (x.isNumber() && y.isNumber())
+    {
+        return x.asNumber() == y.asNumber();
+    }
+
+    return x.raw() == y.raw() || (isString(x) && isString(y) && asString(x)->equals(asString(y)));
+}
+
+// Consistent with valuesEqual: numbers hash by value, so 0 and -0 agree, strings by their characters, and every
+// other value by identity. Only interned strings have their hash at hand.
+inline uint32_t hashValue(const Value value)
+{
+    if (isString(value))
+    {
+        const auto string = asString(value);
+        return string->interned ? string->hash : hashString(string->view());
+    }
+
+    auto bits = value.isNumber() && value.asNumber() == 0 ? uint64_t{0} : value.raw();
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccd;
+    bits ^= bits >> 33;
+    return static_cast<uint32_t>(bits);
+}
+
+inline ObjFunction *asFunction(const Value value)
+{
+    return static_cast<ObjFunction *>(value.asObject());
+}
+
+inline ObjClosure *asClosure(const Value value)
+{
+    return static_cast<ObjClosure *>(value.asObject());
+}
+
+enum class ValueType: uint8_t
+{
+    NIL,
+    BOOL,
+    NUMBER,
+    STRING,
+    FUNCTION,
+    ARRAY,
+    LIST,
+    SET
+};
+
+inline ValueType typeOf(const Value value)
+{
+    if (value.isNumber())
+    {
+        return ValueType::NUMBER;
+    }
+
+    if (value.isBool())
+    {
+        return ValueType::BOOL;
+    }
+
+    if (value.isNull())
+    {
+        return ValueType::NIL;
+    }
+
+    switch (value.asObject()->type)
+    {
+        case ObjType::STRING:
+            return ValueType::STRING;
+        case ObjType::FUNCTION:
+        case ObjType::CLOSURE:
+        case ObjType::NATIVE:
+        case ObjType::BOUND_NATIVE:
+            return ValueType::FUNCTION;
+        case ObjType::ARRAY:
+            return ValueType::ARRAY;
+        case ObjType::LIST:
+            return ValueType::LIST;
+        case ObjType::SET:
+            return ValueType::SET;
+        case ObjType::UPVALUE:
+            break;
+    }
+
+    return ValueType::NIL;
+}
+
+// Null can be stored in any variable, and a variable holding null accepts a value of any type.
+inline bool isAssignable(const ValueType current, const ValueType type)
+{
+    return current == ValueType::NIL || type == ValueType::NIL || current == type;
+}
+
+#endif //OBJECT_H
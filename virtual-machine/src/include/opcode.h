@@ -1,33 +1,177 @@
 #ifndef OPCODE_H
 #define OPCODE_H
 #include <cstdint>
+#include <string_view>
+
+// Every opcode, in encoding order, with the number of operand bytes that follow it and its net effect on the
+// value stack (OP_CALL and OP_TAIL_CALL additionally pop their argument count, OP_ARRAY and OP_ARRAY_LONG their
+// element count, and the _OR_POP jumps keep their operand when they jump). The enum, the opcode info table and the
+// VM dispatch table are all generated from this list.
+#define YAUPL_OPCODES(X)                \
+    X(OP_RETURN, 0, -1)                 \
+    X(OP_CONSTANT, 1, 1)                \
+    X(OP_NULL, 0, 1)                    \
+    X(OP_TRUE, 0, 1)                    \
+    X(OP_FALSE, 0, 1)                   \
+    X(OP_NEGATE, 0, 0)                  \
+    X(OP_EQUAL, 0, -1)                  \
+    X(OP_GREATER, 0, -1)                \
+    X(OP_LESS, 0, -1)                   \
+    X(OP_ADD, 0, -1)                    \
+    X(OP_SUBTRACT, 0, -1)               \
+    X(OP_MULTIPLY, 0, -1)               \
+    X(OP_DIVIDE, 0, -1)                 \
+    X(OP_NOT, 0, 0)                     \
+    X(OP_EXPONENT, 0, -1)               \
+    X(OP_LSHIFT, 0, -1)                 \
+    X(OP_RSHIFT, 0, -1)                 \
+    X(OP_MODULO, 0, -1)                 \
+    X(OP_PRINT, 0, -1)                  \
+    X(OP_POP, 0, -1)                    \
+    X(OP_DEFINE_GLOBAL, 1, -1)          \
+    X(OP_DEFINE_CONSTANT, 1, -1)        \
+    X(OP_GET_GLOBAL, 1, 1)              \
+    X(OP_SET_GLOBAL, 1, 0)              \
+    X(OP_CONSTANT_LONG, 3, 1)           \
+    X(OP_DEFINE_GLOBAL_LONG, 3, -1)     \
+    X(OP_DEFINE_CONSTANT_LONG, 3, -1)   \
+    X(OP_GET_GLOBAL_LONG, 3, 1)         \
+    X(OP_SET_GLOBAL_LONG, 3, 0)         \
+    X(OP_ADD_NUM, 0, -1)                \
+    X(OP_ADD_STR, 0, -1)                \
+    X(OP_SUBTRACT_NUM, 0, -1)           \
+    X(OP_MULTIPLY_NUM, 0, -1)           \
+    X(OP_DIVIDE_NUM, 0, -1)             \
+    X(OP_GREATER_NUM, 0, -1)            \
+    X(OP_LESS_NUM, 0, -1)               \
+    X(OP_GET_LOCAL, 1, 1)               \
+    X(OP_SET_LOCAL, 1, 0)               \
+    X(OP_JUMP, 2, 0)                    \
+    X(OP_JUMP_IF_FALSE, 2, -1)          \
+    X(OP_LOOP, 2, 0)                    \
+    X(OP_CALL, 1, 0)                    \
+    X(OP_CLOSURE, 1, 1)                 \
+    X(OP_CLOSURE_LONG, 3, 1)            \
+    X(OP_GET_UPVALUE, 1, 1)             \
+    X(OP_SET_UPVALUE, 1, 0)             \
+    X(OP_CLOSE_UPVALUE, 0, -1)          \
+    X(OP_JUMP_IF_FALSE_OR_POP, 2, -1)   \
+    X(OP_JUMP_IF_TRUE_OR_POP, 2, -1)    \
+    X(OP_XOR, 0, -1)                    \
+    X(OP_GREATER_EQUAL, 0, -1)          \
+    X(OP_LESS_EQUAL, 0, -1)             \
+    X(OP_NOT_EQUAL, 0, -1)              \
+    X(OP_GREATER_EQUAL_NUM, 0, -1)      \
+    X(OP_LESS_EQUAL_NUM, 0, -1)         \
+    X(OP_LESS_JUMP, 2, -2)              \
+    X(OP_LESS_EQUAL_JUMP, 2, -2)        \
+    X(OP_GREATER_JUMP, 2, -2)           \
+    X(OP_GREATER_EQUAL_JUMP, 2, -2)     \
+    X(OP_GET_GLOBAL_ADD_CONST, 2, 1)    \
+    X(OP_INCREMENT_LOCAL, 2, 0)         \
+    X(OP_TAIL_CALL, 1, 0)               \
+    X(OP_NUM_NEGATE, 0, 0)              \
+    X(OP_NUM_ADD, 0, -1)                \
+    X(OP_NUM_SUBTRACT, 0, -1)           \
+    X(OP_NUM_MULTIPLY, 0, -1)           \
+    X(OP_NUM_DIVIDE, 0, -1)             \
+    X(OP_NUM_GREATER, 0, -1)            \
+    X(OP_NUM_LESS, 0, -1)               \
+    X(OP_NUM_GREATER_EQUAL, 0, -1)      \
+    X(OP_NUM_LESS_EQUAL, 0, -1)         \
+    X(OP_ARRAY, 1, 1)                   \
+    X(OP_INDEX_GET, 0, -1)              \
+    X(OP_INDEX_SET, 0, -2)              \
+    X(OP_GET_PROPERTY, 1, 0)            \
+    X(OP_GET_PROPERTY_LONG, 3, 0)       \
+    X(OP_ARRAY_LONG, 3, 1)
 
 enum class OpCode: uint8_t
 {
-    OP_RETURN = 0,
-    OP_CONSTANT = 1,
-    OP_NULL = 2,
-    OP_TRUE = 3,
-    OP_FALSE = 4,
-    OP_NEGATE = 5,
-    OP_EQUAL = 6,
-    OP_GREATER = 7,
-    OP_LESS = 8,
-    OP_ADD = 9,
-    OP_SUBTRACT = 10,
-    OP_MULTIPLY = 11,
-    OP_DIVIDE = 12,
-    OP_NOT = 13,
-    OP_EXPONENT = 14,
-    OP_LSHIFT = 15,
-    OP_RSHIFT = 16,
-    OP_MODULO = 17,
-    OP_PRINT = 18,
-    OP_POP = 19,
-    OP_DEFINE_GLOBAL = 20,
-    OP_DEFINE_CONSTANT = 21,
-    OP_GET_GLOBAL = 22,
-    OP_SET_GLOBAL = 23
+#define YAUPL_OPCODE_ENUM(opcode, operandBytes, stackEffect) opcode,
+    YAUPL_OPCODES(YAUPL_OPCODE_ENUM)
+#undef YAUPL_OPCODE_ENUM
+};
+
+struct OpCodeInfo
+{
+    std::string_view name;
+    int operandBytes;
+    int stackEffect;
 };
 
+inline constexpr OpCodeInfo OPCODE_INFO[] = {
+#define YAUPL_OPCODE_INFO(opcode, operandBytes, stackEffect) OpCodeInfo{#opcode, operandBytes, stackEffect},
+    YAUPL_OPCODES(YAUPL_OPCODE_INFO)
+#undef YAUPL_OPCODE_INFO
+};
+
+inline constexpr int OPCODE_COUNT = sizeof(OPCODE_INFO) / sizeof(OpCodeInfo);
+
+inline const OpCodeInfo &opcodeInfo(const OpCode opcode)
+{
+    return OPCODE_INFO[static_cast<uint8_t>(opcode)];
+}
+
+inline std::string_view opcodeName(const OpCode opcode)
+{
+    return opcodeInfo(opcode).name;
+}
+
+// The OP_NUM_ operators are emitted where the compiler proved every operand is a number, and skip the type checks
+// of the operator they stand for. Unlike the _NUM forms the VM quickens to, they are never undone at runtime.
+inline OpCode numberForm(const OpCode opcode)
+{
+    switch (opcode)
+    {
+        case OpCode::OP_NEGATE:
+            return OpCode::OP_NUM_NEGATE;
+        case OpCode::OP_ADD:
+            return OpCode::OP_NUM_ADD;
+        case OpCode::OP_SUBTRACT:
+            return OpCode::OP_NUM_SUBTRACT;
+        case OpCode::OP_MULTIPLY:
+            return OpCode::OP_NUM_MULTIPLY;
+        case OpCode::OP_DIVIDE:
+            return OpCode::OP_NUM_DIVIDE;
+        case OpCode::OP_GREATER:
+            return OpCode::OP_NUM_GREATER;
+        case OpCode::OP_LESS:
+            return OpCode::OP_NUM_LESS;
+        case OpCode::OP_GREATER_EQUAL:
+            return OpCode::OP_NUM_GREATER_EQUAL;
+        case OpCode::OP_LESS_EQUAL:
+            return OpCode::OP_NUM_LESS_EQUAL;
+        default:
+            return opcode;
+    }
+}
+
+inline OpCode checkedForm(const OpCode opcode)
+{
+    switch (opcode)
+    {
+        case OpCode::OP_NUM_NEGATE:
+            return OpCode::OP_NEGATE;
+        case OpCode::OP_NUM_ADD:
+            return OpCode::OP_ADD;
+        case OpCode::OP_NUM_SUBTRACT:
+            return OpCode::OP_SUBTRACT;
+        case OpCode::OP_NUM_MULTIPLY:
+            return OpCode::OP_MULTIPLY;
+        case OpCode::OP_NUM_DIVIDE:
+            return OpCode::OP_DIVIDE;
+        case OpCode::OP_NUM_GREATER:
+            return OpCode::OP_GREATER;
+        case OpCode::OP_NUM_LESS:
+            return OpCode::OP_LESS;
+        case OpCode::OP_NUM_GREATER_EQUAL:
+            return OpCode::OP_GREATER_EQUAL;
+        case OpCode::OP_NUM_LESS_EQUAL:
+            return OpCode::OP_LESS_EQUAL;
+        default:
+            return opcode;
+    }
+}
+
 #endif //OPCODE_H
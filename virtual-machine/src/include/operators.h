@@ -0,0 +1,38 @@
+#ifndef OPERATORS_H
+#define OPERATORS_H
+#include <cmath>
+
+#include "value.h"
+
+// The numeric operators, shared by the VM and the constant folder so that folding can never change a result.
+namespace operators
+{
+    constexpr auto add = [](const double a, const double b) { return Value::number(a + b); };
+    constexpr auto subtract = [](const double a, const double b) { return Value::number(a - b); };
+    constexpr auto multiply = [](const double a, const double b) { return Value::number(a * b); };
+    constexpr auto divide = [](const double a, const double b) { return Value::number(a / b); };
+    constexpr auto exponent = [](const double a, const double b) { return Value::number(std::pow(a, b)); };
+    constexpr auto greater = [](const double a, const double b) { return Value::boolean(a > b); };
+    constexpr auto less = [](const double a, const double b) { return Value::boolean(a < b); };
+
+    // >= and <= are defined as the negated comparisons they replace, which differ from the direct ones for NaN.
+    constexpr auto greaterEqual = [](const double a, const double b) { return Value::boolean(!(a < b)); };
+    constexpr auto lessEqual = [](const double a, const double b) { return Value::boolean(!(a > b)); };
+
+    constexpr auto leftShift = [](const double a, const double b)
+    {
+        return Value::number(static_cast<double>(static_cast<long>(a) << static_cast<long>(b)));
+    };
+
+    constexpr auto rightShift = [](const double a, const double b)
+    {
+        return Value::number(static_cast<double>(static_cast<long>(a) >> static_cast<long>(b)));
+    };
+
+    constexpr auto modulo = [](const double a, const double b)
+    {
+        return Value::number(static_cast<double>(static_cast<long>(a) % static_cast<long>(b)));
+    };
+}
+
+#endif //OPERATORS_H
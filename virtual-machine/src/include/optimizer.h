@@ -0,0 +1,85 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+#include <optional>
+#include <vector>
+
+#include "chunk.h"
+#include "heap.h"
+#include "opcode.h"
+
+// Rewrites a finished chunk. Level 1 fuses comparisons with the OP_NOT that follows them, drops values that are
+// pushed only to be popped and emits superinstructions for common sequences. Level 2 also folds operators whose
+// operands are all constants. The unchecked OP_NUM_ operators are matched and folded like the ones they stand for.
+//
+// The chunk is decoded into a list of instructions, with jump operands turned into instruction indices, and every
+// instruction is appended to an output list that the peephole rules match against. Instructions other code jumps
+// to are never merged into the instruction before them, so every jump still lands on an equivalent instruction when
+// the list is encoded back into bytes.
+class Optimizer
+{
+    struct Instruction
+    {
+        OpCode opcode;
+        int operand;
+        SourceLocation location;
+        bool jumpTarget;
+    };
+
+    Heap &heap;
+    Chunk &chunk;
+    int level;
+    std::vector<Instruction> output{};
+    bool pendingJumpTarget = false;
+
+    [[nodiscard]] std::vector<Instruction> decode() const;
+
+    void encode(const std::vector<int> &outputIndices);
+
+    void emit(Instruction instruction);
+
+    void append(Instruction instruction);
+
+    [[nodiscard]] bool removesDeadPush(const Instruction &pop);
+
+    [[nodiscard]] bool fusesComparison(const Instruction &negation);
+
+    [[nodiscard]] bool fusesCompareJump(const Instruction &jump);
+
+    [[nodiscard]] bool fusesGlobalAdd(const Instruction &addition);
+
+    [[nodiscard]] bool fusesIncrement(const Instruction &pop);
+
+    [[nodiscard]] bool foldsUnary(const Instruction &instruction);
+
+    [[nodiscard]] bool foldsBinary(const Instruction &instruction);
+
+    [[nodiscard]] bool isConstant(const Instruction &instruction) const;
+
+    [[nodiscard]] Value constantValue(const Instruction &instruction) const;
+
+    [[nodiscard]] Instruction makeConstant(Value value, SourceLocation location, bool jumpTarget);
+
+    [[nodiscard]] bool isJumpedTo(const Instruction &instruction) const;
+
+    [[nodiscard]] static int packOperands(int first, int second);
+
+    [[nodiscard]] static bool isJump(OpCode opcode);
+
+    [[nodiscard]] static bool isPurePush(OpCode opcode);
+
+public:
+    static constexpr int MAX_LEVEL = 2;
+    static constexpr int DEFAULT_LEVEL = MAX_LEVEL;
+
+    Optimizer(Heap &heap, Chunk &chunk, int level);
+
+    void run();
+
+    // The folding rules, also used by the IR passes. Empty when the operation cannot be evaluated at compile time,
+    // because it fails at runtime or depends on a conversion that is not exact.
+    [[nodiscard]] static std::optional<Value> foldUnary(OpCode opcode, Value operand);
+
+    [[nodiscard]] static std::optional<Value> foldBinary(Heap &heap, OpCode opcode, Value left, Value right);
+};
+
+#endif //OPTIMIZER_H
@@ -0,0 +1,100 @@
+#ifndef PAUSE_HISTOGRAM_H
+#define PAUSE_HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+// Counts garbage collector pauses by duration in nanoseconds. Every power of two is split into SUB_BUCKETS equal
+// buckets, so a percentile is reported as the upper end of its bucket, within an eighth of the true value, without
+// keeping one sample per pause.
+class PauseHistogram
+{
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    std::array<uint64_t, BUCKET_COUNT> buckets{};
+    uint64_t pauses = 0;
+    uint64_t total = 0;
+    uint64_t longest = 0;
+
+    static int bucketOf(const uint64_t nanoseconds)
+    {
+        if (nanoseconds < SUB_BUCKETS)
+        {
+            return static_cast<int>(nanoseconds);
+        }
+
+        const auto shift = std::bit_width(nanoseconds) - 1 - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + static_cast<int>((nanoseconds >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t upperBound(const int bucket)
+    {
+        if (bucket < static_cast<int>(SUB_BUCKETS))
+        {
+            return bucket;
+        }
+
+        const auto shift = bucket / SUB_BUCKETS - 1;
+        return ((SUB_BUCKETS + bucket % SUB_BUCKETS) << shift) + (uint64_t{1} << shift) - 1;
+    }
+
+public:
+    void record(const uint64_t nanoseconds)
+    {
+        buckets[bucketOf(nanoseconds)]++;
+        pauses++;
+        total += nanoseconds;
+        longest = std::max(longest, nanoseconds);
+    }
+
+    [[nodiscard]] uint64_t count() const
+    {
+        return pauses;
+    }
+
+    [[nodiscard]] uint64_t totalNanoseconds() const
+    {
+        return total;
+    }
+
+    [[nodiscard]] uint64_t maxNanoseconds() const
+    {
+        return longest;
+    }
+
+    // The duration at or below which the given fraction of pauses fall, for instance 0.99 for the p99 pause.
+    [[nodiscard]] uint64_t percentile(const double fraction) const
+    {
+        const auto rank = std::max(uint64_t{1}, static_cast<uint64_t>(std::ceil(fraction * pauses)));
+        uint64_t seen = 0;
+        for (auto bucket = 0; bucket < BUCKET_COUNT; bucket++)
+        {
+            seen += buckets[bucket];
+            if (seen >= rank)
+            {
+                return std::min(upperBound(bucket), longest);
+            }
+        }
+
+        return longest;
+    }
+
+    void merge(const PauseHistogram &other)
+    {
+        for (auto bucket = 0; bucket < BUCKET_COUNT; bucket++)
+        {
+            buckets[bucket] += other.buckets[bucket];
+        }
+
+        pauses += other.pauses;
+        total += other.total;
+        longest = std::max(longest, other.longest);
+    }
+};
+
+#endif //PAUSE_HISTOGRAM_H
@@ -0,0 +1,229 @@
+#ifndef REGISTER_COMPILER_H
+#define REGISTER_COMPILER_H
+#include <array>
+#include <string>
+
+#include "compiler_base.h"
+#include "precedence.h"
+#include "register_opcode.h"
+
+// Compiles to the register backend's three-address instructions. Expressions are described by an Operand until an
+// instruction needs them: constants are used in place as RK operands, locals are read straight from their register,
+// and the result of an instruction whose destination is not chosen yet stays relocatable, so it can be written
+// directly into the register that needs it. Temporaries are allocated above the locals and freed in stack order.
+class RegisterCompiler : public CompilerBase
+{
+    static constexpr int MAX_LOOKAHEAD = 64;
+    static constexpr int ARRAY_BATCH_SIZE = 50;
+
+    struct Operand
+    {
+        enum class Kind { CONSTANT, REGISTER, RELOCATABLE };
+
+        Kind kind;
+        int index;
+    };
+
+    using ParseFn = void (RegisterCompiler::*)(bool, Operand &);
+
+    struct Rule
+    {
+        ParseFn prefix;
+        ParseFn infix;
+        Precedence precedence;
+    };
+
+    void beginRegisterFunction(FunctionScope &scope, FunctionType type);
+
+    ObjFunction *endFunction();
+
+    void declaration();
+
+    void functionDeclaration();
+
+    void function(FunctionType, int destination);
+
+    void statement();
+
+    void variableDeclaration();
+
+    void constantDeclaration();
+
+    void defineVariable(int global, int source, bool constant);
+
+    void printStatement();
+
+    void ifStatement();
+
+    void whileStatement();
+
+    void doWhileStatement();
+
+    void forStatement();
+
+    void breakStatement();
+
+    void continueStatement();
+
+    void returnStatement();
+
+    void block();
+
+    void endScope();
+
+    void expressionStatement();
+
+    [[nodiscard]] Operand expression();
+
+    [[nodiscard]] Operand parsePrecedence(Precedence);
+
+    void number(bool, Operand &);
+
+    void grouping(bool, Operand &);
+
+    void unary(bool, Operand &);
+
+    void binary(bool, Operand &);
+
+    void call(bool, Operand &);
+
+    void arrayLiteral(bool, Operand &);
+
+    void subscript(bool, Operand &);
+
+    void dot(bool, Operand &);
+
+    void logicalAnd(bool, Operand &);
+
+    void logicalOr(bool, Operand &);
+
+    void logicalXor(bool, Operand &);
+
+    void logicalNand(bool, Operand &);
+
+    void logicalNor(bool, Operand &);
+
+    void literal(bool, Operand &);
+
+    void string(bool, Operand &);
+
+    void variable(bool, Operand &);
+
+    void namedVariable(const Token &, bool, Operand &);
+
+    void arithmetic(Operand &, RegisterOpCode, Precedence);
+
+    void pinLocal(Operand &);
+
+    [[nodiscard]] bool upcomingCodeMayWrite();
+
+    void shortCircuit(Operand &, RegisterOpCode jump, Precedence, bool negate);
+
+    [[nodiscard]] int allocateRegister();
+
+    void freeRegister(int reg);
+
+    void freeOperand(const Operand &);
+
+    void dischargeTo(Operand &, int reg);
+
+    int toAnyRegister(Operand &);
+
+    int toNextRegister(Operand &);
+
+    [[nodiscard]] int toRK(Operand &);
+
+    void discard(Operand &);
+
+    [[nodiscard]] Operand constant(Value);
+
+    [[nodiscard]] Operand relocatable(uint32_t instruction);
+
+    int emit(uint32_t instruction);
+
+    [[nodiscard]] int currentPosition() const;
+
+    [[nodiscard]] int emitJump(RegisterOpCode, int reg);
+
+    void patchJump(int position);
+
+    void emitLoop(int loopStart);
+
+    void closeUpvaluesAbove(int depth);
+
+    void emitReturn();
+
+    [[nodiscard]] int makeConstant(Value);
+
+    [[nodiscard]] int registerGlobalSlot(const Token &);
+
+    [[nodiscard]] Rule getRule(TokenType) const;
+
+    std::array<Rule, static_cast<std::underlying_type_t<TokenType>>(TokenType::COUNT)> rules = {
+        Rule{&RegisterCompiler::grouping, &RegisterCompiler::call, Precedence::Call}, // Left paren
+        Rule{nullptr, nullptr, Precedence::None}, // Right paren
+        Rule{nullptr, nullptr, Precedence::None}, // Left brace
+        Rule{nullptr, nullptr, Precedence::None}, // Right brace
+        Rule{&RegisterCompiler::arrayLiteral, &RegisterCompiler::subscript, Precedence::Call}, // Left bracket
+        Rule{nullptr, nullptr, Precedence::None}, // Right bracket
+        Rule{nullptr, nullptr, Precedence::None}, // Comma
+        Rule{nullptr, &RegisterCompiler::dot, Precedence::Call}, // Dot
+        Rule{&RegisterCompiler::unary, &RegisterCompiler::binary, Precedence::Term}, // Minus
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Term}, // Plus
+        Rule{nullptr, nullptr, Precedence::None}, // Semicolon
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Factor}, // Slash
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Factor}, // Star
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Exponent}, // Exponent
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Factor}, // Modulo
+        Rule{nullptr, nullptr, Precedence::None}, // Colon
+        Rule{&RegisterCompiler::unary, nullptr, Precedence::None}, // Bang
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Equality}, // Bang equal
+        Rule{nullptr, nullptr, Precedence::None}, // Equal
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Equality}, // Equal equal
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Comparison}, // Greater
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Comparison}, // Greater equal
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Comparison}, // Less
+        Rule{nullptr, &RegisterCompiler::binary, Precedence::Comparison}, // Less equal
+        Rule{nullptr, nullptr, Precedence::None}, // Left shift
+        Rule{nullptr, nullptr, Precedence::None}, // Right shift
+        Rule{&RegisterCompiler::variable, nullptr, Precedence::None}, // Identifier
+        Rule{&RegisterCompiler::string, nullptr, Precedence::None}, // String
+        Rule{&RegisterCompiler::number, nullptr, Precedence::None}, // Number
+        Rule{nullptr, &RegisterCompiler::logicalAnd, Precedence::And}, // And
+        Rule{nullptr, nullptr, Precedence::None}, // Class
+        Rule{nullptr, nullptr, Precedence::None}, // Else
+        Rule{&RegisterCompiler::literal, nullptr, Precedence::None}, // False
+        Rule{nullptr, nullptr, Precedence::None}, // For
+        Rule{nullptr, nullptr, Precedence::None}, // Fun
+        Rule{nullptr, nullptr, Precedence::None}, // If
+        Rule{&RegisterCompiler::literal, nullptr, Precedence::None}, // Nil
+        Rule{nullptr, &RegisterCompiler::logicalOr, Precedence::Or}, // Or
+        Rule{nullptr, &RegisterCompiler::logicalNand, Precedence::Nand}, // Nand
+        Rule{nullptr, &RegisterCompiler::logicalNor, Precedence::Nor}, // Nor
+        Rule{nullptr, &RegisterCompiler::logicalXor, Precedence::Xor}, // Xor
+        Rule{nullptr, nullptr, Precedence::None}, // Print
+        Rule{nullptr, nullptr, Precedence::None}, // Return
+        Rule{nullptr, nullptr, Precedence::None}, // Super
+        Rule{nullptr, nullptr, Precedence::None}, // This
+        Rule{&RegisterCompiler::literal, nullptr, Precedence::None}, // True
+        Rule{nullptr, nullptr, Precedence::None}, // Let
+        Rule{nullptr, nullptr, Precedence::None}, // While
+        Rule{nullptr, nullptr, Precedence::None}, // Break
+        Rule{nullptr, nullptr, Precedence::None}, // Continue
+        Rule{nullptr, nullptr, Precedence::None}, // Do
+        Rule{nullptr, nullptr, Precedence::None}, // Const
+        Rule{nullptr, nullptr, Precedence::None}, // Import
+        Rule{nullptr, nullptr, Precedence::None}, // Static
+        Rule{nullptr, nullptr, Precedence::None}, // EOF
+        Rule{nullptr, nullptr, Precedence::None}, // Error
+    };
+
+public:
+    RegisterCompiler(Heap &heap, Environment &globals): CompilerBase(heap, globals)
+    {
+    }
+
+    [[nodiscard]] ObjFunction *compile(const std::string &source);
+};
+
+#endif //REGISTER_COMPILER_H
@@ -0,0 +1,11 @@
+#ifndef REGISTER_DISASSEMBLER_H
+#define REGISTER_DISASSEMBLER_H
+#include <string>
+
+#include "chunk.h"
+
+// Prints a chunk of register code in the same layout as Chunk::disassemble prints stack code. Registers are shown
+// as R<n> and constant operands as K<n> followed by their value.
+void disassembleRegisterChunk(const Chunk &chunk, const std::string &name);
+
+#endif //REGISTER_DISASSEMBLER_H
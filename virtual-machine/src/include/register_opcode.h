@@ -0,0 +1,155 @@
+#ifndef REGISTER_OPCODE_H
+#define REGISTER_OPCODE_H
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Instructions of the register backend are 32-bit words: a 6-bit opcode, an 8-bit destination register A and two
+// 9-bit operands B and C, or one 18-bit operand Bx (sBx when signed) in their place. Registers are relative to the
+// frame, register 0 holding the callee. A B or C operand is an RK: a register, or a constant when RK_CONSTANT is
+// set. Jumps are counted in instructions from the one following the jump. OP_ARRAY, like OP_CALL, takes its B
+// values from the consecutive registers starting at A and leaves its result in A; OP_ARRAY_APPEND appends the B
+// values in the registers following A to the array in A; OP_INDEX_SET stores RK(C) at index RK(B) of register A.
+//
+// Every opcode is listed with the shape of its operands, which the disassembler uses.
+#define YAUPL_REGISTER_OPCODES(X)       \
+    X(OP_MOVE, AB)                      \
+    X(OP_LOAD_CONSTANT, ABx)            \
+    X(OP_GET_GLOBAL, ABx)               \
+    X(OP_SET_GLOBAL, ABx)               \
+    X(OP_DEFINE_GLOBAL, ABx)            \
+    X(OP_DEFINE_CONSTANT, ABx)          \
+    X(OP_SET_LOCAL, ARK)                \
+    X(OP_GET_UPVALUE, AB)               \
+    X(OP_SET_UPVALUE, ARK)              \
+    X(OP_CLOSE_UPVALUES, A)             \
+    X(OP_ADD, ABC)                      \
+    X(OP_SUBTRACT, ABC)                 \
+    X(OP_MULTIPLY, ABC)                 \
+    X(OP_DIVIDE, ABC)                   \
+    X(OP_EXPONENT, ABC)                 \
+    X(OP_MODULO, ABC)                   \
+    X(OP_EQUAL, ABC)                    \
+    X(OP_NOT_EQUAL, ABC)                \
+    X(OP_LESS, ABC)                     \
+    X(OP_LESS_EQUAL, ABC)               \
+    X(OP_GREATER, ABC)                  \
+    X(OP_GREATER_EQUAL, ABC)            \
+    X(OP_XOR, ABC)                      \
+    X(OP_NEGATE, ARK)                   \
+    X(OP_NOT, ARK)                      \
+    X(OP_JUMP, sBx)                     \
+    X(OP_JUMP_IF_FALSE, AsBx)           \
+    X(OP_JUMP_IF_TRUE, AsBx)            \
+    X(OP_CALL, AB)                      \
+    X(OP_CLOSURE, ABx)                  \
+    X(OP_PRINT, A)                      \
+    X(OP_RETURN, A)                     \
+    X(OP_ARRAY, AB)                     \
+    X(OP_INDEX_GET, ABC)                \
+    X(OP_INDEX_SET, ABC)                \
+    X(OP_GET_PROPERTY, ABC)             \
+    X(OP_ARRAY_APPEND, AB)
+
+enum class RegisterOpCode: uint8_t
+{
+#define YAUPL_REGISTER_OPCODE_ENUM(opcode, shape) opcode,
+    YAUPL_REGISTER_OPCODES(YAUPL_REGISTER_OPCODE_ENUM)
+#undef YAUPL_REGISTER_OPCODE_ENUM
+};
+
+enum class OperandShape { A, AB, ARK, ABC, ABx, sBx, AsBx };
+
+struct RegisterOpCodeInfo
+{
+    std::string_view name;
+    OperandShape shape;
+};
+
+inline constexpr RegisterOpCodeInfo REGISTER_OPCODE_INFO[] = {
+#define YAUPL_REGISTER_OPCODE_INFO(opcode, shape) RegisterOpCodeInfo{#opcode, OperandShape::shape},
+    YAUPL_REGISTER_OPCODES(YAUPL_REGISTER_OPCODE_INFO)
+#undef YAUPL_REGISTER_OPCODE_INFO
+};
+
+inline constexpr int REGISTER_OPCODE_COUNT = sizeof(REGISTER_OPCODE_INFO) / sizeof(RegisterOpCodeInfo);
+
+inline constexpr int INSTRUCTION_SIZE = sizeof(uint32_t);
+inline constexpr int MAX_REGISTERS = UINT8_MAX + 1;
+inline constexpr int RK_CONSTANT = 1 << 8;
+inline constexpr int MAX_RK_CONSTANT = RK_CONSTANT - 1;
+inline constexpr int MAX_BX = (1 << 18) - 1;
+inline constexpr int MAX_SBX = MAX_BX >> 1;
+
+static_assert(REGISTER_OPCODE_COUNT <= 1 << 6);
+
+inline const RegisterOpCodeInfo &registerOpcodeInfo(const RegisterOpCode opcode)
+{
+    return REGISTER_OPCODE_INFO[static_cast<uint8_t>(opcode)];
+}
+
+constexpr uint32_t encodeABC(const RegisterOpCode opcode, const int a, const int b, const int c)
+{
+    return static_cast<uint32_t>(opcode) | static_cast<uint32_t>(a) << 6 | static_cast<uint32_t>(b) << 14
+           | static_cast<uint32_t>(c) << 23;
+}
+
+constexpr uint32_t encodeABx(const RegisterOpCode opcode, const int a, const int bx)
+{
+    return static_cast<uint32_t>(opcode) | static_cast<uint32_t>(a) << 6 | static_cast<uint32_t>(bx) << 14;
+}
+
+constexpr uint32_t encodeAsBx(const RegisterOpCode opcode, const int a, const int sbx)
+{
+    return encodeABx(opcode, a, sbx + MAX_SBX);
+}
+
+constexpr RegisterOpCode decodeOpcode(const uint32_t instruction)
+{
+    return static_cast<RegisterOpCode>(instruction & 0x3f);
+}
+
+constexpr int decodeA(const uint32_t instruction)
+{
+    return static_cast<int>(instruction >> 6 & 0xff);
+}
+
+constexpr int decodeB(const uint32_t instruction)
+{
+    return static_cast<int>(instruction >> 14 & 0x1ff);
+}
+
+constexpr int decodeC(const uint32_t instruction)
+{
+    return static_cast<int>(instruction >> 23);
+}
+
+constexpr int decodeBx(const uint32_t instruction)
+{
+    return static_cast<int>(instruction >> 14);
+}
+
+constexpr int decodeSBx(const uint32_t instruction)
+{
+    return decodeBx(instruction) - MAX_SBX;
+}
+
+constexpr uint32_t withA(const uint32_t instruction, const int a)
+{
+    return (instruction & ~(0xffu << 6)) | static_cast<uint32_t>(a) << 6;
+}
+
+// Register code is stored in the bytes of a Chunk, so instructions are read and written without assuming alignment.
+inline uint32_t readInstruction(const uint8_t *code)
+{
+    uint32_t instruction;
+    std::memcpy(&instruction, code, sizeof instruction);
+    return instruction;
+}
+
+inline void writeInstruction(uint8_t *code, const uint32_t instruction)
+{
+    std::memcpy(code, &instruction, sizeof instruction);
+}
+
+#endif //REGISTER_OPCODE_H
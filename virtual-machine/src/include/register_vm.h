@@ -0,0 +1,97 @@
+#ifndef REGISTER_VM_H
+#define REGISTER_VM_H
+#include <memory>
+#include <optional>
+
+#include "builtins.h"
+#include "call_frame.h"
+#include "chunk.h"
+#include "environment.h"
+#include "heap.h"
+#include "interpret_result.h"
+#include "register_compiler.h"
+#include "tracer.h"
+
+// Runs the register backend. Frames are windows onto the same kind of value stack the stack VM uses, but
+// instructions address them as registers instead of pushing and popping: a call's registers start at the callee,
+// followed by its arguments, so a frame's register 0 is the caller's register holding the callee.
+struct RegisterVM : RootSet
+{
+    static constexpr int INITIAL_STACK_SIZE = 256;
+    static constexpr int DEFAULT_STACK_LIMIT = 1 << 20;
+    static constexpr int FRAMES_MAX = 4096;
+    static constexpr int MAX_TRACE_FRAMES = 8;
+    Heap heap{};
+    Environment env{};
+    Builtins builtins{heap, env};
+    RegisterCompiler compiler{heap, env};
+    CallFrame frames[FRAMES_MAX];
+    int frameCount = 0;
+    CallFrame *frame = nullptr;
+    Chunk *chunk = nullptr;
+    uint8_t *instructionPointer = nullptr;
+    ObjUpvalue *openUpvalues = nullptr;
+    Value *stack = nullptr;
+    Value *stackTop = nullptr;
+    int stackCapacity = 0;
+    int stackLimit = DEFAULT_STACK_LIMIT;
+    std::unique_ptr<Tracer> tracer;
+    std::optional<LineTable::Cursor> traceCursor;
+    bool dumpBytecode = false;
+
+    RegisterVM()
+    {
+        stack = growArray<Value>(nullptr, 0, INITIAL_STACK_SIZE);
+        stackCapacity = INITIAL_STACK_SIZE;
+        resetStack();
+        heap.addRoots(this);
+    }
+
+    RegisterVM(const RegisterVM &) = delete;
+
+    RegisterVM &operator=(const RegisterVM &) = delete;
+
+    ~RegisterVM();
+
+    void markRoots(Heap &heap) override;
+
+    InterpretResult interpret(const std::string &source);
+
+    InterpretResult run();
+
+    template<bool Traced>
+    InterpretResult execute();
+
+    void resetStack();
+
+    [[nodiscard]] bool reserveStack(int slots);
+
+    [[nodiscard]] bool callValue(Value callee, Value *base, int argCount);
+
+    [[nodiscard]] bool call(ObjClosure *closure, Value *base, int argCount);
+
+    ObjUpvalue *captureUpvalue(Value *local);
+
+    void closeUpvalues(const Value *last);
+
+    void makeClosure(ObjFunction *function, Value &target);
+
+    [[nodiscard]] uint32_t fetch();
+
+    [[nodiscard]] Value rk(const Value *registers, int operand) const;
+
+    [[nodiscard]] bool defineGlobal(int index, Value value, bool constant);
+
+    [[nodiscard]] bool getGlobal(int index, Value &value);
+
+    [[nodiscard]] bool setGlobal(int index, Value value);
+
+    template<typename Op>
+    [[nodiscard]] bool arithmetic(Value *registers, uint32_t instruction, Op op);
+
+    void runtimeError(const std::string &);
+
+    void traceInstruction();
+};
+
+#endif //REGISTER_VM_H
@@ -7,17 +7,35 @@
 class Scanner
 {
 public:
-    explicit Scanner(const std::string &source): source(source), start(0), current(0), line(1)
+    explicit Scanner(const std::string &source): source(source), start(0), current(0), line(1), lineStart(0), column(1)
     {
     }
 
+    // Where scanning has got to, so a compiler can look ahead and come back.
+    struct Position
+    {
+        int start;
+        int current;
+        int line;
+        int lineStart;
+        int column;
+    };
+
     Token scanToken();
 
+    [[nodiscard]] Position position() const;
+
+    void rewind(const Position &position);
+
 private:
     std::string source;
     int start;
     int current;
     int line;
+    int lineStart;
+    int column;
+
+    void nextLine();
 
     char advance();
 
@@ -0,0 +1,172 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <cstdint>
+#include <string_view>
+
+#include "memory.h"
+#include "object.h"
+
+// A hash table keyed by interned strings, flat and open-addressed with linear probing. Every entry caches the hash
+// of its key, so probing and growing never touch the strings themselves, and keys are compared by identity except
+// by findString, which is what interning looks up. Removing an entry shifts the ones probed past it back into its
+// place instead of leaving a tombstone, so a lookup never has to skip deleted entries. A table without values, such
+// as the intern table, is a table of std::monostate: the value takes no space.
+template<typename T>
+class StringTable
+{
+    struct Entry
+    {
+        ObjString *key;
+        uint32_t hash;
+        [[no_unique_address]] T value;
+    };
+
+    static constexpr int MAX_LOAD_PERCENT = 75;
+
+    Entry *entries = nullptr;
+    uint32_t capacity = 0;
+    uint32_t count = 0;
+
+    [[nodiscard]] uint32_t mask() const
+    {
+        return capacity - 1;
+    }
+
+    // The entry holding key, or the empty one where it would be inserted.
+    [[nodiscard]] Entry *findEntry(const ObjString *key, const uint32_t hash) const
+    {
+        for (auto index = hash & mask();; index = (index + 1) & mask())
+        {
+            if (entries[index].key == key || entries[index].key == nullptr)
+            {
+                return &entries[index];
+            }
+        }
+    }
+
+    void grow()
+    {
+        const auto oldEntries = entries;
+        const auto oldCapacity = capacity;
+        capacity = growCapacity(capacity);
+        entries = growArray<Entry>(nullptr, 0, capacity);
+        for (uint32_t index = 0; index < capacity; index++)
+        {
+            entries[index].key = nullptr;
+        }
+
+        for (uint32_t index = 0; index < oldCapacity; index++)
+        {
+            if (oldEntries[index].key != nullptr)
+            {
+                *findEntry(oldEntries[index].key, oldEntries[index].hash) = oldEntries[index];
+            }
+        }
+
+        freeArray(oldEntries, oldCapacity);
+    }
+
+public:
+    StringTable() = default;
+
+    StringTable(const StringTable &) = delete;
+
+    StringTable &operator=(const StringTable &) = delete;
+
+    ~StringTable()
+    {
+        clear();
+    }
+
+    [[nodiscard]] T *find(const ObjString *key) const
+    {
+        if (count == 0)
+        {
+            return nullptr;
+        }
+
+        const auto entry = findEntry(key, key->hash);
+        return entry->key == nullptr ? nullptr : &entry->value;
+    }
+
+    [[nodiscard]] ObjString *findString(const std::string_view &chars, const uint32_t hash) const
+    {
+        if (count == 0)
+        {
+            return nullptr;
+        }
+
+        for (auto index = hash & mask();; index = (index + 1) & mask())
+        {
+            const auto &entry = entries[index];
+            if (entry.key == nullptr)
+            {
+                return nullptr;
+            }
+
+            if (entry.hash == hash && entry.key->view() == chars)
+            {
+                return entry.key;
+            }
+        }
+    }
+
+    // Returns whether the key was new; the value of a key that was already there is replaced.
+    bool set(ObjString *key, T value)
+    {
+        if ((count + 1) * 100 > capacity * MAX_LOAD_PERCENT)
+        {
+            grow();
+        }
+
+        const auto entry = findEntry(key, key->hash);
+        const auto isNew = entry->key == nullptr;
+        if (isNew)
+        {
+            count++;
+        }
+
+        *entry = Entry{key, key->hash, value};
+        return isNew;
+    }
+
+    bool erase(const ObjString *key)
+    {
+        if (count == 0)
+        {
+            return false;
+        }
+
+        auto hole = static_cast<uint32_t>(findEntry(key, key->hash) - entries);
+        if (entries[hole].key == nullptr)
+        {
+            return false;
+        }
+
+        // An entry can move into the hole unless its home slot lies cyclically after the hole, up to where it is.
+        for (auto index = (hole + 1) & mask(); entries[index].key != nullptr; index = (index + 1) & mask())
+        {
+            const auto home = entries[index].hash & mask();
+            if (((index - home) & mask()) >= ((index - hole) & mask()))
+            {
+                entries[hole] = entries[index];
+                hole = index;
+            }
+        }
+
+        entries[hole].key = nullptr;
+        count--;
+        return true;
+    }
+
+    void clear()
+    {
+        freeArray(entries, capacity);
+        entries = nullptr;
+        capacity = 0;
+        count = 0;
+    }
+};
+
+#endif //TABLE_H
@@ -8,16 +8,18 @@ struct Token
 {
     std::string_view lexeme;
     int line;
+    int column;
     TokenType type;
 
-    Token(const TokenType type, const std::string_view &lexeme, const int line)
+    Token(const TokenType type, const std::string_view &lexeme, const int line, const int column)
         : lexeme(lexeme),
           line(line),
+          column(column),
           type(type)
     {
     }
 
-    Token(): line(0), type(TokenType::FILE_EOF)
+    Token(): line(0), column(0), type(TokenType::FILE_EOF)
     {
     }
 };
@@ -7,6 +7,7 @@ enum class TokenType
 {
     // Single-character tokens.
     LEFT_PAREN, RIGHT_PAREN, LEFT_BRACE, RIGHT_BRACE,
+    LEFT_BRACKET, RIGHT_BRACKET,
     COMMA, DOT, MINUS, PLUS, SEMICOLON, SLASH, STAR, EXPONENT,
     MODULO, COLON,
 
@@ -46,6 +47,8 @@ inline std::ostream &operator<<(std::ostream &os, const TokenType type)
         case TokenType::RIGHT_PAREN: return os << "RIGHT_PAREN";
         case TokenType::LEFT_BRACE: return os << "LEFT_BRACE";
         case TokenType::RIGHT_BRACE: return os << "RIGHT_BRACE";
+        case TokenType::LEFT_BRACKET: return os << "LEFT_BRACKET";
+        case TokenType::RIGHT_BRACKET: return os << "RIGHT_BRACKET";
         case TokenType::COMMA: return os << "COMMA";
         case TokenType::DOT: return os << "DOT";
         case TokenType::MINUS: return os << "MINUS";
@@ -0,0 +1,43 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <array>
+#include <cstdio>
+#include <string>
+
+#include "opcode.h"
+
+// Writes one CSV record per executed instruction. Records are formatted into a fixed buffer and handed to the
+// file in large blocks, so tracing a long run does not turn into one write call per instruction.
+class Tracer
+{
+    static constexpr size_t BUFFER_SIZE = 1 << 16;
+    static constexpr size_t MAX_RECORD_SIZE = 128;
+
+    std::FILE *file;
+    std::array<char, BUFFER_SIZE> buffer{};
+    size_t used = 0;
+
+    void append(const std::string_view &text);
+
+    void append(long number);
+
+public:
+    explicit Tracer(const std::string &path);
+
+    Tracer(const Tracer &) = delete;
+
+    Tracer &operator=(const Tracer &) = delete;
+
+    ~Tracer();
+
+    [[nodiscard]] bool isOpen() const;
+
+    void record(long offset, OpCode opcode, long stackDepth, int line);
+
+    void record(long offset, std::string_view opcode, long stackDepth, int line);
+
+    void flush();
+};
+
+#endif //TRACER_H
@@ -5,30 +5,94 @@
 #include <iostream>
 #include <sstream>
 
+#include "object.h"
 #include "value.h"
 
 namespace util
 {
-    inline void printValue(const Value &value)
+    // Collections nested deeper than this are elided, which also ends the printing of one that contains itself.
+    inline constexpr int MAX_PRINT_DEPTH = 16;
+
+    inline void writeValue(std::ostream &out, Value value, int depth = 0);
+
+    inline void writeElements(std::ostream &out, const Value *values, const int count, const int depth)
     {
-        if (std::holds_alternative<double>(value))
+        for (auto i = 0; i < count; i++)
+        {
+            if (i > 0)
+            {
+                out << ", ";
+            }
+
+            writeValue(out, values[i], depth + 1);
+        }
+    }
+
+    inline void writeValue(std::ostream &out, const Value value, const int depth)
+    {
+        if (value.isNumber())
+        {
+            out << value.asNumber();
+        }
+        else if (value.isBool())
+        {
+            out << std::boolalpha << value.asBool();
+        }
+        else if (isString(value))
         {
-            std::cout << std::get<double>(value) << " ";
+            out << asString(value)->view();
         }
-        else if (std::holds_alternative<bool>(value))
+        else if (isObjType(value, ObjType::FUNCTION) || isClosure(value))
         {
-            std::cout << std::boolalpha << std::get<bool>(value) << " ";
+            const auto function = isClosure(value) ? asClosure(value)->function : asFunction(value);
+            if (function->name == nullptr)
+            {
+                out << "<script>";
+            }
+            else
+            {
+                out << "<fn " << function->name->view() << ">";
+            }
         }
-        else if (std::holds_alternative<std::string>(value))
+        else if (isNative(value))
         {
-            std::cout << std::get<std::string>(value) << " ";
+            const auto native = isObjType(value, ObjType::NATIVE)
+                                    ? static_cast<ObjNative *>(value.asObject())
+                                    : static_cast<ObjBoundNative *>(value.asObject())->method;
+            out << "<native fn " << native->name->view() << ">";
+        }
+        else if (isSequence(value) || isObjType(value, ObjType::SET))
+        {
+            const auto type = value.asObject()->type;
+            out << (type == ObjType::ARRAY ? "Array [" : type == ObjType::LIST ? "List [" : "Set {");
+            if (depth >= MAX_PRINT_DEPTH)
+            {
+                out << "...";
+            }
+            else if (type == ObjType::SET)
+            {
+                const auto set = static_cast<ObjSet *>(value.asObject());
+                writeElements(out, set->values, set->count, depth);
+            }
+            else
+            {
+                writeElements(out, asSequence(value)->values, asSequence(value)->count, depth);
+            }
+
+            out << (type == ObjType::SET ? "}" : "]");
         }
         else
         {
-            std::cout << "NULL ";
+            out << "NULL";
         }
     }
 
+    inline void printValue(const Value value)
+    {
+        writeValue(std::cout, value);
+        std::cout << " ";
+    }
+
     inline std::string readFile(const std::string_view &path)
     {
         std::ifstream ifs{path.data()};
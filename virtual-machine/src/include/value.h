@@ -1,58 +1,120 @@
 #ifndef VALUE_H
 #define VALUE_H
-#include <variant>
+#include <bit>
+#include <cstdint>
 
-#include "memory.h"
+#include "arena.h"
 
-using Value = std::variant<std::monostate, double, bool, std::string>;
+struct Obj;
 
-inline bool valuesEqual(const Value &x, const Value &y)
+// A Value is a NaN-boxed 64-bit word. Any bit pattern that is not a quiet NaN is a double; quiet NaNs carry either
+// a small tag (null, false, true) in the low bits or, when the sign bit is set, a pointer to a heap object.
+class Value
 {
-    return std::visit([]<typename U, typename V>(const U &a, const V &b) -> bool
+    static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+    static constexpr uint64_t QNAN = 0x7ffc000000000000;
+    static constexpr uint64_t TAG_NULL = 1;
+    static constexpr uint64_t TAG_FALSE = 2;
+    static constexpr uint64_t TAG_TRUE = 3;
+
+    uint64_t bits;
+
+    explicit constexpr Value(const uint64_t bits): bits(bits)
     {
-        if constexpr (std::is_same_v<U, V> || std::is_arithmetic_v<U> && std::is_arithmetic_v<V>)
-        {
-            return a == b;
-        }
-        else
-        {
-            return false;
-        }
-    }, x, y);
-}
+    }
 
-inline bool isFalsey(const Value &value)
-{
-    if (std::holds_alternative<std::monostate>(value))
+public:
+    constexpr Value(): bits(QNAN | TAG_NULL)
+    {
+    }
+
+    [[nodiscard]] static constexpr Value null()
+    {
+        return Value{QNAN | TAG_NULL};
+    }
+
+    [[nodiscard]] static constexpr Value boolean(const bool value)
     {
-        return true;
+        return Value{value ? QNAN | TAG_TRUE : QNAN | TAG_FALSE};
     }
 
-    if (std::holds_alternative<bool>(value))
+    [[nodiscard]] static constexpr Value number(const double value)
     {
-        return !std::get<bool>(value);
+        return Value{std::bit_cast<uint64_t>(value)};
     }
 
-    return false;
+    [[nodiscard]] static Value object(const Obj *object)
+    {
+        return Value{SIGN_BIT | QNAN | reinterpret_cast<uintptr_t>(object)};
+    }
+
+    [[nodiscard]] constexpr bool isNull() const
+    {
+        return bits == (QNAN | TAG_NULL);
+    }
+
+    [[nodiscard]] constexpr bool isBool() const
+    {
+        return (bits | 1) == (QNAN | TAG_TRUE);
+    }
+
+    [[nodiscard]] constexpr bool isNumber() const
+    {
+        return (bits & QNAN) != QNAN;
+    }
+
+    [[nodiscard]] constexpr bool isObject() const
+    {
+        return (bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT);
+    }
+
+    [[nodiscard]] constexpr bool asBool() const
+    {
+        return bits == (QNAN | TAG_TRUE);
+    }
+
+    [[nodiscard]] constexpr double asNumber() const
+    {
+        return std::bit_cast<double>(bits);
+    }
+
+    [[nodiscard]] Obj *asObject() const
+    {
+        return reinterpret_cast<Obj *>(bits & ~(SIGN_BIT | QNAN));
+    }
+
+    [[nodiscard]] constexpr uint64_t raw() const
+    {
+        return bits;
+    }
+};
+
+static_assert(sizeof(Value) == sizeof(uint64_t));
+
+inline bool isFalsey(const Value value)
+{
+    return value.isNull() || (value.isBool() && !value.asBool());
 }
 
+// With an arena, the values are allocated from it and belong to whoever owns the arena, not to the array.
 struct ValueArray
 {
     int capacity;
     int count;
     Value *values;
+    Arena *arena;
 
-    ValueArray(): capacity(0), count(0), values(nullptr)
+    ValueArray(): capacity(0), count(0), values(nullptr), arena(nullptr)
     {
     }
 
-    void write(const Value &value)
+    void write(const Value value)
     {
         if (capacity < count + 1)
         {
             const auto oldCapacity = capacity;
             capacity = growCapacity(oldCapacity);
-            values = growArray(values, oldCapacity, capacity);
+            values = growArray(arena, values, oldCapacity, capacity);
         }
 
         values[count++] = value;
@@ -60,7 +122,17 @@ struct ValueArray
 
     void free()
     {
-        freeArray(values, capacity);
+        if (arena == nullptr)
+        {
+            freeArray(values, capacity);
+        }
+
+        forget();
+    }
+
+    // Drops the values without freeing them, for values some other block of memory owns.
+    void forget()
+    {
         capacity = 0;
         count = 0;
         values = nullptr;
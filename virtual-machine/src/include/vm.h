@@ -1,40 +1,94 @@
 #ifndef VM_H
 #define VM_H
-#include <functional>
 #include <memory>
+#include <optional>
 
+#include "call_frame.h"
 #include "chunk.h"
 #include "compiler.h"
+#include "builtins.h"
 #include "environment.h"
+#include "heap.h"
 #include "interpret_result.h"
+#include "ir_compiler.h"
+#include "opcode.h"
+#include "tracer.h"
 
-template<typename T>
-concept AllowedType = std::same_as<T, double> || std::same_as<T, std::string> || std::same_as<T, bool>;
+// How a source is compiled: straight to bytecode while parsing, or through the IR and its optimization passes,
+// which is slower to compile but produces better code.
+enum class CompilePipeline { SINGLE_PASS, IR };
 
-struct VM
+struct VM : RootSet
 {
-    static constexpr int STACK_MAX = 256;
-    Compiler compiler{};
+    static constexpr int INITIAL_STACK_SIZE = 256;
+    static constexpr int DEFAULT_STACK_LIMIT = 1 << 20;
+    static constexpr int FRAMES_MAX = 4096;
+    static constexpr int MAX_TRACE_FRAMES = 8;
+    Heap heap{};
     Environment env{};
-    std::unique_ptr<Chunk> chunk;
-    uint8_t *instructionPointer;
-    Value stack[STACK_MAX];
-    Value *stackTop;
-
-    VM(): chunk(std::make_unique<Chunk>())
+    Builtins builtins{heap, env};
+    Compiler compiler{heap, env};
+    IrCompiler irCompiler{heap, env};
+    CallFrame frames[FRAMES_MAX];
+    int frameCount = 0;
+    CallFrame *frame = nullptr;
+    Chunk *chunk = nullptr;
+    uint8_t *instructionPointer = nullptr;
+    ObjUpvalue *openUpvalues = nullptr;
+    Value *stack = nullptr;
+    Value *stackTop = nullptr;
+    int stackCapacity = 0;
+    int stackLimit = DEFAULT_STACK_LIMIT;
+    std::unique_ptr<Tracer> tracer;
+    std::optional<LineTable::Cursor> traceCursor;
+    bool dumpBytecode = false;
+
+    VM()
     {
+        stack = growArray<Value>(nullptr, 0, INITIAL_STACK_SIZE);
+        stackCapacity = INITIAL_STACK_SIZE;
         resetStack();
+        heap.addRoots(this);
     }
 
+    VM(const VM &) = delete;
+
+    VM &operator=(const VM &) = delete;
+
     ~VM();
 
-    InterpretResult interpret(const std::string &source);
+    void markRoots(Heap &heap) override;
+
+    InterpretResult interpret(const std::string &source, CompilePipeline pipeline = CompilePipeline::SINGLE_PASS);
 
     InterpretResult run();
 
+    template<bool Traced>
+    InterpretResult execute();
+
     void resetStack();
 
-    void push(const Value &);
+    [[nodiscard]] bool reserveStack(int slots);
+
+    [[nodiscard]] bool callValue(Value callee, int argCount);
+
+    [[nodiscard]] bool call(ObjClosure *closure, int argCount);
+
+    [[nodiscard]] bool tailCall(Value callee, int argCount);
+
+    [[nodiscard]] bool checkArity(const ObjFunction *function, int argCount);
+
+    void returnFrom();
+
+    ObjUpvalue *captureUpvalue(Value *local);
+
+    void closeUpvalues(const Value *last);
+
+    void makeClosure(ObjFunction *function);
+
+    void makeArray(int count);
+
+    void push(Value);
 
     Value pop();
 
@@ -42,12 +96,39 @@ struct VM
 
     [[nodiscard]] uint8_t readByte();
 
+    [[nodiscard]] int readShort();
+
+    [[nodiscard]] int readLong();
+
     [[nodiscard]] Value readConstant();
 
-    template<AllowedType T>
-    [[nodiscard]] bool binaryOp(const std::function<Value(T, T)> &op);
+    [[nodiscard]] bool defineGlobal(int index, bool constant);
+
+    [[nodiscard]] bool getGlobal(int index);
+
+    [[nodiscard]] bool setGlobal(int index);
+
+    template<typename Op>
+    [[nodiscard]] bool binaryOp(Op op);
+
+    template<typename Op>
+    [[nodiscard]] bool numberBinaryOp(Op op);
+
+    template<typename Op>
+    void uncheckedBinaryOp(Op op);
+
+    template<typename Op>
+    [[nodiscard]] bool compareAndJump(Op op);
+
+    void concatenate();
+
+    void quicken(OpCode);
+
+    void dequicken(OpCode);
 
     void runtimeError(const std::string &);
+
+    void traceInstruction();
 };
 
 #endif //VM_H
@@ -0,0 +1,73 @@
+#include "../include/arena.h"
+
+#include <cstdlib>
+
+// Blocks are mapped straight from the system where possible: malloc would serve them from its heap once its mmap
+// threshold has grown past the block size, and freed blocks below the packed chunks would stay resident.
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#define ARENA_USES_MMAP 1
+#else
+#define ARENA_USES_MMAP 0
+#endif
+
+Arena::~Arena()
+{
+    release();
+}
+
+void Arena::freeBlock(Block *block)
+{
+#if ARENA_USES_MMAP
+    munmap(block, HEADER_SIZE + block->capacity);
+#else
+    std::free(block);
+#endif
+}
+
+void Arena::addBlock(const size_t minimum)
+{
+    const auto capacity = std::max(minimum, BLOCK_SIZE);
+#if ARENA_USES_MMAP
+    const auto mapping = mmap(nullptr, HEADER_SIZE + capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    const auto block = mapping == MAP_FAILED ? nullptr : static_cast<Block *>(mapping);
+#else
+    const auto block = static_cast<Block *>(std::malloc(HEADER_SIZE + capacity));
+#endif
+    if (block == nullptr)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    block->previous = current;
+    block->capacity = capacity;
+    current = block;
+    top = reinterpret_cast<uint8_t *>(block) + HEADER_SIZE;
+    limit = top + capacity;
+}
+
+void *Arena::do_allocate(const size_t size, const size_t alignment)
+{
+    auto start = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(top) + alignment - 1) & ~(alignment - 1));
+    if (current == nullptr || start + size > limit)
+    {
+        addBlock(size + alignment);
+        start = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(top) + alignment - 1) & ~(alignment - 1));
+    }
+
+    top = start + size;
+    return start;
+}
+
+void Arena::release()
+{
+    while (current != nullptr)
+    {
+        const auto previous = current->previous;
+        freeBlock(current);
+        current = previous;
+    }
+
+    top = nullptr;
+    limit = nullptr;
+}
@@ -0,0 +1,517 @@
+#include "../include/builtins.h"
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <limits>
+
+namespace
+{
+    std::string_view typeName(const ObjType type)
+    {
+        switch (type)
+        {
+            case ObjType::ARRAY:
+                return "Array";
+            case ObjType::LIST:
+                return "List";
+            default:
+                return "Set";
+        }
+    }
+
+    // Fractions and NaN are not positions, and are rejected before an index is converted.
+    bool isInteger(const double number)
+    {
+        return std::trunc(number) == number;
+    }
+
+    ObjArray *receiverSequence(const NativeCall &call)
+    {
+        return asSequence(call.receiver);
+    }
+
+    ObjSet *receiverSet(const NativeCall &call)
+    {
+        return static_cast<ObjSet *>(call.receiver.asObject());
+    }
+
+    // Reads the argument an index is expected in, which must be a position of the receiver.
+    bool argumentIndex(NativeCall &call, const int argument, int &index)
+    {
+        const auto sequence = receiverSequence(call);
+        const auto value = call.args[argument];
+        if (!value.isNumber())
+        {
+            call.error = "Index must be a number.";
+            return false;
+        }
+
+        if (!isInteger(value.asNumber()))
+        {
+            call.error = "Index must be an integer.";
+            return false;
+        }
+
+        if (const auto position = value.asNumber(); !(position >= 0 && position < sequence->count))
+        {
+            call.error = std::format("{} index {} is out of bounds.", typeName(sequence->type), position);
+            return false;
+        }
+
+        index = static_cast<int>(value.asNumber());
+        return true;
+    }
+
+    // A new array or list holding count elements, which the caller fills in before allocating anything else.
+    ObjArray *newSequence(Heap &heap, const ObjType type, const int count)
+    {
+        if (type == ObjType::ARRAY)
+        {
+            return heap.newArray(count);
+        }
+
+        const auto list = heap.newList(count);
+        list->count = count;
+        return list;
+    }
+
+    void append(Heap &heap, ObjList *list, const Value value)
+    {
+        if (list->count == list->capacity)
+        {
+            const auto oldCapacity = list->capacity;
+            list->capacity = growCapacity(oldCapacity);
+            list->values = growArray(list->values, oldCapacity, list->capacity);
+        }
+
+        list->values[list->count++] = value;
+        heap.writeBarrier(list, value);
+    }
+
+    bool arrayConstructor(NativeCall &call)
+    {
+        const auto size = call.args[0];
+        if (!size.isNumber() || size.asNumber() < 0 || size.asNumber() > std::numeric_limits<int>::max()
+            || std::trunc(size.asNumber()) != size.asNumber())
+        {
+            call.error = "Array size must be a non-negative integer.";
+            return false;
+        }
+
+        call.result = Value::object(call.heap.newArray(static_cast<int>(size.asNumber())));
+        return true;
+    }
+
+    // A single array argument is copied into the list rather than becoming its only element.
+    bool listConstructor(NativeCall &call)
+    {
+        const auto copiesArray = call.argCount == 1 && isObjType(call.args[0], ObjType::ARRAY);
+        const auto count = copiesArray ? asSequence(call.args[0])->count : call.argCount;
+        const auto list = newSequence(call.heap, ObjType::LIST, count);
+        std::copy_n(copiesArray ? asSequence(call.args[0])->values : call.args, count, list->values);
+        call.result = Value::object(list);
+        return true;
+    }
+
+    bool setConstructor(NativeCall &call)
+    {
+        const auto set = call.heap.newSet();
+        for (auto i = 0; i < call.argCount; i++)
+        {
+            set->insert(call.args[i]);
+        }
+
+        call.result = Value::object(set);
+        return true;
+    }
+
+    bool sequenceGet(NativeCall &call)
+    {
+        auto index = 0;
+        if (!argumentIndex(call, 0, index))
+        {
+            return false;
+        }
+
+        call.result = receiverSequence(call)->values[index];
+        return true;
+    }
+
+    bool sequenceSet(NativeCall &call)
+    {
+        auto index = 0;
+        if (!argumentIndex(call, 0, index))
+        {
+            return false;
+        }
+
+        const auto sequence = receiverSequence(call);
+        sequence->values[index] = call.args[1];
+        call.heap.writeBarrier(sequence, call.args[1]);
+        call.result = call.args[1];
+        return true;
+    }
+
+    bool sequenceContains(NativeCall &call)
+    {
+        const auto sequence = receiverSequence(call);
+        const auto found = std::any_of(sequence->values, sequence->values + sequence->count,
+                                       [&](const Value element) { return valuesEqual(element, call.args[0]); });
+        call.result = Value::boolean(found);
+        return true;
+    }
+
+    bool sequenceFill(NativeCall &call)
+    {
+        const auto sequence = receiverSequence(call);
+        std::fill_n(sequence->values, sequence->count, call.args[0]);
+        call.heap.writeBarrier(sequence, call.args[0]);
+        call.result = Value::null();
+        return true;
+    }
+
+    bool sequenceReverse(NativeCall &call)
+    {
+        const auto count = receiverSequence(call)->count;
+        const auto reversed = newSequence(call.heap, receiverSequence(call)->type, count);
+        std::reverse_copy(receiverSequence(call)->values, receiverSequence(call)->values + count, reversed->values);
+        call.result = Value::object(reversed);
+        return true;
+    }
+
+    bool sequenceConcat(NativeCall &call)
+    {
+        const auto type = receiverSequence(call)->type;
+        if (!isObjType(call.args[0], type))
+        {
+            const auto article = type == ObjType::ARRAY ? "an" : "a";
+            call.error = std::format("Argument for {}.concat should be {} {}.", typeName(type), article,
+                                     typeName(type));
+            return false;
+        }
+
+        const auto count = receiverSequence(call)->count;
+        const auto otherCount = asSequence(call.args[0])->count;
+        const auto result = newSequence(call.heap, type, count + otherCount);
+        std::copy_n(receiverSequence(call)->values, count, result->values);
+        std::copy_n(asSequence(call.args[0])->values, otherCount, result->values + count);
+        call.result = Value::object(result);
+        return true;
+    }
+
+    bool listAdd(NativeCall &call)
+    {
+        append(call.heap, static_cast<ObjList *>(receiverSequence(call)), call.args[0]);
+        call.result = Value::null();
+        return true;
+    }
+
+    bool listRemove(NativeCall &call)
+    {
+        auto index = 0;
+        if (!argumentIndex(call, 0, index))
+        {
+            return false;
+        }
+
+        const auto list = receiverSequence(call);
+        std::copy(list->values + index + 1, list->values + list->count, list->values + index);
+        list->count--;
+        call.result = Value::null();
+        return true;
+    }
+
+    bool listClear(NativeCall &call)
+    {
+        receiverSequence(call)->count = 0;
+        call.result = Value::null();
+        return true;
+    }
+
+    bool setAdd(NativeCall &call)
+    {
+        const auto set = receiverSet(call);
+        if (set->insert(call.args[0]))
+        {
+            call.heap.writeBarrier(set, call.args[0]);
+        }
+
+        call.result = Value::null();
+        return true;
+    }
+
+    bool setRemove(NativeCall &call)
+    {
+        receiverSet(call)->erase(call.args[0]);
+        call.result = Value::null();
+        return true;
+    }
+
+    bool setContains(NativeCall &call)
+    {
+        call.result = Value::boolean(receiverSet(call)->contains(call.args[0]));
+        return true;
+    }
+
+    bool setSize(NativeCall &call)
+    {
+        call.result = Value::number(receiverSet(call)->count);
+        return true;
+    }
+
+    bool setClear(NativeCall &call)
+    {
+        receiverSet(call)->clear();
+        call.result = Value::null();
+        return true;
+    }
+
+    bool setToArray(NativeCall &call)
+    {
+        const auto count = receiverSet(call)->count;
+        const auto array = newSequence(call.heap, ObjType::ARRAY, count);
+        std::copy_n(receiverSet(call)->values, count, array->values);
+        call.result = Value::object(array);
+        return true;
+    }
+
+    bool setToList(NativeCall &call)
+    {
+        const auto count = receiverSet(call)->count;
+        const auto list = newSequence(call.heap, ObjType::LIST, count);
+        std::copy_n(receiverSet(call)->values, count, list->values);
+        call.result = Value::object(list);
+        return true;
+    }
+
+    // The new set is filled with the receiver's elements the other set's membership keeps, then with the other
+    // set's elements for a union.
+    template<bool Keep, bool AddOther>
+    bool setCombine(NativeCall &call)
+    {
+        if (!isObjType(call.args[0], ObjType::SET))
+        {
+            call.error = "Argument for a Set operation should be a Set.";
+            return false;
+        }
+
+        const auto result = call.heap.newSet();
+        const auto set = receiverSet(call);
+        const auto other = static_cast<ObjSet *>(call.args[0].asObject());
+        for (auto i = 0; i < set->count; i++)
+        {
+            if (AddOther || other->contains(set->values[i]) == Keep)
+            {
+                result->insert(set->values[i]);
+            }
+        }
+
+        for (auto i = 0; AddOther && i < other->count; i++)
+        {
+            result->insert(other->values[i]);
+        }
+
+        call.result = Value::object(result);
+        return true;
+    }
+}
+
+Builtins::Builtins(Heap &heap, Environment &globals): heap(heap)
+{
+    heap.addRoots(this);
+    lengthName = heap.copyString("length");
+
+    // The constructors' names are the globals' names, so marking the natives keeps those alive too.
+    for (const auto &[name, function]: {
+             std::pair{"Array", &arrayConstructor}, std::pair{"List", &listConstructor},
+             std::pair{"Set", &setConstructor}
+         })
+    {
+        const auto native = define(name, function, function == &arrayConstructor ? 1 : -1);
+        globals.declare(globals.resolve(native->name), Value::object(native), true);
+    }
+
+    for (const auto methods: {&arrayMethods, &listMethods})
+    {
+        defineMethod(*methods, "get", &sequenceGet, 1);
+        defineMethod(*methods, "set", &sequenceSet, 2);
+        defineMethod(*methods, "contains", &sequenceContains, 1);
+        defineMethod(*methods, "fill", &sequenceFill, 1);
+        defineMethod(*methods, "reverse", &sequenceReverse, 0);
+        defineMethod(*methods, "concat", &sequenceConcat, 1);
+    }
+
+    defineMethod(listMethods, "add", &listAdd, 1);
+    defineMethod(listMethods, "remove", &listRemove, 1);
+    defineMethod(listMethods, "clear", &listClear, 0);
+
+    defineMethod(setMethods, "add", &setAdd, 1);
+    defineMethod(setMethods, "remove", &setRemove, 1);
+    defineMethod(setMethods, "contains", &setContains, 1);
+    defineMethod(setMethods, "size", &setSize, 0);
+    defineMethod(setMethods, "clear", &setClear, 0);
+    defineMethod(setMethods, "toArray", &setToArray, 0);
+    defineMethod(setMethods, "toList", &setToList, 0);
+    defineMethod(setMethods, "union", &setCombine<true, true>, 1);
+    defineMethod(setMethods, "intersection", &setCombine<true, false>, 1);
+    defineMethod(setMethods, "difference", &setCombine<false, false>, 1);
+}
+
+Builtins::~Builtins()
+{
+    heap.removeRoots(this);
+}
+
+void Builtins::markRoots(Heap &heap)
+{
+    heap.markObject(lengthName);
+    for (const auto native: natives)
+    {
+        heap.markObject(native);
+    }
+}
+
+// The native is rooted before its name is allocated, and its name written through the barrier in case it was
+// promoted in between.
+ObjNative *Builtins::define(const std::string_view name, const NativeFn function, const int arity)
+{
+    const auto native = heap.newNative(function, nullptr, arity);
+    natives.push_back(native);
+    native->name = heap.copyString(name);
+    heap.writeBarrier(native, native->name);
+    return native;
+}
+
+void Builtins::defineMethod(StringTable<ObjNative *> &methods, const std::string_view name, const NativeFn function,
+                            const int arity)
+{
+    const auto native = define(name, function, arity);
+    methods.set(native->name, native);
+}
+
+bool Builtins::getIndexSlow(const Value target, const Value index, Value &result)
+{
+    if (!isSequence(target) && !isString(target))
+    {
+        message = "Can only index arrays, lists and strings.";
+        return false;
+    }
+
+    if (!index.isNumber())
+    {
+        message = "Index must be a number.";
+        return false;
+    }
+
+    const auto position = index.asNumber();
+    if (!isInteger(position))
+    {
+        message = "Index must be an integer.";
+        return false;
+    }
+
+    if (isSequence(target))
+    {
+        message = std::format("{} index {} is out of bounds.", typeName(target.asObject()->type), position);
+        return false;
+    }
+
+    const auto string = asString(target);
+    if (!(position >= 0 && position < string->length))
+    {
+        message = std::format("String index {} is out of bounds.", position);
+        return false;
+    }
+
+    result = Value::object(heap.copyString(string->view().substr(static_cast<size_t>(position), 1)));
+    return true;
+}
+
+bool Builtins::setIndexSlow(const Value target, const Value index)
+{
+    if (!isSequence(target))
+    {
+        message = "Can only assign to an index of an array or list.";
+        return false;
+    }
+
+    if (!index.isNumber())
+    {
+        message = "Index must be a number.";
+        return false;
+    }
+
+    if (!isInteger(index.asNumber()))
+    {
+        message = "Index must be an integer.";
+        return false;
+    }
+
+    message = std::format("{} index {} is out of bounds.", typeName(target.asObject()->type), index.asNumber());
+    return false;
+}
+
+bool Builtins::getProperty(const Value receiver, ObjString *name, Value &result)
+{
+    StringTable<ObjNative *> *methods;
+    if (isObjType(receiver, ObjType::ARRAY))
+    {
+        methods = &arrayMethods;
+    }
+    else if (isObjType(receiver, ObjType::LIST))
+    {
+        methods = &listMethods;
+    }
+    else if (isObjType(receiver, ObjType::SET))
+    {
+        methods = &setMethods;
+    }
+    else
+    {
+        message = "Only arrays, lists and sets have properties.";
+        return false;
+    }
+
+    if (name == lengthName && isSequence(receiver))
+    {
+        result = Value::number(asSequence(receiver)->count);
+        return true;
+    }
+
+    const auto method = methods->find(name);
+    if (method == nullptr)
+    {
+        message = std::format("Undefined {} property {}.", typeName(receiver.asObject()->type), name->view());
+        return false;
+    }
+
+    result = Value::object(heap.newBoundNative(receiver, *method));
+    return true;
+}
+
+bool Builtins::callNative(const Value callee, Value *base, const int argCount)
+{
+    auto native = static_cast<ObjNative *>(callee.asObject());
+    if (callee.asObject()->type == ObjType::BOUND_NATIVE)
+    {
+        const auto bound = static_cast<ObjBoundNative *>(callee.asObject());
+        native = bound->method;
+        *base = bound->receiver;
+    }
+
+    if (native->arity != -1 && argCount != native->arity)
+    {
+        message = std::format("Expected {} arguments but got {}.", native->arity, argCount);
+        return false;
+    }
+
+    auto call = NativeCall{heap, *base, base + 1, argCount, Value::null(), message};
+    if (!native->function(call))
+    {
+        return false;
+    }
+
+    *base = call.result;
+    return true;
+}
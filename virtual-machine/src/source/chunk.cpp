@@ -1,70 +1,302 @@
 #include "../include/chunk.h"
+#include "../include/object.h"
 #include "../include/opcode.h"
 #include "../include/util.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
 
 
-Chunk::Chunk(): code(nullptr), lines(nullptr), count(0), capacity(0)
+Chunk::Chunk(Arena *arena): code(nullptr), localNames(nullptr), localNameCount(0), localNameCapacity(0), count(0),
+                            capacity(0), maxStackDepth(0), arena(nullptr), packed(nullptr)
 {
     constants = ValueArray{};
+    useArena(arena);
 }
 
 
-void Chunk::write(const uint8_t opcode, const int line)
+Chunk::~Chunk()
+{
+    free();
+}
+
+void Chunk::write(const uint8_t opcode, const SourceLocation location)
 {
     if (capacity < count + 1)
     {
         const auto oldCapacity = capacity;
         capacity = growCapacity(oldCapacity);
-        code = growArray(code, oldCapacity, capacity);
-        lines = growArray(lines, oldCapacity, capacity);
+        code = growArray(arena, code, oldCapacity, capacity);
     }
 
     code[count] = opcode;
-    lines[count] = line;
+    lines.add(count, location);
     count++;
 }
 
 
-int Chunk::addConstant(const Value &value)
+int Chunk::addConstant(const Value value)
 {
+    // Interned strings and equal numbers share their boxed bits, so the bits are enough to find a duplicate.
+    if (const auto existing = constantIndices.find(value.raw()); existing != constantIndices.end())
+    {
+        return existing->second;
+    }
+
     constants.write(value);
+    constantIndices.emplace(value.raw(), constants.count - 1);
     return constants.count - 1;
 }
 
+void Chunk::patchShortOperand(const int offset, const int value) const
+{
+    code[offset] = static_cast<uint8_t>(value & 0xff);
+    code[offset + 1] = static_cast<uint8_t>(value >> 8 & 0xff);
+}
+
+void Chunk::addLocalName(ObjString *name, const SourceLocation declared, const int slot)
+{
+    if (localNameCapacity < localNameCount + 1)
+    {
+        const auto oldCapacity = localNameCapacity;
+        localNameCapacity = growCapacity(oldCapacity);
+        localNames = growArray(arena, localNames, oldCapacity, localNameCapacity);
+    }
+
+    localNames[localNameCount++] = LocalName{name, declared, slot};
+}
+
+// Locals sharing a slot have disjoint scopes, and they are added in the order they are declared, so the local an
+// instruction uses is the last one declared in its slot before the instruction.
+std::string_view Chunk::localName(const int offset, const int slot) const
+{
+    const auto location = lines.lookup(offset);
+    for (auto i = localNameCount - 1; i >= 0; i--)
+    {
+        if (localNames[i].slot == slot && localNames[i].declared <= location)
+        {
+            return localNames[i].name->view();
+        }
+    }
+
+    return {};
+}
+
+// Exchanges the bytecode and its line table, leaving the constants and local names in place, so a rewritten copy of
+// the code can replace the original while still indexing the same constants.
+void Chunk::swapCode(Chunk &other) noexcept
+{
+    std::swap(code, other.code);
+    std::swap(count, other.count);
+    std::swap(capacity, other.capacity);
+    lines.swap(other.lines);
+}
+
+// Only called on an empty chunk. The index of constants is rebuilt, since a container keeps its memory resource.
+void Chunk::useArena(Arena *owner)
+{
+    arena = owner;
+    lines.useArena(owner);
+    constants.arena = owner;
+    std::destroy_at(&constantIndices);
+    std::construct_at(&constantIndices, owner != nullptr ? owner : std::pmr::get_default_resource());
+}
+
 void Chunk::free()
 {
-    constants.free();
-    freeArray(code, capacity);
-    freeArray(lines, capacity);
+    if (packed != nullptr)
+    {
+        if (--packed->chunks == 0)
+        {
+            reallocate(reinterpret_cast<uint8_t *>(packed), packed->size, 0);
+        }
+
+        constants.forget();
+        lines.forget();
+        packed = nullptr;
+    }
+    else
+    {
+        constants.free();
+        lines.free();
+        if (arena == nullptr)
+        {
+            freeArray(code, capacity);
+            freeArray(localNames, localNameCapacity);
+        }
+    }
+
+    constantIndices.clear();
     count = 0;
     capacity = 0;
     code = nullptr;
+    localNameCount = 0;
+    localNameCapacity = 0;
+    localNames = nullptr;
+}
+
+void Chunk::pack(const std::vector<Chunk *> &chunks)
+{
+    if (chunks.empty())
+    {
+        return;
+    }
+
+    constexpr auto align = [](const size_t size) { return (size + alignof(Value) - 1) & ~(alignof(Value) - 1); };
+    auto size = align(sizeof(PackedBlock));
+    for (const auto chunk: chunks)
+    {
+        size = align(size + sizeof(Value) * chunk->constants.count + sizeof(LocalName) * chunk->localNameCount
+                     + chunk->count + chunk->lines.size());
+    }
+
+    const auto storage = reallocate<uint8_t>(nullptr, 0, size);
+    const auto block = new(storage) PackedBlock{size, static_cast<int>(chunks.size())};
+    auto cursor = align(sizeof(PackedBlock));
+    for (const auto chunk: chunks)
+    {
+        auto &constants = chunk->constants;
+        if (constants.count > 0)
+        {
+            std::memcpy(storage + cursor, constants.values, sizeof(Value) * constants.count);
+        }
+
+        constants.values = reinterpret_cast<Value *>(storage + cursor);
+        constants.capacity = constants.count;
+        constants.arena = nullptr;
+        cursor += sizeof(Value) * constants.count;
+
+        if (chunk->localNameCount > 0)
+        {
+            std::memcpy(storage + cursor, chunk->localNames, sizeof(LocalName) * chunk->localNameCount);
+        }
+
+        chunk->localNames = reinterpret_cast<LocalName *>(storage + cursor);
+        chunk->localNameCapacity = chunk->localNameCount;
+        cursor += sizeof(LocalName) * chunk->localNameCount;
+
+        if (chunk->count > 0)
+        {
+            std::memcpy(storage + cursor, chunk->code, chunk->count);
+        }
+
+        chunk->code = storage + cursor;
+        chunk->capacity = chunk->count;
+        cursor += chunk->count;
+
+        const auto lineBytes = chunk->lines.size();
+        chunk->lines.relocate(storage + cursor);
+        cursor = align(cursor + lineBytes);
+
+        chunk->useArena(nullptr);
+        chunk->packed = block;
+    }
+}
+
+// The deepest the value stack can get while running this chunk, counted from its frame's first slot. Every
+// reachable instruction is visited once, following jumps, with the depth it is entered at; structured control flow
+// guarantees that all paths into an instruction agree on that depth. The VM reserves the result once per call
+// instead of checking every push.
+int Chunk::computeStackDepth(const int entryDepth) const
+{
+    std::vector<int> depths(count, -1);
+    std::vector<std::pair<int, int>> pending{{0, entryDepth}};
+    auto maxDepth = entryDepth;
+    while (!pending.empty())
+    {
+        auto [offset, depth] = pending.back();
+        pending.pop_back();
+        while (offset < count && depths[offset] == -1)
+        {
+            depths[offset] = depth;
+            const auto opcode = static_cast<OpCode>(code[offset]);
+            const auto &info = opcodeInfo(opcode);
+            depth += info.stackEffect;
+            if (opcode == OpCode::OP_CALL || opcode == OpCode::OP_TAIL_CALL || opcode == OpCode::OP_ARRAY)
+            {
+                depth -= code[offset + 1];
+            }
+            else if (opcode == OpCode::OP_ARRAY_LONG)
+            {
+                depth -= readLongOperand(&code[offset + 1]);
+            }
+
+            maxDepth = std::max(maxDepth, depth);
+            const auto next = offset + 1 + info.operandBytes;
+            switch (opcode)
+            {
+                case OpCode::OP_JUMP:
+                case OpCode::OP_JUMP_IF_FALSE:
+                case OpCode::OP_LESS_JUMP:
+                case OpCode::OP_LESS_EQUAL_JUMP:
+                case OpCode::OP_GREATER_JUMP:
+                case OpCode::OP_GREATER_EQUAL_JUMP:
+                    pending.emplace_back(next + readShortOperand(code + offset + 1), depth);
+                    break;
+                case OpCode::OP_JUMP_IF_FALSE_OR_POP:
+                case OpCode::OP_JUMP_IF_TRUE_OR_POP:
+                    pending.emplace_back(next + readShortOperand(code + offset + 1), depth + 1);
+                    break;
+                case OpCode::OP_LOOP:
+                    pending.emplace_back(next - readShortOperand(code + offset + 1), depth);
+                    break;
+                default:
+                    break;
+            }
+
+            if (opcode == OpCode::OP_JUMP || opcode == OpCode::OP_LOOP || opcode == OpCode::OP_RETURN)
+            {
+                break;
+            }
+
+            offset = next;
+        }
+    }
+
+    return maxDepth;
 }
 
 void Chunk::disassemble(const std::string &name) const
 {
     std::cout << "======== " << name << " ========\n";
+    auto cursor = LineTable::Cursor{lines};
+    auto previousLine = 0;
     for (auto offset = 0; offset < count;)
     {
-        offset = disassembleInstruction(offset);
+        const auto location = cursor.seek(offset);
+        printLocation(offset, location, location.line == previousLine);
+        previousLine = location.line;
+        offset = disassembleOpcode(offset);
     }
 }
 
 [[nodiscard]] int Chunk::disassembleInstruction(const int offset) const
+{
+    printLocation(offset, lines.lookup(offset), false);
+    return disassembleOpcode(offset);
+}
+
+void Chunk::printLocation(const int offset, const SourceLocation location, const bool sameLine)
 {
     std::cout << std::setw(4) << std::setfill('0') << offset << " ";
 
-    if (offset > 0 && lines[offset] == lines[offset - 1])
+    if (sameLine)
     {
-        std::cout << "     |   ";
+        std::cout << "   |:" << std::setw(3) << std::setfill('0') << location.column << " ";
     }
     else
     {
-        std::cout << std::setw(4) << std::setfill('0') << lines[offset] << " ";
+        std::cout << std::setw(4) << std::setfill('0') << location.line << ":"
+                << std::setw(3) << std::setfill('0') << location.column << " ";
     }
+}
 
+[[nodiscard]] int Chunk::disassembleOpcode(const int offset) const
+{
     switch (const auto instruction = code[offset])
     {
         case static_cast<uint8_t>(OpCode::OP_RETURN):
@@ -80,41 +312,147 @@ void Chunk::disassemble(const std::string &name) const
         case static_cast<uint8_t>(OpCode::OP_FALSE):
             return simpleInstruction("OP_FALSE", offset);
         case static_cast<uint8_t>(OpCode::OP_ADD):
-            return constantInstruction("OP_ADD", offset);
+            return simpleInstruction("OP_ADD", offset);
         case static_cast<uint8_t>(OpCode::OP_SUBTRACT):
-            return constantInstruction("OP_SUBTRACT", offset);
+            return simpleInstruction("OP_SUBTRACT", offset);
         case static_cast<uint8_t>(OpCode::OP_MULTIPLY):
-            return constantInstruction("OP_MULTIPLY", offset);
+            return simpleInstruction("OP_MULTIPLY", offset);
         case static_cast<uint8_t>(OpCode::OP_DIVIDE):
-            return constantInstruction("OP_DIVIDE", offset);
+            return simpleInstruction("OP_DIVIDE", offset);
         case static_cast<uint8_t>(OpCode::OP_EXPONENT):
-            return constantInstruction("OP_EXPONENT", offset);
+            return simpleInstruction("OP_EXPONENT", offset);
         case static_cast<uint8_t>(OpCode::OP_LSHIFT):
-            return constantInstruction("OP_LSHIFT", offset);
+            return simpleInstruction("OP_LSHIFT", offset);
         case static_cast<uint8_t>(OpCode::OP_RSHIFT):
-            return constantInstruction("OP_RSHIFT", offset);
+            return simpleInstruction("OP_RSHIFT", offset);
         case static_cast<uint8_t>(OpCode::OP_MODULO):
-            return constantInstruction("OP_MODULO", offset);
+            return simpleInstruction("OP_MODULO", offset);
         case static_cast<uint8_t>(OpCode::OP_NOT):
-            return constantInstruction("OP_NOT", offset);
+            return simpleInstruction("OP_NOT", offset);
         case static_cast<uint8_t>(OpCode::OP_EQUAL):
-            return constantInstruction("OP_EQUAL", offset);
+            return simpleInstruction("OP_EQUAL", offset);
         case static_cast<uint8_t>(OpCode::OP_GREATER):
-            return constantInstruction("OP_GREATER", offset);
+            return simpleInstruction("OP_GREATER", offset);
         case static_cast<uint8_t>(OpCode::OP_LESS):
-            return constantInstruction("OP_LESS", offset);
+            return simpleInstruction("OP_LESS", offset);
         case static_cast<uint8_t>(OpCode::OP_PRINT):
             return simpleInstruction("OP_PRINT", offset);
         case static_cast<uint8_t>(OpCode::OP_POP):
             return simpleInstruction("OP_POP", offset);
         case static_cast<uint8_t>(OpCode::OP_DEFINE_GLOBAL):
-            return constantInstruction("OP_DEFINE_GLOBAL", offset);
+            return byteInstruction("OP_DEFINE_GLOBAL", offset);
         case static_cast<uint8_t>(OpCode::OP_DEFINE_CONSTANT):
-            return constantInstruction("OP_DEFINE_CONSTANT", offset);
+            return byteInstruction("OP_DEFINE_CONSTANT", offset);
         case static_cast<uint8_t>(OpCode::OP_GET_GLOBAL):
-            return constantInstruction("OP_GET_GLOBAL", offset);
+            return byteInstruction("OP_GET_GLOBAL", offset);
         case static_cast<uint8_t>(OpCode::OP_SET_GLOBAL):
-            return constantInstruction("OP_SET_GLOBAL", offset);
+            return byteInstruction("OP_SET_GLOBAL", offset);
+        case static_cast<uint8_t>(OpCode::OP_CONSTANT_LONG):
+            return longConstantInstruction("OP_CONSTANT_LONG", offset);
+        case static_cast<uint8_t>(OpCode::OP_DEFINE_GLOBAL_LONG):
+            return longInstruction("OP_DEFINE_GLOBAL_LONG", offset);
+        case static_cast<uint8_t>(OpCode::OP_DEFINE_CONSTANT_LONG):
+            return longInstruction("OP_DEFINE_CONSTANT_LONG", offset);
+        case static_cast<uint8_t>(OpCode::OP_GET_GLOBAL_LONG):
+            return longInstruction("OP_GET_GLOBAL_LONG", offset);
+        case static_cast<uint8_t>(OpCode::OP_SET_GLOBAL_LONG):
+            return longInstruction("OP_SET_GLOBAL_LONG", offset);
+        case static_cast<uint8_t>(OpCode::OP_ADD_NUM):
+            return simpleInstruction("OP_ADD_NUM", offset);
+        case static_cast<uint8_t>(OpCode::OP_ADD_STR):
+            return simpleInstruction("OP_ADD_STR", offset);
+        case static_cast<uint8_t>(OpCode::OP_SUBTRACT_NUM):
+            return simpleInstruction("OP_SUBTRACT_NUM", offset);
+        case static_cast<uint8_t>(OpCode::OP_MULTIPLY_NUM):
+            return simpleInstruction("OP_MULTIPLY_NUM", offset);
+        case static_cast<uint8_t>(OpCode::OP_DIVIDE_NUM):
+            return simpleInstruction("OP_DIVIDE_NUM", offset);
+        case static_cast<uint8_t>(OpCode::OP_GREATER_NUM):
+            return simpleInstruction("OP_GREATER_NUM", offset);
+        case static_cast<uint8_t>(OpCode::OP_LESS_NUM):
+            return simpleInstruction("OP_LESS_NUM", offset);
+        case static_cast<uint8_t>(OpCode::OP_GET_LOCAL):
+            return byteInstruction("OP_GET_LOCAL", offset);
+        case static_cast<uint8_t>(OpCode::OP_SET_LOCAL):
+            return byteInstruction("OP_SET_LOCAL", offset);
+        case static_cast<uint8_t>(OpCode::OP_JUMP):
+            return jumpInstruction("OP_JUMP", 1, offset);
+        case static_cast<uint8_t>(OpCode::OP_JUMP_IF_FALSE):
+            return jumpInstruction("OP_JUMP_IF_FALSE", 1, offset);
+        case static_cast<uint8_t>(OpCode::OP_LOOP):
+            return jumpInstruction("OP_LOOP", -1, offset);
+        case static_cast<uint8_t>(OpCode::OP_CALL):
+            return byteInstruction("OP_CALL", offset);
+        case static_cast<uint8_t>(OpCode::OP_CLOSURE):
+            return constantInstruction("OP_CLOSURE", offset);
+        case static_cast<uint8_t>(OpCode::OP_CLOSURE_LONG):
+            return longConstantInstruction("OP_CLOSURE_LONG", offset);
+        case static_cast<uint8_t>(OpCode::OP_GET_UPVALUE):
+            return byteInstruction("OP_GET_UPVALUE", offset);
+        case static_cast<uint8_t>(OpCode::OP_SET_UPVALUE):
+            return byteInstruction("OP_SET_UPVALUE", offset);
+        case static_cast<uint8_t>(OpCode::OP_CLOSE_UPVALUE):
+            return simpleInstruction("OP_CLOSE_UPVALUE", offset);
+        case static_cast<uint8_t>(OpCode::OP_JUMP_IF_FALSE_OR_POP):
+            return jumpInstruction("OP_JUMP_IF_FALSE_OR_POP", 1, offset);
+        case static_cast<uint8_t>(OpCode::OP_JUMP_IF_TRUE_OR_POP):
+            return jumpInstruction("OP_JUMP_IF_TRUE_OR_POP", 1, offset);
+        case static_cast<uint8_t>(OpCode::OP_XOR):
+            return simpleInstruction("OP_XOR", offset);
+        case static_cast<uint8_t>(OpCode::OP_GREATER_EQUAL):
+            return simpleInstruction("OP_GREATER_EQUAL", offset);
+        case static_cast<uint8_t>(OpCode::OP_LESS_EQUAL):
+            return simpleInstruction("OP_LESS_EQUAL", offset);
+        case static_cast<uint8_t>(OpCode::OP_NOT_EQUAL):
+            return simpleInstruction("OP_NOT_EQUAL", offset);
+        case static_cast<uint8_t>(OpCode::OP_GREATER_EQUAL_NUM):
+            return simpleInstruction("OP_GREATER_EQUAL_NUM", offset);
+        case static_cast<uint8_t>(OpCode::OP_LESS_EQUAL_NUM):
+            return simpleInstruction("OP_LESS_EQUAL_NUM", offset);
+        case static_cast<uint8_t>(OpCode::OP_LESS_JUMP):
+            return jumpInstruction("OP_LESS_JUMP", 1, offset);
+        case static_cast<uint8_t>(OpCode::OP_LESS_EQUAL_JUMP):
+            return jumpInstruction("OP_LESS_EQUAL_JUMP", 1, offset);
+        case static_cast<uint8_t>(OpCode::OP_GREATER_JUMP):
+            return jumpInstruction("OP_GREATER_JUMP", 1, offset);
+        case static_cast<uint8_t>(OpCode::OP_GREATER_EQUAL_JUMP):
+            return jumpInstruction("OP_GREATER_EQUAL_JUMP", 1, offset);
+        case static_cast<uint8_t>(OpCode::OP_GET_GLOBAL_ADD_CONST):
+            return byteConstantInstruction("OP_GET_GLOBAL_ADD_CONST", offset);
+        case static_cast<uint8_t>(OpCode::OP_INCREMENT_LOCAL):
+            return byteConstantInstruction("OP_INCREMENT_LOCAL", offset);
+        case static_cast<uint8_t>(OpCode::OP_TAIL_CALL):
+            return byteInstruction("OP_TAIL_CALL", offset);
+        case static_cast<uint8_t>(OpCode::OP_NUM_NEGATE):
+            return simpleInstruction("OP_NUM_NEGATE", offset);
+        case static_cast<uint8_t>(OpCode::OP_NUM_ADD):
+            return simpleInstruction("OP_NUM_ADD", offset);
+        case static_cast<uint8_t>(OpCode::OP_NUM_SUBTRACT):
+            return simpleInstruction("OP_NUM_SUBTRACT", offset);
+        case static_cast<uint8_t>(OpCode::OP_NUM_MULTIPLY):
+            return simpleInstruction("OP_NUM_MULTIPLY", offset);
+        case static_cast<uint8_t>(OpCode::OP_NUM_DIVIDE):
+            return simpleInstruction("OP_NUM_DIVIDE", offset);
+        case static_cast<uint8_t>(OpCode::OP_NUM_GREATER):
+            return simpleInstruction("OP_NUM_GREATER", offset);
+        case static_cast<uint8_t>(OpCode::OP_NUM_LESS):
+            return simpleInstruction("OP_NUM_LESS", offset);
+        case static_cast<uint8_t>(OpCode::OP_NUM_GREATER_EQUAL):
+            return simpleInstruction("OP_NUM_GREATER_EQUAL", offset);
+        case static_cast<uint8_t>(OpCode::OP_NUM_LESS_EQUAL):
+            return simpleInstruction("OP_NUM_LESS_EQUAL", offset);
+        case static_cast<uint8_t>(OpCode::OP_ARRAY):
+            return byteInstruction("OP_ARRAY", offset);
+        case static_cast<uint8_t>(OpCode::OP_INDEX_GET):
+            return simpleInstruction("OP_INDEX_GET", offset);
+        case static_cast<uint8_t>(OpCode::OP_INDEX_SET):
+            return simpleInstruction("OP_INDEX_SET", offset);
+        case static_cast<uint8_t>(OpCode::OP_GET_PROPERTY):
+            return constantInstruction("OP_GET_PROPERTY", offset);
+        case static_cast<uint8_t>(OpCode::OP_GET_PROPERTY_LONG):
+            return longConstantInstruction("OP_GET_PROPERTY_LONG", offset);
+        case static_cast<uint8_t>(OpCode::OP_ARRAY_LONG):
+            return longInstruction("OP_ARRAY_LONG", offset);
         default:
             std::cout << "Unknown opcode " << instruction << "\n";
             return offset + 1;
@@ -127,6 +465,25 @@ void Chunk::disassemble(const std::string &name) const
     return offset + 1;
 }
 
+[[nodiscard]] int Chunk::byteInstruction(const std::string &name, const int offset) const
+{
+    std::cout << name << "(" << +code[offset + 1] << ")\n";
+    return offset + 2;
+}
+
+[[nodiscard]] int Chunk::longInstruction(const std::string &name, const int offset) const
+{
+    std::cout << name << "(" << readLongOperand(code + offset + 1) << ")\n";
+    return offset + 4;
+}
+
+[[nodiscard]] int Chunk::jumpInstruction(const std::string &name, const int sign, const int offset) const
+{
+    const auto jump = readShortOperand(code + offset + 1);
+    std::cout << name << "(" << offset << " -> " << offset + 3 + sign * jump << ")\n";
+    return offset + 3;
+}
+
 [[nodiscard]] int Chunk::constantInstruction(const std::string &name, const int offset) const
 {
     const auto constant = code[offset + 1];
@@ -135,3 +492,21 @@ void Chunk::disassemble(const std::string &name) const
     std::cout << "\n";
     return offset + 2;
 }
+
+[[nodiscard]] int Chunk::longConstantInstruction(const std::string &name, const int offset) const
+{
+    const auto constant = readLongOperand(code + offset + 1);
+    std::cout << name << "(" << constant << ") ";
+    util::printValue(constants.values[constant]);
+    std::cout << "\n";
+    return offset + 4;
+}
+
+[[nodiscard]] int Chunk::byteConstantInstruction(const std::string &name, const int offset) const
+{
+    const auto constant = code[offset + 2];
+    std::cout << name << "(" << +code[offset + 1] << ", " << +constant << ") ";
+    util::printValue(constants.values[constant]);
+    std::cout << "\n";
+    return offset + 3;
+}
@@ -1,5 +1,6 @@
 #include "../include/compiler.h"
 
+#include <format>
 #include <iostream>
 
 #include "../include/opcode.h"
@@ -7,40 +8,52 @@
 #include "../include/scanner.h"
 #include "../include/token.h"
 
-bool Compiler::compile(const std::string &source, Chunk *chunk)
+ObjFunction *Compiler::compile(const std::string &source)
 {
     scanner = Scanner{source};
-    compilingChunk = chunk;
     parser.panicMode = false;
     parser.hadError = false;
+
+    auto script = FunctionScope{};
+    current = nullptr;
+    beginFunction(script, FunctionType::SCRIPT);
     advance();
     while (!match(TokenType::FILE_EOF))
     {
         declaration();
     }
 
-    endCompiler();
-    return !parser.hadError;
+    const auto function = endFunction();
+    finishCompilation();
+    return parser.hadError ? nullptr : function;
 }
 
-void Compiler::advance()
+void Compiler::setOptimizationLevel(const int level)
 {
-    parser.previous = parser.current;
-    for (;;)
-    {
-        parser.current = scanner.scanToken();
-        if (parser.current.type != TokenType::ERROR)
-        {
-            break;
-        }
+    optimizationLevel = level;
+}
 
-        errorAtCurrent(std::string{parser.current.lexeme});
+ObjFunction *Compiler::endFunction()
+{
+    emitReturn();
+    const auto function = current->function;
+    if (optimizationLevel > 0 && !parser.hadError)
+    {
+        Optimizer{heap, function->chunk, optimizationLevel}.run();
     }
+
+    function->chunk.maxStackDepth = function->chunk.computeStackDepth(1 + function->arity);
+    leaveFunction();
+    return function;
 }
 
 void Compiler::declaration()
 {
-    if (match(TokenType::LET))
+    if (match(TokenType::FUN))
+    {
+        functionDeclaration();
+    }
+    else if (match(TokenType::LET))
     {
         variableDeclaration();
     }
@@ -59,12 +72,87 @@ void Compiler::declaration()
     }
 }
 
+void Compiler::functionDeclaration()
+{
+    const auto global = parseVariable("Expect function name.");
+    if (current->scopeDepth > 0)
+    {
+        // A local function may refer to itself, so it is usable before its body is compiled.
+        markInitialized();
+    }
+
+    function(FunctionType::FUNCTION);
+    defineVariable(global);
+}
+
+void Compiler::function(const FunctionType type)
+{
+    auto scope = FunctionScope{};
+    beginFunction(scope, type);
+    beginScope();
+
+    consume(TokenType::LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(TokenType::RIGHT_PAREN))
+    {
+        do
+        {
+            if (++current->function->arity > UINT8_MAX)
+            {
+                errorAtCurrent("Cannot have more than 255 parameters.");
+            }
+
+            defineVariable(parseVariable("Expect parameter name."));
+        } while (match(TokenType::COMMA));
+    }
+
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(TokenType::LEFT_BRACE, "Expect '{' before function body.");
+    block();
+
+    const auto function = endFunction();
+    emitIndexed(OpCode::OP_CLOSURE, OpCode::OP_CLOSURE_LONG, makeConstant(Value::object(function)));
+}
+
 void Compiler::statement()
 {
     if (match(TokenType::PRINT))
     {
         printStatement();
     }
+    else if (match(TokenType::IF))
+    {
+        ifStatement();
+    }
+    else if (match(TokenType::WHILE))
+    {
+        whileStatement();
+    }
+    else if (match(TokenType::DO))
+    {
+        doWhileStatement();
+    }
+    else if (match(TokenType::FOR))
+    {
+        forStatement();
+    }
+    else if (match(TokenType::BREAK))
+    {
+        breakStatement();
+    }
+    else if (match(TokenType::CONTINUE))
+    {
+        continueStatement();
+    }
+    else if (match(TokenType::RETURN))
+    {
+        returnStatement();
+    }
+    else if (match(TokenType::LEFT_BRACE))
+    {
+        beginScope();
+        block();
+        endScope();
+    }
     else
     {
         expressionStatement();
@@ -89,9 +177,15 @@ void Compiler::variableDeclaration()
 
 void Compiler::constantDeclaration()
 {
-    auto const variableName = parseVariable("Expect variable name.");
+    auto const variableName = parseVariable("Expect variable name.", true);
     consume(TokenType::EQUAL, "Expected '=' after constant");
     expression();
+    if (current->scopeDepth > 0 && current->localCount > 0)
+    {
+        // A local constant keeps the type of its value for as long as it is in scope.
+        current->locals[current->localCount - 1].type = expressionType;
+    }
+
     consume(TokenType::SEMICOLON, "Expect ';' after constant declaration");
     defineConstant(variableName);
 }
@@ -103,6 +197,213 @@ void Compiler::printStatement()
     emitByte(static_cast<uint8_t>(OpCode::OP_PRINT));
 }
 
+void Compiler::ifStatement()
+{
+    consume(TokenType::LEFT_PAREN, "Expect '(' after if.");
+    expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after if's condition.");
+
+    const auto thenJump = emitJump(OpCode::OP_JUMP_IF_FALSE);
+    statement();
+    if (match(TokenType::ELSE))
+    {
+        const auto elseJump = emitJump(OpCode::OP_JUMP);
+        patchJump(thenJump);
+        statement();
+        patchJump(elseJump);
+    }
+    else
+    {
+        patchJump(thenJump);
+    }
+}
+
+void Compiler::whileStatement()
+{
+    const auto loopStart = currentChunk()->count;
+    consume(TokenType::LEFT_PAREN, "Expect '(' after while.");
+    expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after while's condition.");
+
+    const auto exitJump = emitJump(OpCode::OP_JUMP_IF_FALSE);
+    auto loop = Loop{current->innermostLoop, current->scopeDepth, loopStart};
+    current->innermostLoop = &loop;
+    statement();
+    emitLoop(loopStart);
+    patchJump(exitJump);
+
+    current->innermostLoop = loop.enclosing;
+    for (const auto jump: loop.breakJumps)
+    {
+        patchJump(jump);
+    }
+}
+
+void Compiler::doWhileStatement()
+{
+    const auto loopStart = currentChunk()->count;
+    auto loop = Loop{current->innermostLoop, current->scopeDepth, -1};
+    current->innermostLoop = &loop;
+    statement();
+    current->innermostLoop = loop.enclosing;
+
+    for (const auto jump: loop.continueJumps)
+    {
+        patchJump(jump);
+    }
+
+    consume(TokenType::WHILE, "Expect 'while' after do while's statements block.");
+    consume(TokenType::LEFT_PAREN, "Expect '(' after while.");
+    expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after while's condition.");
+    consume(TokenType::SEMICOLON, "Expect ';' after do while.");
+
+    const auto exitJump = emitJump(OpCode::OP_JUMP_IF_FALSE);
+    emitLoop(loopStart);
+    patchJump(exitJump);
+    for (const auto jump: loop.breakJumps)
+    {
+        patchJump(jump);
+    }
+}
+
+// The increment is compiled before the body, which jumps back to it, so that a continue is a plain backward jump.
+void Compiler::forStatement()
+{
+    beginScope();
+    consume(TokenType::LEFT_PAREN, "Expect '(' after for.");
+    if (match(TokenType::LET))
+    {
+        variableDeclaration();
+    }
+    else if (!match(TokenType::SEMICOLON))
+    {
+        expressionStatement();
+    }
+
+    auto loopStart = currentChunk()->count;
+    auto exitJump = -1;
+    if (!match(TokenType::SEMICOLON))
+    {
+        expression();
+        consume(TokenType::SEMICOLON, "Expect ';' after loop's condition.");
+        exitJump = emitJump(OpCode::OP_JUMP_IF_FALSE);
+    }
+
+    if (!match(TokenType::RIGHT_PAREN))
+    {
+        const auto bodyJump = emitJump(OpCode::OP_JUMP);
+        const auto incrementStart = currentChunk()->count;
+        expression();
+        emitByte(static_cast<uint8_t>(OpCode::OP_POP));
+        consume(TokenType::RIGHT_PAREN, "Expect ')' after for clauses.");
+
+        emitLoop(loopStart);
+        loopStart = incrementStart;
+        patchJump(bodyJump);
+    }
+
+    auto loop = Loop{current->innermostLoop, current->scopeDepth, loopStart};
+    current->innermostLoop = &loop;
+    statement();
+    emitLoop(loopStart);
+    current->innermostLoop = loop.enclosing;
+
+    if (exitJump != -1)
+    {
+        patchJump(exitJump);
+    }
+
+    for (const auto jump: loop.breakJumps)
+    {
+        patchJump(jump);
+    }
+
+    endScope();
+}
+
+void Compiler::breakStatement()
+{
+    consume(TokenType::SEMICOLON, "Expect ';' after break.");
+    if (current->innermostLoop == nullptr)
+    {
+        error("Cannot use 'break' outside of a loop.");
+        return;
+    }
+
+    popLocalsAbove(current->innermostLoop->scopeDepth);
+    current->innermostLoop->breakJumps.push_back(emitJump(OpCode::OP_JUMP));
+}
+
+void Compiler::continueStatement()
+{
+    consume(TokenType::SEMICOLON, "Expect ';' after continue.");
+    if (current->innermostLoop == nullptr)
+    {
+        error("Cannot use 'continue' outside of a loop.");
+        return;
+    }
+
+    popLocalsAbove(current->innermostLoop->scopeDepth);
+    if (current->innermostLoop->continueTarget == -1)
+    {
+        current->innermostLoop->continueJumps.push_back(emitJump(OpCode::OP_JUMP));
+    }
+    else
+    {
+        emitLoop(current->innermostLoop->continueTarget);
+    }
+}
+
+void Compiler::returnStatement()
+{
+    if (current->type == FunctionType::SCRIPT)
+    {
+        error("Cannot return from top-level code.");
+    }
+
+    if (match(TokenType::SEMICOLON))
+    {
+        emitReturn();
+        return;
+    }
+
+    lastCallEnd = -1;
+    expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after return value.");
+
+    // A call that is the last instruction of the value is in tail position. Jumps that short-circuit around it still
+    // land on the OP_RETURN that follows.
+    if (lastCallEnd == currentChunk()->count)
+    {
+        currentChunk()->code[lastCallEnd - 2] = static_cast<uint8_t>(OpCode::OP_TAIL_CALL);
+    }
+
+    emitByte(static_cast<uint8_t>(OpCode::OP_RETURN));
+}
+
+void Compiler::block()
+{
+    while (!check(TokenType::RIGHT_BRACE) && !check(TokenType::FILE_EOF))
+    {
+        declaration();
+    }
+
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
+}
+
+void Compiler::endScope()
+{
+    current->scopeDepth--;
+    while (current->localCount > 0 && current->locals[current->localCount - 1].depth > current->scopeDepth)
+    {
+        emitByte(static_cast<uint8_t>(current->locals[current->localCount - 1].captured
+                                          ? OpCode::OP_CLOSE_UPVALUE
+                                          : OpCode::OP_POP));
+        current->localCount--;
+    }
+}
+
 void Compiler::expressionStatement()
 {
     expression();
@@ -118,7 +419,8 @@ void Compiler::expression()
 void Compiler::number([[maybe_unused]] bool canAssign)
 {
     const auto value = std::strtod({parser.previous.lexeme.data()}, nullptr);
-    emitConstant(value);
+    emitConstant(Value::number(value));
+    expressionType = ValueType::NUMBER;
 }
 
 void Compiler::grouping([[maybe_unused]] bool canAssign)
@@ -130,15 +432,16 @@ void Compiler::grouping([[maybe_unused]] bool canAssign)
 void Compiler::unary([[maybe_unused]] bool canAssign)
 {
     const auto operatorType = parser.previous.type;
-    expression();
     parsePrecedence(Precedence::Unary);
     switch (operatorType)
     {
         case TokenType::BANG:
             emitByte(static_cast<uint8_t>(OpCode::OP_NOT));
+            expressionType = ValueType::BOOL;
             break;
         case TokenType::MINUS:
-            emitByte(static_cast<uint8_t>(OpCode::OP_NEGATE));
+            emitByte(static_cast<uint8_t>(selectOperator(OpCode::OP_NEGATE, expressionType == ValueType::NUMBER)));
+            expressionType = ValueType::NUMBER;
             break;
         default:
             break;
@@ -148,22 +451,31 @@ void Compiler::unary([[maybe_unused]] bool canAssign)
 void Compiler::binary([[maybe_unused]] bool canAssign)
 {
     const auto operatorType = parser.previous.type;
+    const auto leftType = expressionType;
     const auto rule = getRule(operatorType);
     parsePrecedence(static_cast<Precedence>(static_cast<int>(rule.precedence) + 1));
 
+    const auto numbers = leftType == ValueType::NUMBER && expressionType == ValueType::NUMBER;
+    const auto strings = leftType == ValueType::STRING && expressionType == ValueType::STRING;
+    expressionType = ValueType::NUMBER;
     switch (operatorType)
     {
         case TokenType::PLUS:
-            emitByte(static_cast<uint8_t>(OpCode::OP_ADD));
+            emitByte(static_cast<uint8_t>(selectOperator(OpCode::OP_ADD, numbers)));
+            if (!numbers)
+            {
+                expressionType = strings ? std::optional{ValueType::STRING} : std::nullopt;
+            }
+
             break;
         case TokenType::MINUS:
-            emitByte(static_cast<uint8_t>(OpCode::OP_SUBTRACT));
+            emitByte(static_cast<uint8_t>(selectOperator(OpCode::OP_SUBTRACT, numbers)));
             break;
         case TokenType::STAR:
-            emitByte(static_cast<uint8_t>(OpCode::OP_MULTIPLY));
+            emitByte(static_cast<uint8_t>(selectOperator(OpCode::OP_MULTIPLY, numbers)));
             break;
         case TokenType::SLASH:
-            emitByte(static_cast<uint8_t>(OpCode::OP_DIVIDE));
+            emitByte(static_cast<uint8_t>(selectOperator(OpCode::OP_DIVIDE, numbers)));
             break;
         case TokenType::MODULO:
             emitByte(static_cast<uint8_t>(OpCode::OP_MODULO));
@@ -173,38 +485,169 @@ void Compiler::binary([[maybe_unused]] bool canAssign)
             break;
         case TokenType::BANG_EQUAL:
             emitByte(static_cast<uint8_t>(OpCode::OP_EQUAL), static_cast<uint8_t>(OpCode::OP_NOT));
+            expressionType = ValueType::BOOL;
             break;
         case TokenType::EQUAL_EQUAL:
             emitByte(static_cast<uint8_t>(OpCode::OP_EQUAL));
+            expressionType = ValueType::BOOL;
             break;
         case TokenType::GREATER:
-            emitByte(static_cast<uint8_t>(OpCode::OP_GREATER));
+            emitByte(static_cast<uint8_t>(selectOperator(OpCode::OP_GREATER, numbers)));
+            expressionType = ValueType::BOOL;
             break;
         case TokenType::GREATER_EQUAL:
-            emitByte(static_cast<uint8_t>(OpCode::OP_LESS), static_cast<uint8_t>(OpCode::OP_NOT));
+            emitByte(static_cast<uint8_t>(selectOperator(OpCode::OP_LESS, numbers)),
+                     static_cast<uint8_t>(OpCode::OP_NOT));
+            expressionType = ValueType::BOOL;
             break;
         case TokenType::LESS:
-            emitByte(static_cast<uint8_t>(OpCode::OP_LESS));
+            emitByte(static_cast<uint8_t>(selectOperator(OpCode::OP_LESS, numbers)));
+            expressionType = ValueType::BOOL;
             break;
         case TokenType::LESS_EQUAL:
-            emitByte(static_cast<uint8_t>(OpCode::OP_GREATER), static_cast<uint8_t>(OpCode::OP_NOT));
+            emitByte(static_cast<uint8_t>(selectOperator(OpCode::OP_GREATER, numbers)),
+                     static_cast<uint8_t>(OpCode::OP_NOT));
+            expressionType = ValueType::BOOL;
             break;
         default: break;
     }
 }
 
+void Compiler::call([[maybe_unused]] bool canAssign)
+{
+    const auto argCount = argumentList();
+    emitByte(static_cast<uint8_t>(OpCode::OP_CALL), argCount);
+    lastCallEnd = currentChunk()->count;
+    expressionType = std::nullopt;
+}
+
+void Compiler::arrayLiteral([[maybe_unused]] bool canAssign)
+{
+    auto count = 0;
+    if (!check(TokenType::RIGHT_BRACKET))
+    {
+        do
+        {
+            expression();
+            if (count == MAX_LONG_OPERAND)
+            {
+                error("Cannot have more than 16777215 elements in an array literal.");
+            }
+
+            count++;
+        } while (match(TokenType::COMMA));
+    }
+
+    consume(TokenType::RIGHT_BRACKET, "Expect ']' after array elements.");
+    emitIndexed(OpCode::OP_ARRAY, OpCode::OP_ARRAY_LONG, count);
+    expressionType = ValueType::ARRAY;
+}
+
+// An assigned element leaves the assigned value as the result, like an assigned variable.
+void Compiler::subscript(const bool canAssign)
+{
+    expression();
+    consume(TokenType::RIGHT_BRACKET, "Expect ']' after index.");
+    if (canAssign && match(TokenType::EQUAL))
+    {
+        expression();
+        emitByte(static_cast<uint8_t>(OpCode::OP_INDEX_SET));
+        return;
+    }
+
+    emitByte(static_cast<uint8_t>(OpCode::OP_INDEX_GET));
+    expressionType = std::nullopt;
+}
+
+void Compiler::dot([[maybe_unused]] bool canAssign)
+{
+    consume(TokenType::IDENTIFIER, "Expect property name after '.'.");
+    const auto name = heap.copyString(parser.previous.lexeme);
+    emitIndexed(OpCode::OP_GET_PROPERTY, OpCode::OP_GET_PROPERTY_LONG, makeConstant(Value::object(name)));
+    expressionType = std::nullopt;
+}
+
+uint8_t Compiler::argumentList()
+{
+    auto argCount = 0;
+    if (!check(TokenType::RIGHT_PAREN))
+    {
+        do
+        {
+            expression();
+            if (argCount == UINT8_MAX)
+            {
+                error("Cannot have more than 255 arguments.");
+            }
+
+            argCount++;
+        } while (match(TokenType::COMMA));
+    }
+
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
+    return static_cast<uint8_t>(argCount);
+}
+
+// and/or leave the deciding operand as the result, so the right operand is only compiled into the fall-through path.
+void Compiler::logicalAnd([[maybe_unused]] bool canAssign)
+{
+    const auto leftType = expressionType;
+    const auto endJump = emitJump(OpCode::OP_JUMP_IF_FALSE_OR_POP);
+    parsePrecedence(Precedence::And);
+    patchJump(endJump);
+    expressionType = leftType == expressionType ? leftType : std::nullopt;
+}
+
+void Compiler::logicalOr([[maybe_unused]] bool canAssign)
+{
+    const auto leftType = expressionType;
+    const auto endJump = emitJump(OpCode::OP_JUMP_IF_TRUE_OR_POP);
+    parsePrecedence(Precedence::Or);
+    patchJump(endJump);
+    expressionType = leftType == expressionType ? leftType : std::nullopt;
+}
+
+void Compiler::logicalXor([[maybe_unused]] bool canAssign)
+{
+    parsePrecedence(static_cast<Precedence>(static_cast<int>(Precedence::Xor) + 1));
+    emitByte(static_cast<uint8_t>(OpCode::OP_XOR));
+    expressionType = ValueType::BOOL;
+}
+
+// nand and nor are the negations of and/or, and short-circuit the same way.
+void Compiler::logicalNand([[maybe_unused]] bool canAssign)
+{
+    const auto endJump = emitJump(OpCode::OP_JUMP_IF_FALSE_OR_POP);
+    parsePrecedence(static_cast<Precedence>(static_cast<int>(Precedence::Nand) + 1));
+    patchJump(endJump);
+    emitByte(static_cast<uint8_t>(OpCode::OP_NOT));
+    expressionType = ValueType::BOOL;
+}
+
+void Compiler::logicalNor([[maybe_unused]] bool canAssign)
+{
+    const auto endJump = emitJump(OpCode::OP_JUMP_IF_TRUE_OR_POP);
+    parsePrecedence(static_cast<Precedence>(static_cast<int>(Precedence::Nor) + 1));
+    patchJump(endJump);
+    emitByte(static_cast<uint8_t>(OpCode::OP_NOT));
+    expressionType = ValueType::BOOL;
+}
+
 void Compiler::literal([[maybe_unused]] bool canAssign)
 {
     switch (parser.previous.type)
     {
         case TokenType::FALSE:
             emitByte(static_cast<uint8_t>(OpCode::OP_FALSE));
+            expressionType = ValueType::BOOL;
             break;
         case TokenType::TRUE:
             emitByte(static_cast<uint8_t>(OpCode::OP_TRUE));
+            expressionType = ValueType::BOOL;
             break;
         case TokenType::NIL:
             emitByte(static_cast<uint8_t>(OpCode::OP_NULL));
+            expressionType = ValueType::NIL;
             break;
         default: break;
     }
@@ -212,109 +655,142 @@ void Compiler::literal([[maybe_unused]] bool canAssign)
 
 void Compiler::string([[maybe_unused]] bool canAssign)
 {
-    const auto contentString = std::string(parser.previous.lexeme.data() + 1, parser.previous.lexeme.length() - 2);
-    emitConstant(contentString);
+    const auto content = parser.previous.lexeme.substr(1, parser.previous.lexeme.length() - 2);
+    emitConstant(Value::object(heap.copyString(content)));
+    expressionType = ValueType::STRING;
 }
 
 void Compiler::variable(bool canAssign)
 {
-    namedVariable(parser.previous, canAssign);
+    // Copied, since compiling an assigned value moves parser.previous past the name.
+    const auto name = parser.previous;
+    namedVariable(name, canAssign);
 }
 
 void Compiler::namedVariable(const Token &name, bool canAssign)
 {
-    const auto argument = identifierConstant(name);
-    if (canAssign && match(TokenType::EQUAL))
+    auto getOp = OpCode::OP_GET_LOCAL;
+    auto setOp = OpCode::OP_SET_LOCAL;
+    auto constant = false;
+    auto slot = resolveLocal(current, name);
+    if (slot != -1)
     {
-        expression();
-        emitByte(static_cast<uint8_t>(OpCode::OP_SET_GLOBAL), argument);
+        constant = current->locals[slot].constant;
     }
-    else
+    else if (slot = resolveUpvalue(current, name); slot != -1)
     {
-        emitByte(static_cast<uint8_t>(OpCode::OP_GET_GLOBAL), argument);
+        getOp = OpCode::OP_GET_UPVALUE;
+        setOp = OpCode::OP_SET_UPVALUE;
+        constant = current->function->upvalues[slot].constant;
     }
-}
-
-void Compiler::consume(TokenType type, const std::string &message)
-{
-    if (parser.current.type == type)
+    else
     {
-        advance();
+        const auto argument = globalSlot(name);
+        if (canAssign && match(TokenType::EQUAL))
+        {
+            expression();
+            emitIndexed(OpCode::OP_SET_GLOBAL, OpCode::OP_SET_GLOBAL_LONG, argument);
+        }
+        else
+        {
+            emitIndexed(OpCode::OP_GET_GLOBAL, OpCode::OP_GET_GLOBAL_LONG, argument);
+            expressionType = std::nullopt;
+        }
+
         return;
     }
 
-    errorAtCurrent(message);
-}
+    if (canAssign && match(TokenType::EQUAL))
+    {
+        if (constant)
+        {
+            error(std::format("Constant {} cannot be reassigned.", name.lexeme));
+        }
 
-bool Compiler::match(const TokenType type)
-{
-    if (!check(type))
+        expression();
+        emitByte(static_cast<uint8_t>(setOp), static_cast<uint8_t>(slot));
+    }
+    else
     {
-        return false;
+        emitByte(static_cast<uint8_t>(getOp), static_cast<uint8_t>(slot));
+        expressionType = getOp == OpCode::OP_GET_LOCAL ? current->locals[slot].type : std::nullopt;
     }
+}
 
-    advance();
-    return true;
+void Compiler::emitByte(const uint8_t byte) const
+{
+    currentChunk()->write(byte, {parser.previous.line, parser.previous.column});
 }
 
-bool Compiler::check(const TokenType type) const
+void Compiler::emitByte(const uint8_t byte1, const uint8_t byte2) const
 {
-    return parser.current.type == type;
+    emitByte(byte1);
+    emitByte(byte2);
 }
 
-void Compiler::errorAtCurrent(const std::string &message)
+void Compiler::emitIndexed(const OpCode shortForm, const OpCode longForm, const int index) const
 {
-    errorAt(parser.current, message);
+    if (index <= UINT8_MAX)
+    {
+        emitByte(static_cast<uint8_t>(shortForm), static_cast<uint8_t>(index));
+        return;
+    }
+
+    emitByte(static_cast<uint8_t>(longForm));
+    emitByte(static_cast<uint8_t>(index & 0xff));
+    emitByte(static_cast<uint8_t>(index >> 8 & 0xff));
+    emitByte(static_cast<uint8_t>(index >> 16 & 0xff));
 }
 
-void Compiler::error(const std::string &message)
+int Compiler::emitJump(const OpCode instruction) const
 {
-    errorAt(parser.current, message);
+    emitByte(static_cast<uint8_t>(instruction));
+    emitByte(0xff, 0xff);
+    return currentChunk()->count - 2;
 }
 
-void Compiler::errorAt(const Token &token, const std::string &message)
+void Compiler::patchJump(const int offset)
 {
-    parser.panicMode = true;
-    std::cerr << "[line " << token.line << "] Error";
-    switch (token.type)
+    const auto jump = currentChunk()->count - offset - 2;
+    if (jump > MAX_JUMP)
     {
-        case TokenType::FILE_EOF:
-            std::cerr << " at end";
-            break;
-        case TokenType::ERROR:
-            break;
-        case TokenType::IDENTIFIER:
-            std::cerr << " at token " << token.type << " (" << token.lexeme << ")";
-            break;
-        default:
-            std::cerr << " at token " << token.type;
-            break;
+        error("Too much code to jump over.");
     }
 
-    std::cerr << " " << message << "\n";
-    parser.hadError = true;
+    currentChunk()->patchShortOperand(offset, jump);
 }
 
-void Compiler::emitByte(const uint8_t byte) const
+void Compiler::emitLoop(const int loopStart)
 {
-    compilingChunk->write(byte, parser.previous.line);
+    emitByte(static_cast<uint8_t>(OpCode::OP_LOOP));
+    const auto offset = currentChunk()->count - loopStart + 2;
+    if (offset > MAX_JUMP)
+    {
+        error("Loop body too large.");
+    }
+
+    emitByte(static_cast<uint8_t>(offset & 0xff), static_cast<uint8_t>(offset >> 8 & 0xff));
 }
 
-void Compiler::emitByte(const uint8_t byte1, const uint8_t byte2) const
+// Pops the locals of the scopes a break or continue jumps out of. The compiler keeps tracking them, since the
+// code following the jump in the same block is still compiled against them.
+void Compiler::popLocalsAbove(const int depth) const
 {
-    emitByte(byte1);
-    emitByte(byte2);
+    for (auto i = current->localCount - 1; i >= 0 && current->locals[i].depth > depth; i--)
+    {
+        emitByte(static_cast<uint8_t>(current->locals[i].captured ? OpCode::OP_CLOSE_UPVALUE : OpCode::OP_POP));
+    }
 }
 
-void Compiler::emitConstant(const Value &value)
+void Compiler::emitConstant(const Value value)
 {
-    emitByte(static_cast<uint8_t>(OpCode::OP_CONSTANT), makeConstant(value));
+    emitIndexed(OpCode::OP_CONSTANT, OpCode::OP_CONSTANT_LONG, makeConstant(value));
 }
 
-uint8_t Compiler::makeConstant(const Value &value)
+int Compiler::makeConstant(const Value value)
 {
-    auto const constant = compilingChunk->addConstant(value);
-    if (constant > UINT8_MAX)
+    auto const constant = currentChunk()->addConstant(value);
+    if (constant > MAX_LONG_OPERAND)
     {
         error("Too many constants in one chunk.");
         return 0;
@@ -323,51 +799,16 @@ uint8_t Compiler::makeConstant(const Value &value)
     return constant;
 }
 
-void Compiler::endCompiler() const
-{
-    emitReturn();
-
-#ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError)
-    {
-        compilingChunk->disassemble("code");
-    }
-#endif
-}
-
-void Compiler::synchronize()
+void Compiler::emitReturn() const
 {
-    parser.panicMode = false;
-    while (parser.current.type != TokenType::FILE_EOF)
-    {
-        if (parser.previous.type == TokenType::SEMICOLON)
-        {
-            return;
-        }
-
-        switch (parser.previous.type)
-        {
-            case TokenType::CLASS:
-            case TokenType::FUN:
-            case TokenType::LET:
-            case TokenType::CONST:
-            case TokenType::FOR:
-            case TokenType::IF:
-            case TokenType::WHILE:
-            case TokenType::PRINT:
-            case TokenType::RETURN:
-                return;
-
-            default: break;
-        }
-
-        advance();
-    }
+    emitByte(static_cast<uint8_t>(OpCode::OP_NULL), static_cast<uint8_t>(OpCode::OP_RETURN));
 }
 
-void Compiler::emitReturn() const
+// The unchecked OP_NUM_ form of an operator when its operands are proven to be numbers. Like the other rewrites of
+// the optimizer, it is left out at -O0.
+OpCode Compiler::selectOperator(const OpCode opcode, const bool numbers) const
 {
-    emitByte(static_cast<uint8_t>(OpCode::OP_RETURN));
+    return numbers && optimizationLevel > 0 ? numberForm(opcode) : opcode;
 }
 
 void Compiler::parsePrecedence(Precedence precedence)
@@ -395,26 +836,26 @@ void Compiler::parsePrecedence(Precedence precedence)
     }
 }
 
-void Compiler::defineVariable(const uint8_t global) const
+void Compiler::defineVariable(const int global)
 {
-    emitByte(static_cast<uint8_t>(OpCode::OP_DEFINE_GLOBAL), global);
-}
+    if (current->scopeDepth > 0)
+    {
+        markInitialized();
+        return;
+    }
 
-void Compiler::defineConstant(const uint8_t global) const
-{
-    emitByte(static_cast<uint8_t>(OpCode::OP_DEFINE_CONSTANT), global);
+    emitIndexed(OpCode::OP_DEFINE_GLOBAL, OpCode::OP_DEFINE_GLOBAL_LONG, global);
 }
 
-uint8_t Compiler::parseVariable(const std::string &errorMessage)
+void Compiler::defineConstant(const int global)
 {
-    consume(TokenType::IDENTIFIER, errorMessage);
-    return identifierConstant(parser.previous);
-}
+    if (current->scopeDepth > 0)
+    {
+        markInitialized();
+        return;
+    }
 
-uint8_t Compiler::identifierConstant(const Token &token)
-{
-    const auto content = std::string{token.lexeme};
-    return makeConstant(content);
+    emitIndexed(OpCode::OP_DEFINE_CONSTANT, OpCode::OP_DEFINE_CONSTANT_LONG, global);
 }
 
 ParseRule Compiler::getRule(const TokenType type) const
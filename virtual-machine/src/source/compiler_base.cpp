@@ -0,0 +1,305 @@
+#include "../include/compiler_base.h"
+
+#include <format>
+#include <iostream>
+
+Chunk *CompilerBase::currentChunk() const
+{
+    return &current->function->chunk;
+}
+
+// Slot 0 of every frame holds the closure being called, so it is reserved with a name no identifier can match.
+void CompilerBase::beginFunction(FunctionScope &scope, const FunctionType type)
+{
+    scope.enclosing = current;
+    scope.function = heap.newFunction();
+    scope.function->chunk.useArena(&arena);
+    unitFunctions.push_back(scope.function);
+    scope.type = type;
+    scope.locals[scope.localCount++] = Local{Token{}, 0, false, false};
+    current = &scope;
+
+    // Only allocated once the new function is reachable through current.
+    if (type != FunctionType::SCRIPT)
+    {
+        scope.function->name = heap.copyString(parser.previous.lexeme);
+    }
+}
+
+void CompilerBase::leaveFunction()
+{
+    heap.rescanObject(current->function);
+    current = current->enclosing;
+}
+
+void CompilerBase::finishCompilation()
+{
+    auto chunks = std::vector<Chunk *>{};
+    chunks.reserve(unitFunctions.size());
+    for (const auto function: unitFunctions)
+    {
+        chunks.push_back(&function->chunk);
+    }
+
+    Chunk::pack(chunks);
+    unitFunctions.clear();
+    arena.release();
+}
+
+void CompilerBase::markRoots(Heap &heap)
+{
+    for (auto scope = current; scope != nullptr; scope = scope->enclosing)
+    {
+        heap.rescanObject(scope->function);
+    }
+
+    for (const auto function: unitFunctions)
+    {
+        heap.markObject(function);
+    }
+}
+
+void CompilerBase::advance()
+{
+    parser.previous = parser.current;
+    for (;;)
+    {
+        parser.current = scanner.scanToken();
+        if (parser.current.type != TokenType::ERROR)
+        {
+            break;
+        }
+
+        errorAtCurrent(parser.current.lexeme);
+    }
+}
+
+void CompilerBase::beginScope()
+{
+    current->scopeDepth++;
+}
+
+void CompilerBase::consume(TokenType type, const std::string_view message)
+{
+    if (parser.current.type == type)
+    {
+        advance();
+        return;
+    }
+
+    errorAtCurrent(message);
+}
+
+bool CompilerBase::match(const TokenType type)
+{
+    if (!check(type))
+    {
+        return false;
+    }
+
+    advance();
+    return true;
+}
+
+bool CompilerBase::check(const TokenType type) const
+{
+    return parser.current.type == type;
+}
+
+void CompilerBase::errorAtCurrent(const std::string_view message)
+{
+    errorAt(parser.current, message);
+}
+
+void CompilerBase::error(const std::string_view message)
+{
+    errorAt(parser.previous, message);
+}
+
+void CompilerBase::errorAt(const Token &token, const std::string_view message)
+{
+    if (parser.panicMode)
+    {
+        return;
+    }
+
+    parser.panicMode = true;
+    std::cerr << "[line " << token.line << "] Error";
+    switch (token.type)
+    {
+        case TokenType::FILE_EOF:
+            std::cerr << " at end";
+            break;
+        case TokenType::ERROR:
+            break;
+        case TokenType::IDENTIFIER:
+            std::cerr << " at token " << token.type << " (" << token.lexeme << ")";
+            break;
+        default:
+            std::cerr << " at token " << token.type;
+            break;
+    }
+
+    std::cerr << " " << message << "\n";
+    parser.hadError = true;
+}
+
+void CompilerBase::synchronize()
+{
+    parser.panicMode = false;
+    while (parser.current.type != TokenType::FILE_EOF)
+    {
+        if (parser.previous.type == TokenType::SEMICOLON)
+        {
+            return;
+        }
+
+        switch (parser.previous.type)
+        {
+            case TokenType::CLASS:
+            case TokenType::FUN:
+            case TokenType::LET:
+            case TokenType::CONST:
+            case TokenType::FOR:
+            case TokenType::IF:
+            case TokenType::WHILE:
+            case TokenType::PRINT:
+            case TokenType::RETURN:
+                return;
+
+            default: break;
+        }
+
+        advance();
+    }
+}
+
+int CompilerBase::parseVariable(const std::string_view errorMessage, const bool constant)
+{
+    consume(TokenType::IDENTIFIER, errorMessage);
+    if (current->scopeDepth > 0)
+    {
+        declareLocal(constant);
+        return 0;
+    }
+
+    return globalSlot(parser.previous);
+}
+
+void CompilerBase::declareLocal(const bool constant)
+{
+    const auto &name = parser.previous;
+    for (auto i = current->localCount - 1; i >= 0; i--)
+    {
+        const auto &local = current->locals[i];
+        if (local.depth != -1 && local.depth < current->scopeDepth)
+        {
+            break;
+        }
+
+        if (local.name.lexeme == name.lexeme)
+        {
+            error(std::format("Cannot redeclare variable {}.", name.lexeme));
+        }
+    }
+
+    addLocal(name, constant);
+}
+
+void CompilerBase::addLocal(const Token &name, const bool constant)
+{
+    if (current->localCount == FunctionScope::MAX_LOCALS)
+    {
+        error("Too many local variables in scope.");
+        return;
+    }
+
+    current->locals[current->localCount++] = Local{name, -1, constant, false};
+    if (namesLocals)
+    {
+        currentChunk()->addLocalName(heap.copyString(name.lexeme), {name.line, name.column}, current->localCount - 1);
+    }
+}
+
+void CompilerBase::markInitialized()
+{
+    if (current->scopeDepth == 0)
+    {
+        return;
+    }
+
+    current->locals[current->localCount - 1].depth = current->scopeDepth;
+}
+
+int CompilerBase::resolveLocal(FunctionScope *scope, const Token &name)
+{
+    for (auto i = scope->localCount - 1; i >= 0; i--)
+    {
+        if (scope->locals[i].name.lexeme == name.lexeme)
+        {
+            if (scope->locals[i].depth == -1)
+            {
+                error(std::format("Variable {} used in its own initializer.", name.lexeme));
+            }
+
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int CompilerBase::resolveUpvalue(FunctionScope *scope, const Token &name)
+{
+    if (scope->enclosing == nullptr)
+    {
+        return -1;
+    }
+
+    if (const auto local = resolveLocal(scope->enclosing, name); local != -1)
+    {
+        auto &captured = scope->enclosing->locals[local];
+        captured.captured = true;
+        return addUpvalue(scope, local, true, captured.constant);
+    }
+
+    if (const auto upvalue = resolveUpvalue(scope->enclosing, name); upvalue != -1)
+    {
+        return addUpvalue(scope, upvalue, false, scope->enclosing->function->upvalues[upvalue].constant);
+    }
+
+    return -1;
+}
+
+int CompilerBase::addUpvalue(FunctionScope *scope, const int index, const bool isLocal, const bool constant)
+{
+    auto &upvalues = scope->function->upvalues;
+    for (auto i = 0; i < static_cast<int>(upvalues.size()); i++)
+    {
+        if (upvalues[i].index == index && upvalues[i].isLocal == isLocal)
+        {
+            return i;
+        }
+    }
+
+    if (upvalues.size() == UINT8_MAX + 1)
+    {
+        error("Too many closure variables in function.");
+        return 0;
+    }
+
+    upvalues.push_back(UpvalueDescriptor{static_cast<uint8_t>(index), isLocal, constant});
+    return static_cast<int>(upvalues.size()) - 1;
+}
+
+int CompilerBase::globalSlot(const Token &token)
+{
+    const auto slot = globals.resolve(heap.copyString(token.lexeme));
+    if (slot > MAX_LONG_OPERAND)
+    {
+        error("Too many global variables.");
+        return 0;
+    }
+
+    return slot;
+}
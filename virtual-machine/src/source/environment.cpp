@@ -1,48 +1,66 @@
 #include "../include/environment.h"
 
-EnvironmentDeclareResult Environment::declare(const std::string &name, const Value &value, bool constant)
+#include "../include/heap.h"
+
+int Environment::resolve(ObjString *name)
 {
-    if (bindings.contains(name))
+    if (const auto existing = indices.find(name); existing != nullptr)
     {
-        return EnvironmentDeclareResult::ALREADY_DEFINED;
+        return *existing;
     }
 
-    bindings.emplace(name, value);
-    if (constant)
-    {
-        constants.insert(name);
-    }
-    return EnvironmentDeclareResult::OK;
+    const auto index = static_cast<int>(slots.size());
+    slots.push_back(GlobalSlot{Value::null(), name, ValueType::NIL, false, false, false});
+    indices.set(name, index);
+    markDirty(index);
+    return index;
 }
 
-EnvironmentSetResult Environment::set(const std::string &name, const Value &value)
+EnvironmentDeclareResult Environment::declare(const int index, const Value value, const bool constant)
 {
-    const auto iterator = bindings.find(name);
-    if (iterator == bindings.end())
-    {
-        return EnvironmentSetResult::NOT_DEFINED;
-    }
-
-    if (constants.contains(name))
+    auto &slot = slots[index];
+    if (slot.defined)
     {
-        return EnvironmentSetResult::CONSTANT_NOT_REASSIGNABLE;
+        return EnvironmentDeclareResult::ALREADY_DEFINED;
     }
 
-    if (iterator->second.index() != value.index())
+    slot.value = value;
+    slot.type = typeOf(value);
+    slot.defined = true;
+    slot.constant = constant;
+    if (value.isObject())
     {
-        return EnvironmentSetResult::TYPE_MISMATCH;
+        markDirty(index);
     }
 
-    iterator->second = value;
-    return EnvironmentSetResult::OK;
+    return EnvironmentDeclareResult::OK;
 }
 
-std::optional<Value> Environment::get(const std::string &name) const
+// Names are marked even for globals that are only declared, since compiled code already refers to their slots.
+// Every collection that scans the roots leaves the nursery empty, so the dirty list can be cleared after any scan.
+void Environment::markRoots(Heap &heap)
 {
-    if (!bindings.contains(name))
+    if (heap.isMinorCollection())
+    {
+        for (const auto index: dirtySlots)
+        {
+            heap.markObject(slots[index].name);
+            heap.markValue(slots[index].value);
+        }
+    }
+    else
+    {
+        for (const auto &slot: slots)
+        {
+            heap.markObject(slot.name);
+            heap.markValue(slot.value);
+        }
+    }
+
+    for (const auto index: dirtySlots)
     {
-        return std::nullopt;
+        slots[index].dirty = false;
     }
 
-    return std::make_optional(bindings.at(name));
+    dirtySlots.clear();
 }
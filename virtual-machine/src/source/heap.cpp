@@ -0,0 +1,606 @@
+#include "../include/heap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#include "../include/memory.h"
+
+namespace
+{
+    uint64_t elapsedSince(const std::chrono::steady_clock::time_point start)
+    {
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+}
+
+Heap::~Heap()
+{
+    freeObjects();
+}
+
+void Heap::collectIfDue()
+{
+    if (stressMode || bytesAllocated > nurseryStart + NURSERY_SIZE)
+    {
+        collectNursery();
+    }
+}
+
+template<typename T>
+T *Heap::allocateObject(const ObjType type)
+{
+    collectIfDue();
+    return placeObject<T>(type);
+}
+
+// Allocates without letting a collection run first, for an object whose parts were allocated just before it and
+// are not reachable from anything else yet.
+template<typename T>
+T *Heap::placeObject(const ObjType type)
+{
+    auto object = new(reallocate<uint8_t>(nullptr, 0, sizeof(T))) T{};
+    object->type = type;
+    object->next = nursery;
+    nursery = object;
+    return object;
+}
+
+ObjString *Heap::allocateString(char *chars, const int length, const uint32_t hash)
+{
+    const auto string = allocateObject<ObjString>(ObjType::STRING);
+    string->length = length;
+    string->hash = hash;
+    string->chars = chars;
+    string->interned = true;
+    strings.set(string, {});
+    return string;
+}
+
+ObjString *Heap::copyString(const std::string_view &chars)
+{
+    const auto hash = hashString(chars);
+    if (const auto interned = strings.findString(chars, hash); interned != nullptr)
+    {
+        return interned;
+    }
+
+    const auto length = static_cast<int>(chars.length());
+    const auto heapChars = growArray<char>(nullptr, 0, length + 1);
+    std::memcpy(heapChars, chars.data(), length);
+    heapChars[length] = '\0';
+    return allocateString(heapChars, length, hash);
+}
+
+ObjString *Heap::takeString(char *chars, const int length)
+{
+    const auto view = std::string_view{chars, static_cast<size_t>(length)};
+    const auto hash = hashString(view);
+    if (const auto interned = strings.findString(view, hash); interned != nullptr)
+    {
+        freeArray(chars, length + 1);
+        return interned;
+    }
+
+    return allocateString(chars, length, hash);
+}
+
+// Short results are copied and interned as before. Longer ones become ropes, so that building a string piece by
+// piece does not copy everything built so far each time; appending a short string to a rope that ends in a short
+// leaf copies the two into a new leaf instead, which keeps one node per ROPE_LEAF_SIZE characters rather than one
+// per piece.
+ObjString *Heap::concatenate(ObjString *a, ObjString *b)
+{
+    const auto length = a->length + b->length;
+    if (length < MIN_ROPE_LENGTH)
+    {
+        const auto chars = growArray<char>(nullptr, 0, length + 1);
+        std::memcpy(chars, a->view().data(), a->length);
+        std::memcpy(chars + a->length, b->view().data(), b->length);
+        chars[length] = '\0';
+        return takeString(chars, length);
+    }
+
+    if (a->isRope() && !a->right->isRope() && !b->isRope() && a->right->length + b->length <= ROPE_LEAF_SIZE)
+    {
+        const auto leaf = newLeaf(a->right, b);
+        return newRope(a->left, leaf);
+    }
+
+    collectIfDue();
+    return newRope(a, b);
+}
+
+ObjString *Heap::newLeaf(ObjString *a, ObjString *b)
+{
+    const auto length = a->length + b->length;
+    const auto chars = growArray<char>(nullptr, 0, length + 1);
+    std::memcpy(chars, a->chars, a->length);
+    std::memcpy(chars + a->length, b->chars, b->length);
+    chars[length] = '\0';
+
+    const auto leaf = allocateObject<ObjString>(ObjType::STRING);
+    leaf->length = length;
+    leaf->hash = 0;
+    leaf->chars = chars;
+    return leaf;
+}
+
+ObjString *Heap::newRope(ObjString *left, ObjString *right)
+{
+    const auto rope = placeObject<ObjString>(ObjType::STRING);
+    rope->length = left->length + right->length;
+    rope->hash = 0;
+    rope->chars = nullptr;
+    rope->left = left;
+    rope->right = right;
+    return rope;
+}
+
+ObjFunction *Heap::newFunction()
+{
+    return allocateObject<ObjFunction>(ObjType::FUNCTION);
+}
+
+ObjClosure *Heap::newClosure(ObjFunction *function)
+{
+    const auto upvalueCount = static_cast<int>(function->upvalues.size());
+    const auto upvalues = growArray<ObjUpvalue *>(nullptr, 0, upvalueCount);
+    std::fill_n(upvalues, upvalueCount, nullptr);
+
+    const auto closure = allocateObject<ObjClosure>(ObjType::CLOSURE);
+    closure->function = function;
+    closure->upvalues = upvalues;
+    closure->upvalueCount = upvalueCount;
+    return closure;
+}
+
+ObjUpvalue *Heap::newUpvalue(Value *slot)
+{
+    const auto upvalue = allocateObject<ObjUpvalue>(ObjType::UPVALUE);
+    upvalue->location = slot;
+    upvalue->closed = Value::null();
+    upvalue->nextOpen = nullptr;
+    return upvalue;
+}
+
+ObjArray *Heap::newArray(const int count)
+{
+    const auto values = growArray<Value>(nullptr, 0, count);
+    std::fill_n(values, count, Value::null());
+
+    const auto array = allocateObject<ObjArray>(ObjType::ARRAY);
+    array->values = values;
+    array->count = count;
+    return array;
+}
+
+ObjList *Heap::newList(const int capacity)
+{
+    const auto values = growArray<Value>(nullptr, 0, capacity);
+
+    const auto list = allocateObject<ObjList>(ObjType::LIST);
+    list->values = values;
+    list->count = 0;
+    list->capacity = capacity;
+    return list;
+}
+
+ObjSet *Heap::newSet()
+{
+    return allocateObject<ObjSet>(ObjType::SET);
+}
+
+ObjNative *Heap::newNative(const NativeFn function, ObjString *name, const int arity)
+{
+    const auto native = allocateObject<ObjNative>(ObjType::NATIVE);
+    native->function = function;
+    native->name = name;
+    native->arity = arity;
+    return native;
+}
+
+ObjBoundNative *Heap::newBoundNative(const Value receiver, ObjNative *method)
+{
+    const auto bound = allocateObject<ObjBoundNative>(ObjType::BOUND_NATIVE);
+    bound->receiver = receiver;
+    bound->method = method;
+    return bound;
+}
+
+void Heap::freeObject(Obj *object)
+{
+    switch (object->type)
+    {
+        case ObjType::STRING:
+        {
+            const auto string = static_cast<ObjString *>(object);
+            if (!string->isRope())
+            {
+                freeArray(string->chars, string->length + 1);
+            }
+
+            reallocate(string, sizeof(ObjString), 0);
+            break;
+        }
+        case ObjType::FUNCTION:
+            destroyObject(static_cast<ObjFunction *>(object));
+            break;
+        case ObjType::CLOSURE:
+        {
+            const auto closure = static_cast<ObjClosure *>(object);
+            freeArray(closure->upvalues, closure->upvalueCount);
+            reallocate(closure, sizeof(ObjClosure), 0);
+            break;
+        }
+        case ObjType::UPVALUE:
+            reallocate(object, sizeof(ObjUpvalue), 0);
+            break;
+        case ObjType::ARRAY:
+        {
+            const auto array = static_cast<ObjArray *>(object);
+            freeArray(array->values, array->count);
+            reallocate(array, sizeof(ObjArray), 0);
+            break;
+        }
+        case ObjType::LIST:
+        {
+            const auto list = static_cast<ObjList *>(object);
+            freeArray(list->values, list->capacity);
+            reallocate(list, sizeof(ObjList), 0);
+            break;
+        }
+        case ObjType::SET:
+        {
+            const auto set = static_cast<ObjSet *>(object);
+            set->clear();
+            reallocate(set, sizeof(ObjSet), 0);
+            break;
+        }
+        case ObjType::NATIVE:
+            reallocate(object, sizeof(ObjNative), 0);
+            break;
+        case ObjType::BOUND_NATIVE:
+            reallocate(object, sizeof(ObjBoundNative), 0);
+            break;
+    }
+}
+
+void Heap::freeList(Obj *object)
+{
+    while (object != nullptr)
+    {
+        const auto next = object->next;
+        freeObject(object);
+        object = next;
+    }
+}
+
+void Heap::freeObjects()
+{
+    freeList(nursery);
+    freeList(oldObjects);
+    nursery = nullptr;
+    oldObjects = nullptr;
+    strings.clear();
+    grayYoung.clear();
+    grayOld.clear();
+    remembered.clear();
+    marking = false;
+}
+
+void Heap::addRoots(RootSet *roots)
+{
+    rootSets.push_back(roots);
+}
+
+void Heap::removeRoots(RootSet *roots)
+{
+    std::erase(rootSets, roots);
+}
+
+void Heap::markValue(const Value value)
+{
+    if (value.isObject())
+    {
+        markObject(value.asObject());
+    }
+}
+
+// Old objects are only marked during a marking cycle, and nursery objects only by a pause that collects the nursery.
+void Heap::markObject(Obj *object)
+{
+    if (object == nullptr || object->marked)
+    {
+        return;
+    }
+
+    if (object->old ? !marking : !tracingNursery)
+    {
+        return;
+    }
+
+    object->marked = true;
+    (object->old ? grayOld : grayYoung).push_back(object);
+}
+
+void Heap::rescanObject(Obj *object)
+{
+    if (object == nullptr)
+    {
+        return;
+    }
+
+    if (!object->old)
+    {
+        markObject(object);
+    }
+    else if (!object->remembered)
+    {
+        object->remembered = true;
+        remembered.push_back(object);
+    }
+}
+
+void Heap::collectGarbage()
+{
+    const auto start = std::chrono::steady_clock::now();
+    if (!marking)
+    {
+        beginMarking();
+    }
+
+    finishMarking();
+    stats.full.record(elapsedSince(start));
+}
+
+void Heap::enableStressMode()
+{
+    stressMode = true;
+}
+
+// A minor pause: survivors of the nursery are promoted, and the old generation's marking advances by one step or
+// starts, once the heap has grown enough. The remark pause that ends a cycle is counted on its own.
+void Heap::collectNursery()
+{
+    const auto start = std::chrono::steady_clock::now();
+    tracingNursery = true;
+    minorCollection = true;
+    markRootSets();
+    traceRemembered();
+    while (!grayYoung.empty())
+    {
+        const auto object = grayYoung.back();
+        grayYoung.pop_back();
+        blacken(object);
+    }
+
+    sweepNursery();
+    minorCollection = false;
+    tracingNursery = false;
+
+    if (!marking && (stressMode || bytesAllocated > nextMarking))
+    {
+        beginMarking();
+    }
+    else if (marking)
+    {
+        traceGray(stressMode ? STRESS_MARK_STEP : MARK_STEP);
+        if (grayOld.empty() || bytesAllocated > nextMarking * GROWTH_FACTOR)
+        {
+            finishMarking();
+            stats.remark.record(elapsedSince(start));
+            return;
+        }
+    }
+
+    stats.minor.record(elapsedSince(start));
+}
+
+// Only runs with an empty nursery, or right before finishMarking, so the roots found here are all old.
+void Heap::beginMarking()
+{
+    marking = true;
+    markRootSets();
+}
+
+void Heap::finishMarking()
+{
+    tracingNursery = true;
+    markRootSets();
+    traceRemembered();
+    while (!grayYoung.empty() || !grayOld.empty())
+    {
+        while (!grayYoung.empty())
+        {
+            const auto object = grayYoung.back();
+            grayYoung.pop_back();
+            blacken(object);
+        }
+
+        traceGray(SIZE_MAX);
+    }
+
+    sweepOldObjects();
+    marking = false;
+    sweepNursery();
+    tracingNursery = false;
+    nextMarking = std::max(bytesAllocated * GROWTH_FACTOR, FIRST_MARKING);
+}
+
+void Heap::markRootSets()
+{
+    for (const auto roots: rootSets)
+    {
+        roots->markRoots(*this);
+    }
+}
+
+// A remembered object may have lost every reference to it since it was written. Treating it as reachable anyway
+// only delays freeing it to the next cycle.
+void Heap::traceRemembered()
+{
+    for (const auto object: remembered)
+    {
+        object->remembered = false;
+        object->marked = object->marked || marking;
+        blacken(object);
+    }
+
+    remembered.clear();
+}
+
+void Heap::traceGray(size_t budget)
+{
+    while (budget > 0 && !grayOld.empty())
+    {
+        const auto object = grayOld.back();
+        grayOld.pop_back();
+        blacken(object);
+        budget--;
+    }
+}
+
+void Heap::blacken(Obj *object)
+{
+    switch (object->type)
+    {
+        case ObjType::STRING:
+        {
+            const auto string = static_cast<ObjString *>(object);
+            markObject(string->left);
+            markObject(string->right);
+            break;
+        }
+        case ObjType::FUNCTION:
+        {
+            const auto function = static_cast<ObjFunction *>(object);
+            markObject(function->name);
+            for (auto i = 0; i < function->chunk.constants.count; i++)
+            {
+                markValue(function->chunk.constants.values[i]);
+            }
+
+            for (auto i = 0; i < function->chunk.localNameCount; i++)
+            {
+                markObject(function->chunk.localNames[i].name);
+            }
+
+            break;
+        }
+        case ObjType::CLOSURE:
+        {
+            // Upvalues are still null while a new closure is capturing them.
+            const auto closure = static_cast<ObjClosure *>(object);
+            markObject(closure->function);
+            for (auto i = 0; i < closure->upvalueCount; i++)
+            {
+                markObject(closure->upvalues[i]);
+            }
+
+            break;
+        }
+        case ObjType::UPVALUE:
+            markValue(static_cast<ObjUpvalue *>(object)->closed);
+            break;
+        case ObjType::ARRAY:
+        case ObjType::LIST:
+        {
+            const auto sequence = static_cast<ObjArray *>(object);
+            for (auto i = 0; i < sequence->count; i++)
+            {
+                markValue(sequence->values[i]);
+            }
+
+            break;
+        }
+        case ObjType::SET:
+        {
+            const auto set = static_cast<ObjSet *>(object);
+            for (auto i = 0; i < set->count; i++)
+            {
+                markValue(set->values[i]);
+            }
+
+            break;
+        }
+        case ObjType::NATIVE:
+            markObject(static_cast<ObjNative *>(object)->name);
+            break;
+        case ObjType::BOUND_NATIVE:
+        {
+            const auto bound = static_cast<ObjBoundNative *>(object);
+            markValue(bound->receiver);
+            markObject(bound->method);
+            break;
+        }
+    }
+}
+
+// Survivors were traced by this pause, so while a marking cycle runs they join the old generation already marked.
+void Heap::sweepNursery()
+{
+    auto object = nursery;
+    while (object != nullptr)
+    {
+        const auto next = object->next;
+        if (object->marked)
+        {
+            object->old = true;
+            object->marked = marking;
+            object->next = oldObjects;
+            oldObjects = object;
+            stats.promotedObjects++;
+        }
+        else
+        {
+            release(object);
+        }
+
+        object = next;
+    }
+
+    nursery = nullptr;
+    nurseryStart = bytesAllocated;
+}
+
+void Heap::sweepOldObjects()
+{
+    Obj *previous = nullptr;
+    auto object = oldObjects;
+    while (object != nullptr)
+    {
+        if (object->marked)
+        {
+            object->marked = false;
+            previous = object;
+            object = object->next;
+            continue;
+        }
+
+        const auto unreached = object;
+        object = object->next;
+        if (previous == nullptr)
+        {
+            oldObjects = object;
+        }
+        else
+        {
+            previous->next = object;
+        }
+
+        release(unreached);
+    }
+}
+
+void Heap::release(Obj *object)
+{
+    if (object->type == ObjType::STRING && static_cast<ObjString *>(object)->interned)
+    {
+        strings.erase(static_cast<ObjString *>(object));
+    }
+
+    freeObject(object);
+}
@@ -0,0 +1,1178 @@
+#include "../include/ir_compiler.h"
+
+#include <format>
+
+#include "../include/ir_optimizer.h"
+#include "../include/token.h"
+
+ObjFunction *IrCompiler::compile(const std::string &source)
+{
+    scanner = Scanner{source};
+    parser.panicMode = false;
+    parser.hadError = false;
+    pool.clear();
+
+    auto script = FunctionScope{};
+    auto scriptState = FunctionState{};
+    current = nullptr;
+    state = nullptr;
+    beginIrFunction(script, scriptState, FunctionType::SCRIPT);
+    advance();
+    const auto body = node(IrKind::BLOCK);
+    while (!match(TokenType::FILE_EOF))
+    {
+        body->children.push_back(declaration());
+    }
+
+    body->location = {parser.previous.line, parser.previous.column};
+    scriptState.ir->body = body;
+    const auto program = endIrFunction();
+    if (parser.hadError)
+    {
+        pool.clear();
+        finishCompilation();
+        return nullptr;
+    }
+
+    if (optimizationLevel > 0)
+    {
+        IrOptimizer{heap, pool}.run(program);
+    }
+
+    lowerFunction(program);
+    const auto function = program->function;
+    pool.clear();
+    finishCompilation();
+    return parser.hadError ? nullptr : function;
+}
+
+void IrCompiler::setOptimizationLevel(const int level)
+{
+    optimizationLevel = level;
+}
+
+// Only the functions being lowered are written to; the others are kept alive as functions of the compilation unit.
+void IrCompiler::markRoots(Heap &heap)
+{
+    CompilerBase::markRoots(heap);
+    pool.markRoots(heap);
+    for (auto function = lowering; function != nullptr; function = function->enclosing)
+    {
+        heap.rescanObject(function->ir->function);
+    }
+}
+
+void IrCompiler::beginIrFunction(FunctionScope &scope, FunctionState &functionState, const FunctionType type)
+{
+    beginFunction(scope, type);
+    functionState.enclosing = state;
+    functionState.ir = pool.function(scope.function);
+    functionState.ir->variables.push_back(IrVariable{{}, {}, false, false});
+    functionState.localVariables[0] = 0;
+    state = &functionState;
+}
+
+// Upvalues that capture a local of the enclosing function are recorded by variable, since the slot they name now
+// may not be the slot the variable ends up in.
+IrFunction *IrCompiler::endIrFunction()
+{
+    for (auto i = 1; i < current->localCount; i++)
+    {
+        retireLocal(i);
+    }
+
+    const auto ir = state->ir;
+    for (const auto &upvalue: ir->function->upvalues)
+    {
+        ir->upvalueVariables.push_back(upvalue.isLocal ? state->enclosing->localVariables[upvalue.index] : -1);
+    }
+
+    leaveFunction();
+    state = state->enclosing;
+    return ir;
+}
+
+IrNode *IrCompiler::node(const IrKind kind)
+{
+    return pool.node(kind, {parser.previous.line, parser.previous.column});
+}
+
+void IrCompiler::declareVariable(const int localCountBefore, const bool constant)
+{
+    if (current->localCount == localCountBefore)
+    {
+        return;
+    }
+
+    auto &variables = state->ir->variables;
+    state->localVariables[current->localCount - 1] = static_cast<int>(variables.size());
+    const auto &name = current->locals[current->localCount - 1].name;
+    variables.push_back(IrVariable{name.lexeme, {name.line, name.column}, constant, false});
+}
+
+// Once a local goes out of scope every closure that can capture it has been compiled.
+void IrCompiler::retireLocal(const int slot) const
+{
+    state->ir->variables[state->localVariables[slot]].captured = current->locals[slot].captured;
+}
+
+IrNode *IrCompiler::declaration()
+{
+    IrNode *result;
+    if (match(TokenType::FUN))
+    {
+        result = functionDeclaration();
+    }
+    else if (match(TokenType::LET))
+    {
+        result = variableDeclaration();
+    }
+    else if (match(TokenType::CONST))
+    {
+        result = constantDeclaration();
+    }
+    else
+    {
+        result = statement();
+    }
+
+    if (parser.panicMode)
+    {
+        synchronize();
+    }
+
+    return result;
+}
+
+IrNode *IrCompiler::functionDeclaration()
+{
+    const auto localCount = current->localCount;
+    const auto global = parseVariable("Expect function name.");
+    declareVariable(localCount, false);
+    if (current->scopeDepth > 0)
+    {
+        // A local function may refer to itself, so it is usable before its body is compiled.
+        markInitialized();
+    }
+
+    return defineVariable(global, function(FunctionType::FUNCTION), false);
+}
+
+IrNode *IrCompiler::function(const FunctionType type)
+{
+    auto scope = FunctionScope{};
+    auto functionState = FunctionState{};
+    beginIrFunction(scope, functionState, type);
+    beginScope();
+
+    consume(TokenType::LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(TokenType::RIGHT_PAREN))
+    {
+        do
+        {
+            if (++current->function->arity > UINT8_MAX)
+            {
+                errorAtCurrent("Cannot have more than 255 parameters.");
+            }
+
+            const auto localCount = current->localCount;
+            parseVariable("Expect parameter name.");
+            declareVariable(localCount, false);
+            markInitialized();
+        } while (match(TokenType::COMMA));
+    }
+
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(TokenType::LEFT_BRACE, "Expect '{' before function body.");
+    functionState.ir->body = block(node(IrKind::BLOCK));
+
+    const auto closure = node(IrKind::CLOSURE);
+    closure->function = endIrFunction();
+    return closure;
+}
+
+IrNode *IrCompiler::statement()
+{
+    if (match(TokenType::PRINT))
+    {
+        return printStatement();
+    }
+
+    if (match(TokenType::IF))
+    {
+        return ifStatement();
+    }
+
+    if (match(TokenType::WHILE))
+    {
+        return whileStatement();
+    }
+
+    if (match(TokenType::DO))
+    {
+        return doWhileStatement();
+    }
+
+    if (match(TokenType::FOR))
+    {
+        return forStatement();
+    }
+
+    if (match(TokenType::BREAK))
+    {
+        return breakStatement();
+    }
+
+    if (match(TokenType::CONTINUE))
+    {
+        return continueStatement();
+    }
+
+    if (match(TokenType::RETURN))
+    {
+        return returnStatement();
+    }
+
+    if (match(TokenType::LEFT_BRACE))
+    {
+        return scopedBlock();
+    }
+
+    return expressionStatement();
+}
+
+IrNode *IrCompiler::variableDeclaration()
+{
+    const auto localCount = current->localCount;
+    const auto global = parseVariable("Expect variable name.");
+    declareVariable(localCount, false);
+    const auto value = match(TokenType::EQUAL) ? expression() : constantNode(Value::null());
+    consume(TokenType::SEMICOLON, "Expect ';' after variable declaration");
+    return defineVariable(global, value, false);
+}
+
+IrNode *IrCompiler::constantDeclaration()
+{
+    const auto localCount = current->localCount;
+    const auto global = parseVariable("Expect variable name.", true);
+    declareVariable(localCount, true);
+    consume(TokenType::EQUAL, "Expected '=' after constant");
+    const auto value = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after constant declaration");
+    return defineVariable(global, value, true);
+}
+
+IrNode *IrCompiler::defineVariable(const int global, IrNode *value, const bool constant)
+{
+    if (current->scopeDepth > 0)
+    {
+        markInitialized();
+        const auto declaration = node(IrKind::DECLARE_LOCAL);
+        declaration->index = state->localVariables[current->localCount - 1];
+        declaration->operand = value;
+        return declaration;
+    }
+
+    const auto definition = node(IrKind::DEFINE_GLOBAL);
+    definition->index = global;
+    definition->operand = value;
+    definition->constant = constant;
+    return definition;
+}
+
+IrNode *IrCompiler::printStatement()
+{
+    const auto value = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after value.");
+    const auto print = node(IrKind::PRINT);
+    print->operand = value;
+    return print;
+}
+
+IrNode *IrCompiler::ifStatement()
+{
+    consume(TokenType::LEFT_PAREN, "Expect '(' after if.");
+    const auto condition = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after if's condition.");
+
+    const auto branch = node(IrKind::IF);
+    branch->operand = condition;
+    branch->body = statement();
+    if (match(TokenType::ELSE))
+    {
+        branch->alternative = statement();
+    }
+
+    return branch;
+}
+
+IrNode *IrCompiler::whileStatement()
+{
+    consume(TokenType::LEFT_PAREN, "Expect '(' after while.");
+    const auto condition = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after while's condition.");
+
+    const auto loop = node(IrKind::LOOP);
+    loop->form = IrLoopForm::WHILE;
+    loop->operand = condition;
+    loop->body = loopBody();
+    return loop;
+}
+
+IrNode *IrCompiler::doWhileStatement()
+{
+    const auto body = loopBody();
+    consume(TokenType::WHILE, "Expect 'while' after do while's statements block.");
+    consume(TokenType::LEFT_PAREN, "Expect '(' after while.");
+    const auto condition = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after while's condition.");
+    consume(TokenType::SEMICOLON, "Expect ';' after do while.");
+
+    const auto loop = node(IrKind::LOOP);
+    loop->form = IrLoopForm::DO_WHILE;
+    loop->operand = condition;
+    loop->body = body;
+    return loop;
+}
+
+// The initializer's scope becomes a block around the loop.
+IrNode *IrCompiler::forStatement()
+{
+    beginScope();
+    const auto scope = node(IrKind::BLOCK);
+    consume(TokenType::LEFT_PAREN, "Expect '(' after for.");
+    if (match(TokenType::LET))
+    {
+        scope->children.push_back(variableDeclaration());
+    }
+    else if (!match(TokenType::SEMICOLON))
+    {
+        scope->children.push_back(expressionStatement());
+    }
+
+    const auto loop = node(IrKind::LOOP);
+    loop->form = IrLoopForm::FOR;
+    if (!match(TokenType::SEMICOLON))
+    {
+        loop->operand = expression();
+        consume(TokenType::SEMICOLON, "Expect ';' after loop's condition.");
+    }
+
+    if (!match(TokenType::RIGHT_PAREN))
+    {
+        loop->increment = expression();
+        consume(TokenType::RIGHT_PAREN, "Expect ')' after for clauses.");
+    }
+
+    loop->body = loopBody();
+    scope->children.push_back(loop);
+    endScope();
+    scope->location = {parser.previous.line, parser.previous.column};
+    return scope;
+}
+
+IrNode *IrCompiler::loopBody()
+{
+    state->loopDepth++;
+    const auto body = statement();
+    state->loopDepth--;
+    return body;
+}
+
+IrNode *IrCompiler::breakStatement()
+{
+    consume(TokenType::SEMICOLON, "Expect ';' after break.");
+    if (state->loopDepth == 0)
+    {
+        error("Cannot use 'break' outside of a loop.");
+    }
+
+    return node(IrKind::BREAK);
+}
+
+IrNode *IrCompiler::continueStatement()
+{
+    consume(TokenType::SEMICOLON, "Expect ';' after continue.");
+    if (state->loopDepth == 0)
+    {
+        error("Cannot use 'continue' outside of a loop.");
+    }
+
+    return node(IrKind::CONTINUE);
+}
+
+IrNode *IrCompiler::returnStatement()
+{
+    if (current->type == FunctionType::SCRIPT)
+    {
+        error("Cannot return from top-level code.");
+    }
+
+    const auto value = match(TokenType::SEMICOLON) ? constantNode(Value::null()) : nullptr;
+    const auto result = node(IrKind::RETURN);
+    if (value != nullptr)
+    {
+        result->operand = value;
+        return result;
+    }
+
+    result->operand = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after return value.");
+    result->location = {parser.previous.line, parser.previous.column};
+    return result;
+}
+
+IrNode *IrCompiler::block(IrNode *statements)
+{
+    while (!check(TokenType::RIGHT_BRACE) && !check(TokenType::FILE_EOF))
+    {
+        statements->children.push_back(declaration());
+    }
+
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
+    statements->location = {parser.previous.line, parser.previous.column};
+    return statements;
+}
+
+IrNode *IrCompiler::scopedBlock()
+{
+    beginScope();
+    const auto statements = block(node(IrKind::BLOCK));
+    endScope();
+    return statements;
+}
+
+void IrCompiler::endScope()
+{
+    current->scopeDepth--;
+    while (current->localCount > 0 && current->locals[current->localCount - 1].depth > current->scopeDepth)
+    {
+        retireLocal(current->localCount - 1);
+        current->localCount--;
+    }
+}
+
+IrNode *IrCompiler::expressionStatement()
+{
+    const auto value = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after expression.");
+    const auto statement = node(IrKind::EXPRESSION);
+    statement->operand = value;
+    return statement;
+}
+
+IrNode *IrCompiler::expression()
+{
+    return parsePrecedence(Precedence::Assignment);
+}
+
+IrNode *IrCompiler::parsePrecedence(const Precedence precedence)
+{
+    advance();
+    const auto prefixRule = getRule(parser.previous.type).prefix;
+    if (prefixRule == nullptr)
+    {
+        error("Expected expression.");
+        return constantNode(Value::null());
+    }
+
+    const auto canAssign = precedence <= Precedence::Assignment;
+    auto result = (this->*prefixRule)(canAssign, nullptr);
+    while (precedence <= getRule(parser.current.type).precedence)
+    {
+        advance();
+        const auto infixRule = getRule(parser.previous.type).infix;
+        result = (this->*infixRule)(canAssign, result);
+    }
+
+    if (canAssign && match(TokenType::EQUAL))
+    {
+        error("Invalid assignment target.");
+    }
+
+    return result;
+}
+
+IrNode *IrCompiler::number([[maybe_unused]] bool canAssign, [[maybe_unused]] IrNode *left)
+{
+    return constantNode(Value::number(std::strtod({parser.previous.lexeme.data()}, nullptr)));
+}
+
+IrNode *IrCompiler::grouping([[maybe_unused]] bool canAssign, [[maybe_unused]] IrNode *left)
+{
+    const auto inner = expression();
+    consume(TokenType::RIGHT_PAREN, "Expected ')' after expression.");
+    return inner;
+}
+
+IrNode *IrCompiler::unary([[maybe_unused]] bool canAssign, [[maybe_unused]] IrNode *left)
+{
+    const auto operatorType = parser.previous.type;
+    const auto operand = parsePrecedence(Precedence::Unary);
+    const auto result = node(IrKind::UNARY);
+    result->opcode = operatorType == TokenType::BANG ? OpCode::OP_NOT : OpCode::OP_NEGATE;
+    result->operand = operand;
+    return result;
+}
+
+IrNode *IrCompiler::binary([[maybe_unused]] bool canAssign, IrNode *left)
+{
+    const auto operatorType = parser.previous.type;
+    const auto rule = getRule(operatorType);
+    const auto right = parsePrecedence(static_cast<Precedence>(static_cast<int>(rule.precedence) + 1));
+
+    const auto result = node(IrKind::BINARY);
+    result->left = left;
+    result->right = right;
+    switch (operatorType)
+    {
+        case TokenType::PLUS: result->opcode = OpCode::OP_ADD;
+            break;
+        case TokenType::MINUS: result->opcode = OpCode::OP_SUBTRACT;
+            break;
+        case TokenType::STAR: result->opcode = OpCode::OP_MULTIPLY;
+            break;
+        case TokenType::SLASH: result->opcode = OpCode::OP_DIVIDE;
+            break;
+        case TokenType::MODULO: result->opcode = OpCode::OP_MODULO;
+            break;
+        case TokenType::EXPONENT: result->opcode = OpCode::OP_EXPONENT;
+            break;
+        case TokenType::BANG_EQUAL: result->opcode = OpCode::OP_NOT_EQUAL;
+            break;
+        case TokenType::EQUAL_EQUAL: result->opcode = OpCode::OP_EQUAL;
+            break;
+        case TokenType::GREATER: result->opcode = OpCode::OP_GREATER;
+            break;
+        case TokenType::GREATER_EQUAL: result->opcode = OpCode::OP_GREATER_EQUAL;
+            break;
+        case TokenType::LESS: result->opcode = OpCode::OP_LESS;
+            break;
+        case TokenType::LESS_EQUAL: result->opcode = OpCode::OP_LESS_EQUAL;
+            break;
+        default: break;
+    }
+
+    return result;
+}
+
+IrNode *IrCompiler::call([[maybe_unused]] bool canAssign, IrNode *left)
+{
+    std::vector<IrNode *> arguments;
+    if (!check(TokenType::RIGHT_PAREN))
+    {
+        do
+        {
+            arguments.push_back(expression());
+            if (arguments.size() == UINT8_MAX + 1)
+            {
+                error("Cannot have more than 255 arguments.");
+            }
+        } while (match(TokenType::COMMA));
+    }
+
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
+    const auto result = node(IrKind::CALL);
+    result->operand = left;
+    result->children = std::move(arguments);
+    return result;
+}
+
+IrNode *IrCompiler::arrayLiteral([[maybe_unused]] bool canAssign, [[maybe_unused]] IrNode *left)
+{
+    std::vector<IrNode *> elements;
+    if (!check(TokenType::RIGHT_BRACKET))
+    {
+        do
+        {
+            elements.push_back(expression());
+            if (elements.size() == MAX_LONG_OPERAND + 1)
+            {
+                error("Cannot have more than 16777215 elements in an array literal.");
+            }
+        } while (match(TokenType::COMMA));
+    }
+
+    consume(TokenType::RIGHT_BRACKET, "Expect ']' after array elements.");
+    const auto result = node(IrKind::ARRAY);
+    result->children = std::move(elements);
+    return result;
+}
+
+IrNode *IrCompiler::subscript(const bool canAssign, IrNode *left)
+{
+    const auto index = expression();
+    consume(TokenType::RIGHT_BRACKET, "Expect ']' after index.");
+    if (canAssign && match(TokenType::EQUAL))
+    {
+        const auto value = expression();
+        const auto result = node(IrKind::INDEX_SET);
+        result->children = {left, index, value};
+        return result;
+    }
+
+    const auto result = node(IrKind::INDEX_GET);
+    result->left = left;
+    result->right = index;
+    return result;
+}
+
+IrNode *IrCompiler::dot([[maybe_unused]] bool canAssign, IrNode *left)
+{
+    consume(TokenType::IDENTIFIER, "Expect property name after '.'.");
+    const auto result = node(IrKind::GET_PROPERTY);
+    result->operand = left;
+    result->value = Value::object(heap.copyString(parser.previous.lexeme));
+    return result;
+}
+
+IrNode *IrCompiler::logicalAnd([[maybe_unused]] bool canAssign, IrNode *left)
+{
+    return logical(left, OpCode::OP_JUMP_IF_FALSE_OR_POP, Precedence::And, false);
+}
+
+IrNode *IrCompiler::logicalOr([[maybe_unused]] bool canAssign, IrNode *left)
+{
+    return logical(left, OpCode::OP_JUMP_IF_TRUE_OR_POP, Precedence::Or, false);
+}
+
+IrNode *IrCompiler::logicalXor([[maybe_unused]] bool canAssign, IrNode *left)
+{
+    const auto right = parsePrecedence(static_cast<Precedence>(static_cast<int>(Precedence::Xor) + 1));
+    const auto result = node(IrKind::BINARY);
+    result->opcode = OpCode::OP_XOR;
+    result->left = left;
+    result->right = right;
+    return result;
+}
+
+IrNode *IrCompiler::logicalNand([[maybe_unused]] bool canAssign, IrNode *left)
+{
+    return logical(left, OpCode::OP_JUMP_IF_FALSE_OR_POP,
+                   static_cast<Precedence>(static_cast<int>(Precedence::Nand) + 1), true);
+}
+
+IrNode *IrCompiler::logicalNor([[maybe_unused]] bool canAssign, IrNode *left)
+{
+    return logical(left, OpCode::OP_JUMP_IF_TRUE_OR_POP,
+                   static_cast<Precedence>(static_cast<int>(Precedence::Nor) + 1), true);
+}
+
+IrNode *IrCompiler::logical(IrNode *left, const OpCode jump, const Precedence precedence, const bool negated)
+{
+    const auto right = parsePrecedence(precedence);
+    const auto result = node(IrKind::LOGICAL);
+    result->opcode = jump;
+    result->negated = negated;
+    result->left = left;
+    result->right = right;
+    return result;
+}
+
+IrNode *IrCompiler::literal([[maybe_unused]] bool canAssign, [[maybe_unused]] IrNode *left)
+{
+    switch (parser.previous.type)
+    {
+        case TokenType::FALSE:
+            return constantNode(Value::boolean(false));
+        case TokenType::TRUE:
+            return constantNode(Value::boolean(true));
+        default:
+            return constantNode(Value::null());
+    }
+}
+
+IrNode *IrCompiler::string([[maybe_unused]] bool canAssign, [[maybe_unused]] IrNode *left)
+{
+    const auto content = parser.previous.lexeme.substr(1, parser.previous.lexeme.length() - 2);
+    return constantNode(Value::object(heap.copyString(content)));
+}
+
+IrNode *IrCompiler::variable(const bool canAssign, [[maybe_unused]] IrNode *left)
+{
+    // Copied, since compiling an assigned value moves parser.previous past the name.
+    const auto name = parser.previous;
+    return namedVariable(name, canAssign);
+}
+
+IrNode *IrCompiler::namedVariable(const Token &name, const bool canAssign)
+{
+    auto getKind = IrKind::GET_LOCAL;
+    auto setKind = IrKind::SET_LOCAL;
+    auto constant = false;
+    auto index = resolveLocal(current, name);
+    if (index != -1)
+    {
+        constant = current->locals[index].constant;
+        index = state->localVariables[index];
+    }
+    else if (index = resolveUpvalue(current, name); index != -1)
+    {
+        getKind = IrKind::GET_UPVALUE;
+        setKind = IrKind::SET_UPVALUE;
+        constant = current->function->upvalues[index].constant;
+    }
+    else
+    {
+        getKind = IrKind::GET_GLOBAL;
+        setKind = IrKind::SET_GLOBAL;
+        index = globalSlot(name);
+    }
+
+    if (canAssign && match(TokenType::EQUAL))
+    {
+        if (constant)
+        {
+            error(std::format("Constant {} cannot be reassigned.", name.lexeme));
+        }
+
+        const auto value = expression();
+        const auto assignment = node(setKind);
+        assignment->index = index;
+        assignment->operand = value;
+        return assignment;
+    }
+
+    const auto read = node(getKind);
+    read->index = index;
+    return read;
+}
+
+IrNode *IrCompiler::constantNode(const Value value)
+{
+    const auto constant = node(IrKind::CONSTANT);
+    constant->value = value;
+    return constant;
+}
+
+IrCompiler::Rule IrCompiler::getRule(const TokenType type) const
+{
+    return rules[static_cast<uint8_t>(type)];
+}
+
+// Lowering assigns stack slots in declaration order, exactly like the single-pass compiler does while parsing, and
+// reproduces its instruction sequences, so only what the passes changed differs in the bytecode.
+void IrCompiler::lowerFunction(IrFunction *ir)
+{
+    auto functionLowering = Lowering{ir, std::vector<int>(ir->variables.size(), -1), lowering};
+    lowering = &functionLowering;
+
+    const auto function = ir->function;
+    for (auto variable = 0; variable <= function->arity; variable++)
+    {
+        declareSlot(variable);
+    }
+
+    for (const auto statement: ir->body->children)
+    {
+        lowerStatement(statement);
+    }
+
+    emitByte(static_cast<uint8_t>(OpCode::OP_NULL), ir->body->location);
+    emitByte(static_cast<uint8_t>(OpCode::OP_RETURN), ir->body->location);
+    if (optimizationLevel > 0 && !parser.hadError)
+    {
+        Optimizer{heap, function->chunk, optimizationLevel}.run();
+    }
+
+    function->chunk.maxStackDepth = function->chunk.computeStackDepth(1 + function->arity);
+    heap.rescanObject(function);
+    lowering = functionLowering.enclosing;
+}
+
+void IrCompiler::lowerStatement(const IrNode *statement)
+{
+    const auto location = statement->location;
+    switch (statement->kind)
+    {
+        case IrKind::EXPRESSION:
+            lowerExpression(statement->operand);
+            emitByte(static_cast<uint8_t>(OpCode::OP_POP), location);
+            break;
+        case IrKind::PRINT:
+            lowerExpression(statement->operand);
+            emitByte(static_cast<uint8_t>(OpCode::OP_PRINT), location);
+            break;
+        case IrKind::DECLARE_LOCAL:
+            // The slot is assigned first: a local function captures its own slot before its closure is stored there.
+            declareSlot(statement->index);
+            lowerExpression(statement->operand);
+            break;
+        case IrKind::DEFINE_GLOBAL:
+            lowerExpression(statement->operand);
+            if (statement->constant)
+            {
+                emitIndexed(OpCode::OP_DEFINE_CONSTANT, OpCode::OP_DEFINE_CONSTANT_LONG, statement->index, location);
+            }
+            else
+            {
+                emitIndexed(OpCode::OP_DEFINE_GLOBAL, OpCode::OP_DEFINE_GLOBAL_LONG, statement->index, location);
+            }
+
+            break;
+        case IrKind::BLOCK:
+        {
+            const auto liveCount = static_cast<int>(lowering->live.size());
+            for (const auto child: statement->children)
+            {
+                lowerStatement(child);
+            }
+
+            popLiveAbove(liveCount, location);
+            lowering->live.resize(liveCount);
+            break;
+        }
+        case IrKind::IF:
+        {
+            lowerExpression(statement->operand);
+            const auto thenJump = emitJump(OpCode::OP_JUMP_IF_FALSE, location);
+            lowerStatement(statement->body);
+            if (statement->alternative != nullptr)
+            {
+                const auto elseJump = emitJump(OpCode::OP_JUMP, location);
+                patchJump(thenJump, location);
+                lowerStatement(statement->alternative);
+                patchJump(elseJump, location);
+            }
+            else
+            {
+                patchJump(thenJump, location);
+            }
+
+            break;
+        }
+        case IrKind::LOOP:
+            lowerLoop(statement);
+            break;
+        case IrKind::BREAK:
+        {
+            auto &loop = lowering->loops.back();
+            popLiveAbove(loop.liveCount, location);
+            loop.breakJumps.push_back(emitJump(OpCode::OP_JUMP, location));
+            break;
+        }
+        case IrKind::CONTINUE:
+        {
+            popLiveAbove(lowering->loops.back().liveCount, location);
+            if (lowering->loops.back().continueTarget == -1)
+            {
+                const auto jump = emitJump(OpCode::OP_JUMP, location);
+                lowering->loops.back().continueJumps.push_back(jump);
+            }
+            else
+            {
+                emitLoop(lowering->loops.back().continueTarget, location);
+            }
+
+            break;
+        }
+        case IrKind::RETURN:
+            lowerExpression(statement->operand);
+            if (statement->operand->kind == IrKind::CALL)
+            {
+                auto &chunk = lowering->ir->function->chunk;
+                chunk.code[chunk.count - 2] = static_cast<uint8_t>(OpCode::OP_TAIL_CALL);
+            }
+
+            emitByte(static_cast<uint8_t>(OpCode::OP_RETURN), location);
+            break;
+        default:
+            break;
+    }
+}
+
+// while and for loops without an increment continue at their condition; for loops with one compile it before the
+// body and continue there, do while loops patch their continues to the condition after the body.
+void IrCompiler::lowerLoop(const IrNode *loop)
+{
+    const auto location = loop->location;
+    auto &chunk = lowering->ir->function->chunk;
+    auto loopStart = chunk.count;
+    const auto liveCount = static_cast<int>(lowering->live.size());
+    if (loop->form == IrLoopForm::DO_WHILE)
+    {
+        lowering->loops.push_back(LoweringLoop{liveCount, -1});
+        lowerStatement(loop->body);
+        const auto finished = std::move(lowering->loops.back());
+        lowering->loops.pop_back();
+        for (const auto jump: finished.continueJumps)
+        {
+            patchJump(jump, location);
+        }
+
+        lowerExpression(loop->operand);
+        const auto exitJump = emitJump(OpCode::OP_JUMP_IF_FALSE, location);
+        emitLoop(loopStart, location);
+        patchJump(exitJump, location);
+        for (const auto jump: finished.breakJumps)
+        {
+            patchJump(jump, location);
+        }
+
+        return;
+    }
+
+    auto exitJump = -1;
+    if (loop->operand != nullptr)
+    {
+        lowerExpression(loop->operand);
+        exitJump = emitJump(OpCode::OP_JUMP_IF_FALSE, location);
+    }
+
+    if (loop->increment != nullptr)
+    {
+        const auto bodyJump = emitJump(OpCode::OP_JUMP, location);
+        const auto incrementStart = chunk.count;
+        lowerExpression(loop->increment);
+        emitByte(static_cast<uint8_t>(OpCode::OP_POP), location);
+        emitLoop(loopStart, location);
+        loopStart = incrementStart;
+        patchJump(bodyJump, location);
+    }
+
+    lowering->loops.push_back(LoweringLoop{liveCount, loopStart});
+    lowerStatement(loop->body);
+    emitLoop(loopStart, location);
+    const auto finished = std::move(lowering->loops.back());
+    lowering->loops.pop_back();
+    if (exitJump != -1)
+    {
+        patchJump(exitJump, location);
+    }
+
+    for (const auto jump: finished.breakJumps)
+    {
+        patchJump(jump, location);
+    }
+}
+
+void IrCompiler::lowerExpression(const IrNode *expression)
+{
+    const auto location = expression->location;
+    switch (expression->kind)
+    {
+        case IrKind::CONSTANT:
+            lowerConstant(expression->value, location);
+            break;
+        case IrKind::GET_LOCAL:
+            emitByte(static_cast<uint8_t>(OpCode::OP_GET_LOCAL), location);
+            emitByte(static_cast<uint8_t>(lowering->slots[expression->index]), location);
+            break;
+        case IrKind::SET_LOCAL:
+            lowerExpression(expression->operand);
+            emitByte(static_cast<uint8_t>(OpCode::OP_SET_LOCAL), location);
+            emitByte(static_cast<uint8_t>(lowering->slots[expression->index]), location);
+            break;
+        case IrKind::GET_UPVALUE:
+            emitByte(static_cast<uint8_t>(OpCode::OP_GET_UPVALUE), location);
+            emitByte(static_cast<uint8_t>(expression->index), location);
+            break;
+        case IrKind::SET_UPVALUE:
+            lowerExpression(expression->operand);
+            emitByte(static_cast<uint8_t>(OpCode::OP_SET_UPVALUE), location);
+            emitByte(static_cast<uint8_t>(expression->index), location);
+            break;
+        case IrKind::GET_GLOBAL:
+            emitIndexed(OpCode::OP_GET_GLOBAL, OpCode::OP_GET_GLOBAL_LONG, expression->index, location);
+            break;
+        case IrKind::SET_GLOBAL:
+            lowerExpression(expression->operand);
+            emitIndexed(OpCode::OP_SET_GLOBAL, OpCode::OP_SET_GLOBAL_LONG, expression->index, location);
+            break;
+        case IrKind::UNARY:
+            lowerExpression(expression->operand);
+            emitByte(static_cast<uint8_t>(expression->opcode), location);
+            break;
+        case IrKind::BINARY:
+            lowerExpression(expression->left);
+            lowerExpression(expression->right);
+            emitByte(static_cast<uint8_t>(expression->opcode), location);
+            break;
+        case IrKind::LOGICAL:
+        {
+            lowerExpression(expression->left);
+            const auto endJump = emitJump(expression->opcode, location);
+            lowerExpression(expression->right);
+            patchJump(endJump, location);
+            if (expression->negated)
+            {
+                emitByte(static_cast<uint8_t>(OpCode::OP_NOT), location);
+            }
+
+            break;
+        }
+        case IrKind::CALL:
+            lowerExpression(expression->operand);
+            for (const auto argument: expression->children)
+            {
+                lowerExpression(argument);
+            }
+
+            emitByte(static_cast<uint8_t>(OpCode::OP_CALL), location);
+            emitByte(static_cast<uint8_t>(expression->children.size()), location);
+            break;
+        case IrKind::ARRAY:
+            for (const auto element: expression->children)
+            {
+                lowerExpression(element);
+            }
+
+            emitIndexed(OpCode::OP_ARRAY, OpCode::OP_ARRAY_LONG, static_cast<int>(expression->children.size()),
+                        location);
+            break;
+        case IrKind::INDEX_GET:
+            lowerExpression(expression->left);
+            lowerExpression(expression->right);
+            emitByte(static_cast<uint8_t>(OpCode::OP_INDEX_GET), location);
+            break;
+        case IrKind::INDEX_SET:
+            for (const auto child: expression->children)
+            {
+                lowerExpression(child);
+            }
+
+            emitByte(static_cast<uint8_t>(OpCode::OP_INDEX_SET), location);
+            break;
+        case IrKind::GET_PROPERTY:
+        {
+            lowerExpression(expression->operand);
+            const auto constant = makeConstant(expression->value, location);
+            emitIndexed(OpCode::OP_GET_PROPERTY, OpCode::OP_GET_PROPERTY_LONG, constant, location);
+            break;
+        }
+        case IrKind::CLOSURE:
+        {
+            const auto ir = expression->function;
+            lowerFunction(ir);
+            for (auto i = 0; i < static_cast<int>(ir->upvalueVariables.size()); i++)
+            {
+                if (const auto variable = ir->upvalueVariables[i]; variable != -1)
+                {
+                    ir->function->upvalues[i].index = static_cast<uint8_t>(lowering->slots[variable]);
+                }
+            }
+
+            const auto constant = makeConstant(Value::object(ir->function), location);
+            emitIndexed(OpCode::OP_CLOSURE, OpCode::OP_CLOSURE_LONG, constant, location);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void IrCompiler::lowerConstant(const Value value, const SourceLocation location)
+{
+    if (value.isNull())
+    {
+        emitByte(static_cast<uint8_t>(OpCode::OP_NULL), location);
+    }
+    else if (value.isBool())
+    {
+        emitByte(static_cast<uint8_t>(value.asBool() ? OpCode::OP_TRUE : OpCode::OP_FALSE), location);
+    }
+    else
+    {
+        emitIndexed(OpCode::OP_CONSTANT, OpCode::OP_CONSTANT_LONG, makeConstant(value, location), location);
+    }
+}
+
+void IrCompiler::declareSlot(const int variable)
+{
+    if (lowering->live.size() == FunctionScope::MAX_LOCALS)
+    {
+        loweringError(lowering->ir->body->location, "Too many local variables in scope.");
+        return;
+    }
+
+    lowering->slots[variable] = static_cast<int>(lowering->live.size());
+    lowering->live.push_back(variable);
+    if (const auto &declared = lowering->ir->variables[variable]; !declared.name.empty())
+    {
+        lowering->ir->function->chunk.addLocalName(heap.copyString(declared.name), declared.declared,
+                                                   lowering->slots[variable]);
+    }
+}
+
+// Only emits the pops, leaving the variables live: after a break or continue the rest of the block is still
+// lowered against them.
+void IrCompiler::popLiveAbove(const int liveCount, const SourceLocation location)
+{
+    for (auto i = static_cast<int>(lowering->live.size()) - 1; i >= liveCount; i--)
+    {
+        const auto captured = lowering->ir->variables[lowering->live[i]].captured;
+        emitByte(static_cast<uint8_t>(captured ? OpCode::OP_CLOSE_UPVALUE : OpCode::OP_POP), location);
+    }
+}
+
+void IrCompiler::emitByte(const uint8_t byte, const SourceLocation location) const
+{
+    lowering->ir->function->chunk.write(byte, location);
+}
+
+void IrCompiler::emitIndexed(const OpCode shortForm, const OpCode longForm, const int index,
+                             const SourceLocation location) const
+{
+    if (index <= UINT8_MAX)
+    {
+        emitByte(static_cast<uint8_t>(shortForm), location);
+        emitByte(static_cast<uint8_t>(index), location);
+        return;
+    }
+
+    emitByte(static_cast<uint8_t>(longForm), location);
+    emitByte(static_cast<uint8_t>(index & 0xff), location);
+    emitByte(static_cast<uint8_t>(index >> 8 & 0xff), location);
+    emitByte(static_cast<uint8_t>(index >> 16 & 0xff), location);
+}
+
+int IrCompiler::emitJump(const OpCode instruction, const SourceLocation location) const
+{
+    emitByte(static_cast<uint8_t>(instruction), location);
+    emitByte(0xff, location);
+    emitByte(0xff, location);
+    return lowering->ir->function->chunk.count - 2;
+}
+
+void IrCompiler::patchJump(const int offset, const SourceLocation location)
+{
+    const auto &chunk = lowering->ir->function->chunk;
+    const auto jump = chunk.count - offset - 2;
+    if (jump > MAX_JUMP)
+    {
+        loweringError(location, "Too much code to jump over.");
+    }
+
+    chunk.patchShortOperand(offset, jump);
+}
+
+void IrCompiler::emitLoop(const int loopStart, const SourceLocation location)
+{
+    emitByte(static_cast<uint8_t>(OpCode::OP_LOOP), location);
+    const auto offset = lowering->ir->function->chunk.count - loopStart + 2;
+    if (offset > MAX_JUMP)
+    {
+        loweringError(location, "Loop body too large.");
+    }
+
+    emitByte(static_cast<uint8_t>(offset & 0xff), location);
+    emitByte(static_cast<uint8_t>(offset >> 8 & 0xff), location);
+}
+
+int IrCompiler::makeConstant(const Value value, const SourceLocation location)
+{
+    const auto constant = lowering->ir->function->chunk.addConstant(value);
+    if (constant > MAX_LONG_OPERAND)
+    {
+        loweringError(location, "Too many constants in one chunk.");
+        return 0;
+    }
+
+    return constant;
+}
+
+// Parsing is over by the time a function is lowered, so errors point at the node's location instead of a token.
+void IrCompiler::loweringError(const SourceLocation location, const std::string_view message)
+{
+    errorAt(Token{TokenType::ERROR, "", location.line, location.column}, message);
+}
@@ -0,0 +1,680 @@
+#include "../include/ir_optimizer.h"
+
+#include <algorithm>
+
+#include "../include/function_scope.h"
+#include "../include/optimizer.h"
+
+namespace
+{
+    // Visits the nodes directly below node, in evaluation order, by reference so they can be replaced. The bodies of
+    // nested functions belong to other IrFunctions and are not visited.
+    template<typename Visit>
+    void forEachChild(IrNode *node, Visit &&visit)
+    {
+        for (auto child: {&node->operand, &node->left, &node->right, &node->body, &node->alternative, &node->increment})
+        {
+            if (*child != nullptr)
+            {
+                visit(*child);
+            }
+        }
+
+        for (auto &child: node->children)
+        {
+            visit(child);
+        }
+    }
+
+    bool sameExpression(const IrNode *a, const IrNode *b)
+    {
+        if (a->kind != b->kind)
+        {
+            return false;
+        }
+
+        switch (a->kind)
+        {
+            case IrKind::CONSTANT:
+                return a->value.raw() == b->value.raw();
+            case IrKind::GET_LOCAL:
+                return a->index == b->index;
+            case IrKind::UNARY:
+                return a->opcode == b->opcode && sameExpression(a->operand, b->operand);
+            case IrKind::BINARY:
+                return a->opcode == b->opcode && sameExpression(a->left, b->left) && sameExpression(a->right, b->right);
+            default:
+                return false;
+        }
+    }
+
+    bool readsAny(const IrNode *expression, const std::vector<bool> &variables)
+    {
+        switch (expression->kind)
+        {
+            case IrKind::GET_LOCAL:
+                return variables[expression->index];
+            case IrKind::UNARY:
+                return readsAny(expression->operand, variables);
+            case IrKind::BINARY:
+                return readsAny(expression->left, variables) || readsAny(expression->right, variables);
+            default:
+                return false;
+        }
+    }
+
+    // Statements after one of these in the same block are never reached.
+    bool terminates(const IrNode *statement)
+    {
+        switch (statement->kind)
+        {
+            case IrKind::RETURN:
+            case IrKind::BREAK:
+            case IrKind::CONTINUE:
+                return true;
+            case IrKind::BLOCK:
+                return !statement->children.empty() && terminates(statement->children.back());
+            case IrKind::IF:
+                return statement->alternative != nullptr && terminates(statement->body)
+                       && terminates(statement->alternative);
+            default:
+                return false;
+        }
+    }
+
+    // Operators whose result is a number whenever they do not fail.
+    bool yieldsNumber(const OpCode opcode)
+    {
+        switch (opcode)
+        {
+            case OpCode::OP_SUBTRACT:
+            case OpCode::OP_MULTIPLY:
+            case OpCode::OP_DIVIDE:
+            case OpCode::OP_EXPONENT:
+            case OpCode::OP_MODULO:
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+IrOptimizer::IrOptimizer(Heap &heap, IrPool &pool): heap(heap), pool(pool)
+{
+}
+
+void IrOptimizer::run(IrFunction *program)
+{
+    optimize(program);
+}
+
+// Copy propagation runs again after the passes that leave locals holding nothing but a copy of another one.
+void IrOptimizer::optimize(IrFunction *ir)
+{
+    function = ir;
+    function->body = fold(function->body);
+    propagateCopies();
+    function->body = fold(function->body);
+
+    analyze();
+    auto available = std::vector<Available>{};
+    eliminateCommonSubexpressions(function->body, available);
+    propagateCopies();
+
+    analyze();
+    inferNumbers();
+    hoistLoopInvariants(function->body);
+    propagateCopies();
+
+    do
+    {
+        analyze();
+        inferNumbers();
+    } while (eliminateDeadCode(function->body));
+
+    selectNumberOperators(function->body);
+    optimizeNested(function->body);
+}
+
+void IrOptimizer::optimizeNested(IrNode *node)
+{
+    if (node->kind == IrKind::CLOSURE)
+    {
+        optimize(node->function);
+        return;
+    }
+
+    forEachChild(node, [&](IrNode *child) { optimizeNested(child); });
+}
+
+void IrOptimizer::analyze()
+{
+    usages.assign(function->variables.size(), Usage{});
+    count(function->body);
+}
+
+void IrOptimizer::count(IrNode *node)
+{
+    switch (node->kind)
+    {
+        case IrKind::GET_LOCAL:
+            usages[node->index].reads++;
+            break;
+        case IrKind::SET_LOCAL:
+            usages[node->index].writes++;
+            usages[node->index].assignedValues.push_back(node->operand);
+            break;
+        case IrKind::DECLARE_LOCAL:
+            usages[node->index].declaration = node;
+            break;
+        default:
+            break;
+    }
+
+    forEachChild(node, [&](IrNode *child) { count(child); });
+}
+
+// Starts from every declared, uncaptured local being numeric and drops those that are ever given a value that may
+// not be a number, until nothing changes. Parameters may be passed anything.
+void IrOptimizer::inferNumbers()
+{
+    for (auto variable = 0; variable < static_cast<int>(usages.size()); variable++)
+    {
+        usages[variable].numeric = usages[variable].declaration != nullptr && !isCaptured(variable);
+    }
+
+    for (auto changed = true; changed;)
+    {
+        changed = false;
+        for (auto &usage: usages)
+        {
+            if (!usage.numeric)
+            {
+                continue;
+            }
+
+            usage.numeric = isNumeric(usage.declaration->operand)
+                            && std::ranges::all_of(usage.assignedValues, [&](auto value) { return isNumeric(value); });
+            changed = changed || !usage.numeric;
+        }
+    }
+}
+
+IrNode *IrOptimizer::fold(IrNode *node)
+{
+    forEachChild(node, [&](IrNode *&child) { child = fold(child); });
+    switch (node->kind)
+    {
+        case IrKind::UNARY:
+            if (node->operand->kind == IrKind::CONSTANT)
+            {
+                if (const auto result = Optimizer::foldUnary(node->opcode, node->operand->value); result.has_value())
+                {
+                    return constant(result.value(), node->location);
+                }
+            }
+
+            return node;
+        case IrKind::BINARY:
+            if (node->left->kind == IrKind::CONSTANT && node->right->kind == IrKind::CONSTANT)
+            {
+                const auto result = Optimizer::foldBinary(heap, node->opcode, node->left->value, node->right->value);
+                if (result.has_value())
+                {
+                    return constant(result.value(), node->location);
+                }
+            }
+
+            return node;
+        case IrKind::LOGICAL:
+        {
+            if (node->left->kind != IrKind::CONSTANT)
+            {
+                return node;
+            }
+
+            const auto falsey = isFalsey(node->left->value);
+            const auto decided = node->opcode == OpCode::OP_JUMP_IF_FALSE_OR_POP ? falsey : !falsey;
+            const auto result = decided ? node->left : node->right;
+            if (!node->negated)
+            {
+                return result;
+            }
+
+            const auto negation = pool.node(IrKind::UNARY, node->location);
+            negation->opcode = OpCode::OP_NOT;
+            negation->operand = result;
+            return fold(negation);
+        }
+        case IrKind::IF:
+            if (node->operand->kind != IrKind::CONSTANT)
+            {
+                return node;
+            }
+
+            if (!isFalsey(node->operand->value))
+            {
+                return node->body;
+            }
+
+            return node->alternative != nullptr ? node->alternative : pool.node(IrKind::BLOCK, node->location);
+        case IrKind::LOOP:
+            if (node->form == IrLoopForm::DO_WHILE || node->operand == nullptr
+                || node->operand->kind != IrKind::CONSTANT)
+            {
+                return node;
+            }
+
+            if (isFalsey(node->operand->value))
+            {
+                return pool.node(IrKind::BLOCK, node->location);
+            }
+
+            node->operand = nullptr;
+            return node;
+        default:
+            return node;
+    }
+}
+
+void IrOptimizer::propagateCopies()
+{
+    analyze();
+
+    // The node each local can be replaced with, resolved through chains of copies. Locals are declared before any
+    // local initialized from them, so resolving in variable order sees every source resolved already.
+    const auto variableCount = static_cast<int>(usages.size());
+    std::vector<const IrNode *> sources(variableCount, nullptr);
+    for (auto variable = 0; variable < variableCount; variable++)
+    {
+        const auto &usage = usages[variable];
+        if (usage.declaration == nullptr || usage.writes > 0 || isCaptured(variable))
+        {
+            continue;
+        }
+
+        const auto value = usage.declaration->operand;
+        if (value->kind == IrKind::CONSTANT)
+        {
+            sources[variable] = value;
+        }
+        else if (value->kind == IrKind::GET_LOCAL && usages[value->index].writes == 0 && !isCaptured(value->index))
+        {
+            sources[variable] = sources[value->index] != nullptr ? sources[value->index] : value;
+        }
+    }
+
+    // Copied out first, since the nodes they point to are rewritten below. A rewritten node keeps its own location;
+    // the placeholders for variables without a source are never read.
+    std::vector<IrNode> replacements;
+    replacements.reserve(variableCount);
+    for (const auto source: sources)
+    {
+        replacements.push_back(source != nullptr ? *source : IrNode{IrKind::BLOCK, function->body->location});
+    }
+
+    auto replace = [&](auto &self, IrNode *node) -> void
+    {
+        if (node->kind == IrKind::GET_LOCAL && sources[node->index] != nullptr)
+        {
+            const auto &replacement = replacements[node->index];
+            node->kind = replacement.kind;
+            node->value = replacement.value;
+            node->index = replacement.index;
+            return;
+        }
+
+        forEachChild(node, [&](IrNode *child) { self(self, child); });
+    };
+    replace(replace, function->body);
+}
+
+// Works through a block in order, keeping the expressions held by locals declared so far. Any other statement first
+// loses whatever it may assign, since the expressions it contains may be evaluated after those assignments, or on
+// the next iteration of a loop. Nested blocks and branches start from a copy: what they make available is gone once
+// they are left.
+void IrOptimizer::eliminateCommonSubexpressions(IrNode *statement, std::vector<Available> &available)
+{
+    auto inner = available;
+    const auto assigned = assignedIn(statement);
+    std::erase_if(available, [&](const Available &entry)
+    {
+        return assigned[entry.variable] || readsAny(entry.expression, assigned);
+    });
+
+    switch (statement->kind)
+    {
+        case IrKind::BLOCK:
+            for (const auto child: statement->children)
+            {
+                eliminateCommonSubexpressions(child, inner);
+            }
+
+            return;
+        case IrKind::IF:
+        case IrKind::LOOP:
+        {
+            replaceAvailable(statement->operand, available);
+            replaceAvailable(statement->increment, available);
+            for (const auto branch: {statement->body, statement->alternative})
+            {
+                if (branch != nullptr)
+                {
+                    auto branchAvailable = available;
+                    eliminateCommonSubexpressions(branch, branchAvailable);
+                }
+            }
+
+            return;
+        }
+        default:
+            break;
+    }
+
+    replaceAvailable(statement->operand, available);
+    if (statement->kind == IrKind::DECLARE_LOCAL && !isCaptured(statement->index) && isPure(statement->operand)
+        && (statement->operand->kind == IrKind::UNARY || statement->operand->kind == IrKind::BINARY))
+    {
+        available.push_back(Available{statement->operand, statement->index});
+    }
+}
+
+void IrOptimizer::replaceAvailable(IrNode *&expression, const std::vector<Available> &available)
+{
+    if (expression == nullptr)
+    {
+        return;
+    }
+
+    for (const auto &[held, variable]: available)
+    {
+        if (sameExpression(expression, held))
+        {
+            expression = readLocal(variable, expression->location);
+            return;
+        }
+    }
+
+    forEachChild(expression, [&](IrNode *&child) { replaceAvailable(child, available); });
+}
+
+// Inner loops are handled first, so an expression invariant in several nested loops ends up before the outermost
+// one, through the temporaries copy propagation then merges.
+void IrOptimizer::hoistLoopInvariants(IrNode *&statement)
+{
+    switch (statement->kind)
+    {
+        case IrKind::BLOCK:
+            for (auto &child: statement->children)
+            {
+                hoistLoopInvariants(child);
+            }
+
+            return;
+        case IrKind::IF:
+            hoistLoopInvariants(statement->body);
+            if (statement->alternative != nullptr)
+            {
+                hoistLoopInvariants(statement->alternative);
+            }
+
+            return;
+        case IrKind::LOOP:
+            hoistLoopInvariants(statement->body);
+            break;
+        default:
+            return;
+    }
+
+    const auto assigned = assignedIn(statement);
+    std::vector<IrNode *> hoisted;
+    forEachChild(statement, [&](IrNode *&child) { hoistFromLoop(child, assigned, hoisted); });
+    if (hoisted.empty())
+    {
+        return;
+    }
+
+    const auto block = pool.node(IrKind::BLOCK, statement->location);
+    block->children = std::move(hoisted);
+    block->children.push_back(statement);
+    statement = block;
+}
+
+void IrOptimizer::hoistFromLoop(IrNode *&expression, const std::vector<bool> &assigned, std::vector<IrNode *> &hoisted)
+{
+    const auto isOperation = expression->kind == IrKind::UNARY || expression->kind == IrKind::BINARY;
+    if (!isOperation || !isInvariant(expression, assigned) || !cannotFail(expression))
+    {
+        forEachChild(expression, [&](IrNode *&child) { hoistFromLoop(child, assigned, hoisted); });
+        return;
+    }
+
+    const auto existing = std::ranges::find_if(hoisted, [&](const IrNode *declaration)
+    {
+        return sameExpression(declaration->operand, expression);
+    });
+    if (existing != hoisted.end())
+    {
+        expression = readLocal((*existing)->index, expression->location);
+        return;
+    }
+
+    // Every variable could be live at once, so a new one is only added while that still fits in the frame's slots.
+    auto &variables = function->variables;
+    if (variables.size() >= FunctionScope::MAX_LOCALS)
+    {
+        return;
+    }
+
+    const auto variable = static_cast<int>(variables.size());
+    variables.push_back(IrVariable{{}, {}, true, false});
+    usages.push_back(Usage{});
+    usages.back().numeric = isNumeric(expression);
+
+    const auto declaration = pool.node(IrKind::DECLARE_LOCAL, expression->location);
+    declaration->index = variable;
+    declaration->operand = expression;
+    hoisted.push_back(declaration);
+    expression = readLocal(variable, expression->location);
+}
+
+// Returns whether anything was removed, since that can leave more locals unused.
+bool IrOptimizer::eliminateDeadCode(IrNode *statement)
+{
+    auto changed = false;
+    switch (statement->kind)
+    {
+        case IrKind::BLOCK:
+        {
+            auto &children = statement->children;
+            auto kept = std::vector<IrNode *>{};
+            for (const auto child: children)
+            {
+                changed = eliminateDeadCode(child) || changed;
+                if (isDead(child))
+                {
+                    changed = true;
+                    continue;
+                }
+
+                kept.push_back(child);
+                if (terminates(child))
+                {
+                    break;
+                }
+            }
+
+            changed = changed || kept.size() != children.size();
+            children = std::move(kept);
+            break;
+        }
+        case IrKind::IF:
+            changed = eliminateDeadCode(statement->body);
+            if (statement->alternative != nullptr)
+            {
+                changed = eliminateDeadCode(statement->alternative) || changed;
+            }
+
+            break;
+        case IrKind::LOOP:
+            changed = eliminateDeadCode(statement->body);
+            break;
+        default:
+            break;
+    }
+
+    return changed;
+}
+
+bool IrOptimizer::isDead(const IrNode *statement) const
+{
+    switch (statement->kind)
+    {
+        case IrKind::EXPRESSION:
+            return cannotFail(statement->operand);
+        case IrKind::DECLARE_LOCAL:
+        {
+            const auto &usage = usages[statement->index];
+            return usage.reads == 0 && usage.writes == 0 && !isCaptured(statement->index)
+                   && cannotFail(statement->operand);
+        }
+        case IrKind::BLOCK:
+            return statement->children.empty();
+        case IrKind::IF:
+            return cannotFail(statement->operand) && isDead(statement->body)
+                   && (statement->alternative == nullptr || isDead(statement->alternative));
+        default:
+            return false;
+    }
+}
+
+// Runs last, on the final tree: operators whose operands are all proven numbers become their unchecked OP_NUM_ form.
+void IrOptimizer::selectNumberOperators(IrNode *node)
+{
+    forEachChild(node, [&](IrNode *child) { selectNumberOperators(child); });
+    if (node->kind == IrKind::UNARY && isNumeric(node->operand))
+    {
+        node->opcode = numberForm(node->opcode);
+    }
+    else if (node->kind == IrKind::BINARY && isNumeric(node->left) && isNumeric(node->right))
+    {
+        node->opcode = numberForm(node->opcode);
+    }
+}
+
+std::vector<bool> IrOptimizer::assignedIn(IrNode *node) const
+{
+    std::vector<bool> assigned(function->variables.size(), false);
+    auto visit = [&](auto &self, IrNode *current) -> void
+    {
+        if (current->kind == IrKind::SET_LOCAL || current->kind == IrKind::DECLARE_LOCAL)
+        {
+            assigned[current->index] = true;
+        }
+
+        forEachChild(current, [&](IrNode *child) { self(self, child); });
+    };
+    visit(visit, node);
+    return assigned;
+}
+
+bool IrOptimizer::isNumeric(const IrNode *expression) const
+{
+    switch (expression->kind)
+    {
+        case IrKind::CONSTANT:
+            return expression->value.isNumber();
+        case IrKind::GET_LOCAL:
+            return usages[expression->index].numeric;
+        case IrKind::SET_LOCAL:
+            return isNumeric(expression->operand);
+        case IrKind::UNARY:
+            return checkedForm(expression->opcode) == OpCode::OP_NEGATE;
+        case IrKind::BINARY:
+            return yieldsNumber(checkedForm(expression->opcode))
+                   || (checkedForm(expression->opcode) == OpCode::OP_ADD && isNumeric(expression->left)
+                       && isNumeric(expression->right));
+        default:
+            return false;
+    }
+}
+
+// Modulo is left out even on numbers: it goes through long, where a zero divisor is not a runtime error to report.
+bool IrOptimizer::cannotFail(const IrNode *expression) const
+{
+    switch (expression->kind)
+    {
+        case IrKind::CONSTANT:
+        case IrKind::GET_LOCAL:
+        case IrKind::GET_UPVALUE:
+        case IrKind::CLOSURE:
+            return true;
+        case IrKind::UNARY:
+            return cannotFail(expression->operand)
+                   && (expression->opcode == OpCode::OP_NOT || isNumeric(expression->operand));
+        case IrKind::LOGICAL:
+            return cannotFail(expression->left) && cannotFail(expression->right);
+        case IrKind::ARRAY:
+            return std::ranges::all_of(expression->children, [&](auto element) { return cannotFail(element); });
+        case IrKind::BINARY:
+            if (!cannotFail(expression->left) || !cannotFail(expression->right))
+            {
+                return false;
+            }
+
+            switch (expression->opcode)
+            {
+                case OpCode::OP_EQUAL:
+                case OpCode::OP_NOT_EQUAL:
+                case OpCode::OP_XOR:
+                    return true;
+                case OpCode::OP_MODULO:
+                    return false;
+                default:
+                    return isNumeric(expression->left) && isNumeric(expression->right);
+            }
+        default:
+            return false;
+    }
+}
+
+bool IrOptimizer::isPure(const IrNode *expression) const
+{
+    switch (expression->kind)
+    {
+        case IrKind::CONSTANT:
+            return true;
+        case IrKind::GET_LOCAL:
+            return !isCaptured(expression->index);
+        case IrKind::UNARY:
+            return isPure(expression->operand);
+        case IrKind::BINARY:
+            return isPure(expression->left) && isPure(expression->right);
+        default:
+            return false;
+    }
+}
+
+bool IrOptimizer::isInvariant(const IrNode *expression, const std::vector<bool> &assigned) const
+{
+    return isPure(expression) && !readsAny(expression, assigned);
+}
+
+bool IrOptimizer::isCaptured(const int variable) const
+{
+    return function->variables[variable].captured;
+}
+
+IrNode *IrOptimizer::constant(const Value value, const SourceLocation location)
+{
+    const auto node = pool.node(IrKind::CONSTANT, location);
+    node->value = value;
+    return node;
+}
+
+IrNode *IrOptimizer::readLocal(const int variable, const SourceLocation location)
+{
+    const auto node = pool.node(IrKind::GET_LOCAL, location);
+    node->index = variable;
+    return node;
+}
@@ -0,0 +1,177 @@
+#include "../include/line_table.h"
+
+#include <cstring>
+#include <utility>
+
+#include "../include/memory.h"
+
+LineTable::~LineTable()
+{
+    free();
+}
+
+void LineTable::writeByte(const uint8_t byte)
+{
+    if (capacity < count + 1)
+    {
+        const auto oldCapacity = capacity;
+        capacity = growCapacity(oldCapacity);
+        bytes = growArray(arena, bytes, oldCapacity, capacity);
+    }
+
+    bytes[count++] = byte;
+}
+
+void LineTable::writeVarint(uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        writeByte(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+
+    writeByte(static_cast<uint8_t>(value));
+}
+
+void LineTable::add(const int offset, const SourceLocation location)
+{
+    if (!empty && location == last)
+    {
+        return;
+    }
+
+    const auto lineDelta = location.line - last.line;
+    writeVarint(offset - lastOffset);
+    writeVarint(static_cast<uint32_t>(lineDelta) << 1 ^ static_cast<uint32_t>(lineDelta >> 31));
+    writeVarint(location.column);
+    lastOffset = offset;
+    last = location;
+    empty = false;
+}
+
+SourceLocation LineTable::lookup(const int offset) const
+{
+    return Cursor{*this}.seek(offset);
+}
+
+int LineTable::size() const
+{
+    return count;
+}
+
+void LineTable::swap(LineTable &other) noexcept
+{
+    std::swap(bytes, other.bytes);
+    std::swap(count, other.count);
+    std::swap(capacity, other.capacity);
+    std::swap(lastOffset, other.lastOffset);
+    std::swap(last, other.last);
+    std::swap(empty, other.empty);
+    std::swap(arena, other.arena);
+}
+
+void LineTable::useArena(Arena *owner)
+{
+    arena = owner;
+}
+
+void LineTable::relocate(uint8_t *storage)
+{
+    if (count > 0)
+    {
+        std::memcpy(storage, bytes, count);
+    }
+
+    bytes = storage;
+    capacity = count;
+    arena = nullptr;
+}
+
+void LineTable::free()
+{
+    if (arena == nullptr)
+    {
+        freeArray(bytes, capacity);
+    }
+
+    forget();
+}
+
+void LineTable::forget()
+{
+    bytes = nullptr;
+    count = 0;
+    capacity = 0;
+    lastOffset = 0;
+    last = {0, 0};
+    empty = true;
+}
+
+LineTable::Cursor::Cursor(const LineTable &table): table(&table)
+{
+    restart();
+}
+
+void LineTable::Cursor::restart()
+{
+    position = 0;
+    runOffset = 0;
+    location = {0, 0};
+
+    // The first run always starts at offset 0, so decode it eagerly and every later seek has a current run.
+    if (int offset, end; decodeNext(offset, location, end))
+    {
+        runOffset = offset;
+        position = end;
+    }
+}
+
+uint32_t LineTable::Cursor::readVarint(int &at) const
+{
+    uint32_t value = 0;
+    for (auto shift = 0;; shift += 7)
+    {
+        const auto byte = table->bytes[at++];
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+}
+
+bool LineTable::Cursor::decodeNext(int &offset, SourceLocation &next, int &end) const
+{
+    if (position >= table->count)
+    {
+        return false;
+    }
+
+    end = position;
+    offset = runOffset + static_cast<int>(readVarint(end));
+    const auto zigzag = readVarint(end);
+    next.line = location.line + (static_cast<int>(zigzag >> 1) ^ -static_cast<int>(zigzag & 1));
+    next.column = static_cast<int>(readVarint(end));
+    return true;
+}
+
+SourceLocation LineTable::Cursor::seek(const int offset)
+{
+    if (offset < runOffset)
+    {
+        restart();
+    }
+
+    for (int nextOffset, end; ;)
+    {
+        auto next = location;
+        if (!decodeNext(nextOffset, next, end) || nextOffset > offset)
+        {
+            return location;
+        }
+
+        runOffset = nextOffset;
+        location = next;
+        position = end;
+    }
+}
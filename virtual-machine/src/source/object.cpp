@@ -0,0 +1,160 @@
+#include "../include/object.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "../include/memory.h"
+
+// Walks the rope with an explicit stack, since a string appended to piece by piece is as deep as it has nodes. The
+// children are let go afterwards, and are freed by the next collection unless another string shares them.
+void ObjString::flatten()
+{
+    const auto buffer = growArray<char>(nullptr, 0, length + 1);
+    auto written = 0;
+    std::vector<ObjString *> pending{this};
+    while (!pending.empty())
+    {
+        const auto node = pending.back();
+        pending.pop_back();
+        if (node->isRope())
+        {
+            pending.push_back(node->right);
+            pending.push_back(node->left);
+            continue;
+        }
+
+        std::memcpy(buffer + written, node->chars, node->length);
+        written += node->length;
+    }
+
+    buffer[length] = '\0';
+    chars = buffer;
+    left = nullptr;
+    right = nullptr;
+}
+
+bool ObjSet::contains(const Value value)
+{
+    return count > 0 && findSlot(value, hashValue(value))->index != -1;
+}
+
+bool ObjSet::insert(const Value value)
+{
+    if ((count + 1) * 100 > slotCapacity * MAX_LOAD_PERCENT)
+    {
+        growSlots();
+    }
+
+    const auto hash = hashValue(value);
+    const auto slot = findSlot(value, hash);
+    if (slot->index != -1)
+    {
+        return false;
+    }
+
+    if (count == capacity)
+    {
+        const auto oldCapacity = capacity;
+        capacity = growCapacity(capacity);
+        values = growArray(values, oldCapacity, capacity);
+    }
+
+    *slot = SetSlot{hash, count};
+    values[count++] = value;
+    return true;
+}
+
+bool ObjSet::erase(const Value value)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+
+    const auto mask = slotCapacity - 1;
+    auto hole = static_cast<int>(findSlot(value, hashValue(value)) - slots);
+    const auto removed = slots[hole].index;
+    if (removed == -1)
+    {
+        return false;
+    }
+
+    // The same backward shift as StringTable::erase.
+    for (auto index = (hole + 1) & mask; slots[index].index != -1; index = (index + 1) & mask)
+    {
+        const auto home = static_cast<int>(slots[index].hash) & mask;
+        if (((index - home) & mask) >= ((index - hole) & mask))
+        {
+            slots[hole] = slots[index];
+            hole = index;
+        }
+    }
+
+    slots[hole].index = -1;
+    count--;
+    if (removed != count)
+    {
+        const auto last = values[count];
+        auto slot = static_cast<int>(hashValue(last)) & mask;
+        while (slots[slot].index != count)
+        {
+            slot = (slot + 1) & mask;
+        }
+
+        slots[slot].index = removed;
+        values[removed] = last;
+    }
+
+    return true;
+}
+
+void ObjSet::clear()
+{
+    freeArray(values, capacity);
+    freeArray(slots, slotCapacity);
+    values = nullptr;
+    slots = nullptr;
+    count = 0;
+    capacity = 0;
+    slotCapacity = 0;
+}
+
+SetSlot *ObjSet::findSlot(const Value value, const uint32_t hash)
+{
+    const auto mask = slotCapacity - 1;
+    for (auto index = static_cast<int>(hash) & mask;; index = (index + 1) & mask)
+    {
+        const auto &slot = slots[index];
+        if (slot.index == -1 || (slot.hash == hash && valuesEqual(values[slot.index], value)))
+        {
+            return &slots[index];
+        }
+    }
+}
+
+void ObjSet::growSlots()
+{
+    const auto oldSlots = slots;
+    const auto oldCapacity = slotCapacity;
+    slotCapacity = growCapacity(slotCapacity);
+    slots = growArray<SetSlot>(nullptr, 0, slotCapacity);
+    std::fill_n(slots, slotCapacity, SetSlot{0, -1});
+    const auto mask = slotCapacity - 1;
+    for (auto i = 0; i < oldCapacity; i++)
+    {
+        if (oldSlots[i].index == -1)
+        {
+            continue;
+        }
+
+        auto index = static_cast<int>(oldSlots[i].hash) & mask;
+        while (slots[index].index != -1)
+        {
+            index = (index + 1) & mask;
+        }
+
+        slots[index] = oldSlots[i];
+    }
+
+    freeArray(oldSlots, oldCapacity);
+}
@@ -0,0 +1,570 @@
+#include "../include/optimizer.h"
+
+#include <cmath>
+
+#include "../include/object.h"
+#include "../include/operators.h"
+
+namespace
+{
+    // Bit shifts and modulo go through long, so they are only folded when that conversion is exact.
+    bool isExactInteger(const double value)
+    {
+        return std::abs(value) < 9007199254740992.0;
+    }
+}
+
+Optimizer::Optimizer(Heap &heap, Chunk &chunk, const int level): heap(heap), chunk(chunk), level(level)
+{
+}
+
+void Optimizer::run()
+{
+    const auto instructions = decode();
+    std::vector<int> outputIndices(instructions.size() + 1);
+    for (auto i = 0; i < static_cast<int>(instructions.size()); i++)
+    {
+        outputIndices[i] = static_cast<int>(output.size());
+        emit(instructions[i]);
+    }
+
+    outputIndices[instructions.size()] = static_cast<int>(output.size());
+    encode(outputIndices);
+}
+
+std::vector<Optimizer::Instruction> Optimizer::decode() const
+{
+    std::vector<int> indexAt(chunk.count + 1, -1);
+    std::vector<Instruction> instructions;
+    auto cursor = LineTable::Cursor{chunk.lines};
+    for (auto offset = 0; offset < chunk.count;)
+    {
+        const auto opcode = static_cast<OpCode>(chunk.code[offset]);
+        const auto operandBytes = opcodeInfo(opcode).operandBytes;
+        auto operand = 0;
+        if (operandBytes == 1)
+        {
+            operand = chunk.code[offset + 1];
+        }
+        else if (operandBytes == 2)
+        {
+            operand = readShortOperand(chunk.code + offset + 1);
+        }
+        else if (operandBytes == 3)
+        {
+            operand = readLongOperand(chunk.code + offset + 1);
+        }
+
+        indexAt[offset] = static_cast<int>(instructions.size());
+        instructions.push_back(Instruction{opcode, operand, cursor.seek(offset), false});
+        offset += 1 + operandBytes;
+    }
+
+    indexAt[chunk.count] = static_cast<int>(instructions.size());
+
+    // Jump operands become the index of the instruction they land on.
+    auto offset = 0;
+    for (auto &instruction: instructions)
+    {
+        const auto next = offset + 1 + opcodeInfo(instruction.opcode).operandBytes;
+        if (isJump(instruction.opcode))
+        {
+            const auto target = instruction.opcode == OpCode::OP_LOOP
+                                    ? next - instruction.operand
+                                    : next + instruction.operand;
+            instruction.operand = indexAt[target];
+        }
+
+        offset = next;
+    }
+
+    for (const auto &instruction: instructions)
+    {
+        if (isJump(instruction.opcode) && instruction.operand < static_cast<int>(instructions.size()))
+        {
+            instructions[instruction.operand].jumpTarget = true;
+        }
+    }
+
+    return instructions;
+}
+
+void Optimizer::encode(const std::vector<int> &outputIndices)
+{
+    std::vector<int> offsets(output.size() + 1);
+    auto offset = 0;
+    for (auto i = 0; i < static_cast<int>(output.size()); i++)
+    {
+        offsets[i] = offset;
+        offset += 1 + opcodeInfo(output[i].opcode).operandBytes;
+    }
+
+    offsets[output.size()] = offset;
+
+    auto rewritten = Chunk{chunk.arena};
+    for (auto i = 0; i < static_cast<int>(output.size()); i++)
+    {
+        const auto &[opcode, operand, location, jumpTarget] = output[i];
+        auto value = operand;
+        if (isJump(opcode))
+        {
+            const auto next = offsets[i + 1];
+            const auto target = offsets[outputIndices[operand]];
+            value = opcode == OpCode::OP_LOOP ? next - target : target - next;
+        }
+
+        rewritten.write(static_cast<uint8_t>(opcode), location);
+        for (auto byte = 0; byte < opcodeInfo(opcode).operandBytes; byte++)
+        {
+            rewritten.write(static_cast<uint8_t>(value >> 8 * byte & 0xff), location);
+        }
+    }
+
+    chunk.swapCode(rewritten);
+}
+
+void Optimizer::emit(const Instruction instruction)
+{
+    switch (instruction.opcode)
+    {
+        case OpCode::OP_POP:
+            if (removesDeadPush(instruction) || fusesIncrement(instruction))
+            {
+                return;
+            }
+
+            break;
+        case OpCode::OP_NOT:
+            if (fusesComparison(instruction) || foldsUnary(instruction))
+            {
+                return;
+            }
+
+            break;
+        case OpCode::OP_NEGATE:
+        case OpCode::OP_NUM_NEGATE:
+            if (foldsUnary(instruction))
+            {
+                return;
+            }
+
+            break;
+        case OpCode::OP_JUMP_IF_FALSE:
+            if (fusesCompareJump(instruction))
+            {
+                return;
+            }
+
+            break;
+        case OpCode::OP_ADD:
+            if (foldsBinary(instruction) || fusesGlobalAdd(instruction))
+            {
+                return;
+            }
+
+            break;
+        case OpCode::OP_SUBTRACT:
+        case OpCode::OP_MULTIPLY:
+        case OpCode::OP_DIVIDE:
+        case OpCode::OP_EXPONENT:
+        case OpCode::OP_MODULO:
+        case OpCode::OP_LSHIFT:
+        case OpCode::OP_RSHIFT:
+        case OpCode::OP_EQUAL:
+        case OpCode::OP_NOT_EQUAL:
+        case OpCode::OP_GREATER:
+        case OpCode::OP_GREATER_EQUAL:
+        case OpCode::OP_LESS:
+        case OpCode::OP_LESS_EQUAL:
+        case OpCode::OP_XOR:
+        case OpCode::OP_NUM_ADD:
+        case OpCode::OP_NUM_SUBTRACT:
+        case OpCode::OP_NUM_MULTIPLY:
+        case OpCode::OP_NUM_DIVIDE:
+        case OpCode::OP_NUM_GREATER:
+        case OpCode::OP_NUM_LESS:
+        case OpCode::OP_NUM_GREATER_EQUAL:
+        case OpCode::OP_NUM_LESS_EQUAL:
+            if (foldsBinary(instruction))
+            {
+                return;
+            }
+
+            break;
+        default:
+            break;
+    }
+
+    append(instruction);
+}
+
+void Optimizer::append(Instruction instruction)
+{
+    instruction.jumpTarget = instruction.jumpTarget || pendingJumpTarget;
+    pendingJumpTarget = false;
+    output.push_back(instruction);
+}
+
+// A value that is computed without side effects and immediately popped never needs to be pushed. If the push was a
+// jump target, whatever is emitted next takes over that role.
+bool Optimizer::removesDeadPush(const Instruction &pop)
+{
+    if (isJumpedTo(pop) || output.empty() || !isPurePush(output.back().opcode))
+    {
+        return false;
+    }
+
+    pendingJumpTarget = pendingJumpTarget || output.back().jumpTarget;
+    output.pop_back();
+    return true;
+}
+
+// A comparison on operands proven to be numbers stays unchecked once negated.
+bool Optimizer::fusesComparison(const Instruction &negation)
+{
+    if (isJumpedTo(negation) || output.empty())
+    {
+        return false;
+    }
+
+    auto &comparison = output.back();
+    const auto unchecked = comparison.opcode != checkedForm(comparison.opcode);
+    switch (checkedForm(comparison.opcode))
+    {
+        case OpCode::OP_LESS:
+            comparison.opcode = OpCode::OP_GREATER_EQUAL;
+            break;
+        case OpCode::OP_GREATER:
+            comparison.opcode = OpCode::OP_LESS_EQUAL;
+            break;
+        case OpCode::OP_EQUAL:
+            comparison.opcode = OpCode::OP_NOT_EQUAL;
+            break;
+        default:
+            return false;
+    }
+
+    if (unchecked)
+    {
+        comparison.opcode = numberForm(comparison.opcode);
+    }
+
+    return true;
+}
+
+// Superinstructions replace the sequences that dominate the opcode-pair profile of loops: a comparison feeding a
+// conditional jump, a global plus a constant, and a local incremented by a constant in a statement of its own.
+bool Optimizer::fusesCompareJump(const Instruction &jump)
+{
+    if (isJumpedTo(jump) || output.empty())
+    {
+        return false;
+    }
+
+    auto &comparison = output.back();
+    switch (checkedForm(comparison.opcode))
+    {
+        case OpCode::OP_LESS:
+            comparison.opcode = OpCode::OP_LESS_JUMP;
+            break;
+        case OpCode::OP_LESS_EQUAL:
+            comparison.opcode = OpCode::OP_LESS_EQUAL_JUMP;
+            break;
+        case OpCode::OP_GREATER:
+            comparison.opcode = OpCode::OP_GREATER_JUMP;
+            break;
+        case OpCode::OP_GREATER_EQUAL:
+            comparison.opcode = OpCode::OP_GREATER_EQUAL_JUMP;
+            break;
+        default:
+            return false;
+    }
+
+    comparison.operand = jump.operand;
+    return true;
+}
+
+bool Optimizer::fusesGlobalAdd(const Instruction &addition)
+{
+    const auto size = output.size();
+    if (isJumpedTo(addition) || size < 2 || output[size - 1].jumpTarget
+        || output[size - 2].opcode != OpCode::OP_GET_GLOBAL || output[size - 1].opcode != OpCode::OP_CONSTANT)
+    {
+        return false;
+    }
+
+    const auto constant = output.back().operand;
+    output.pop_back();
+    output.back().opcode = OpCode::OP_GET_GLOBAL_ADD_CONST;
+    output.back().operand = packOperands(output.back().operand, constant);
+    output.back().location = addition.location;
+    return true;
+}
+
+// Matches GET_LOCAL, CONSTANT, ADD or SUBTRACT, SET_LOCAL of the same slot followed by this POP. Subtracting a
+// constant is the same as adding its negation, so both become OP_INCREMENT_LOCAL.
+bool Optimizer::fusesIncrement(const Instruction &pop)
+{
+    const auto size = output.size();
+    if (isJumpedTo(pop) || size < 4)
+    {
+        return false;
+    }
+
+    const auto &get = output[size - 4];
+    const auto &constant = output[size - 3];
+    const auto &operation = output[size - 2];
+    const auto &set = output[size - 1];
+    const auto arithmetic = checkedForm(operation.opcode);
+    if (get.opcode != OpCode::OP_GET_LOCAL || constant.opcode != OpCode::OP_CONSTANT
+        || set.opcode != OpCode::OP_SET_LOCAL || set.operand != get.operand
+        || (arithmetic != OpCode::OP_ADD && arithmetic != OpCode::OP_SUBTRACT)
+        || constant.jumpTarget || operation.jumpTarget || set.jumpTarget)
+    {
+        return false;
+    }
+
+    const auto step = constantValue(constant);
+    if (!step.isNumber())
+    {
+        return false;
+    }
+
+    auto index = constant.operand;
+    if (arithmetic == OpCode::OP_SUBTRACT)
+    {
+        index = chunk.addConstant(Value::number(-step.asNumber()));
+        if (index > UINT8_MAX)
+        {
+            return false;
+        }
+    }
+
+    const auto fused = Instruction{
+        OpCode::OP_INCREMENT_LOCAL, packOperands(get.operand, index), operation.location, get.jumpTarget
+    };
+    output.resize(size - 4);
+    output.push_back(fused);
+    return true;
+}
+
+bool Optimizer::foldsUnary(const Instruction &instruction)
+{
+    if (level < 2 || isJumpedTo(instruction) || output.empty() || !isConstant(output.back()))
+    {
+        return false;
+    }
+
+    const auto result = foldUnary(instruction.opcode, constantValue(output.back()));
+    if (!result.has_value())
+    {
+        return false;
+    }
+
+    const auto jumpTarget = output.back().jumpTarget;
+    output.back() = makeConstant(result.value(), instruction.location, jumpTarget);
+    return true;
+}
+
+bool Optimizer::foldsBinary(const Instruction &instruction)
+{
+    const auto size = output.size();
+    if (level < 2 || isJumpedTo(instruction) || size < 2 || output[size - 1].jumpTarget
+        || !isConstant(output[size - 2]) || !isConstant(output[size - 1]))
+    {
+        return false;
+    }
+
+    const auto result = foldBinary(heap, instruction.opcode, constantValue(output[size - 2]),
+                                   constantValue(output[size - 1]));
+    if (!result.has_value())
+    {
+        return false;
+    }
+
+    const auto jumpTarget = output[size - 2].jumpTarget;
+    output.pop_back();
+    output.back() = makeConstant(result.value(), instruction.location, jumpTarget);
+    return true;
+}
+
+std::optional<Value> Optimizer::foldUnary(const OpCode opcode, const Value operand)
+{
+    if (opcode == OpCode::OP_NOT)
+    {
+        return Value::boolean(isFalsey(operand));
+    }
+
+    if (checkedForm(opcode) == OpCode::OP_NEGATE && operand.isNumber())
+    {
+        return Value::number(-operand.asNumber());
+    }
+
+    return std::nullopt;
+}
+
+std::optional<Value> Optimizer::foldBinary(Heap &heap, const OpCode opcode, const Value left, const Value right)
+{
+    switch (checkedForm(opcode))
+    {
+        case OpCode::OP_EQUAL:
+            return Value::boolean(valuesEqual(left, right));
+        case OpCode::OP_NOT_EQUAL:
+            return Value::boolean(!valuesEqual(left, right));
+        case OpCode::OP_XOR:
+            return Value::boolean(isFalsey(left) != isFalsey(right));
+        case OpCode::OP_ADD:
+            if (isString(left) && isString(right))
+            {
+                return Value::object(heap.concatenate(asString(left), asString(right)));
+            }
+
+            break;
+        default:
+            break;
+    }
+
+    if (!left.isNumber() || !right.isNumber())
+    {
+        return std::nullopt;
+    }
+
+    const auto a = left.asNumber();
+    const auto b = right.asNumber();
+    switch (checkedForm(opcode))
+    {
+        case OpCode::OP_ADD:
+            return operators::add(a, b);
+        case OpCode::OP_SUBTRACT:
+            return operators::subtract(a, b);
+        case OpCode::OP_MULTIPLY:
+            return operators::multiply(a, b);
+        case OpCode::OP_DIVIDE:
+            return operators::divide(a, b);
+        case OpCode::OP_EXPONENT:
+            return operators::exponent(a, b);
+        case OpCode::OP_GREATER:
+            return operators::greater(a, b);
+        case OpCode::OP_GREATER_EQUAL:
+            return operators::greaterEqual(a, b);
+        case OpCode::OP_LESS:
+            return operators::less(a, b);
+        case OpCode::OP_LESS_EQUAL:
+            return operators::lessEqual(a, b);
+        case OpCode::OP_MODULO:
+            if (!isExactInteger(a) || !isExactInteger(b) || static_cast<long>(b) == 0)
+            {
+                return std::nullopt;
+            }
+
+            return operators::modulo(a, b);
+        case OpCode::OP_LSHIFT:
+        case OpCode::OP_RSHIFT:
+            if (!isExactInteger(a) || b < 0 || b >= 64)
+            {
+                return std::nullopt;
+            }
+
+            return opcode == OpCode::OP_LSHIFT ? operators::leftShift(a, b) : operators::rightShift(a, b);
+        default:
+            return std::nullopt;
+    }
+}
+
+bool Optimizer::isConstant(const Instruction &instruction) const
+{
+    switch (instruction.opcode)
+    {
+        case OpCode::OP_CONSTANT:
+        case OpCode::OP_CONSTANT_LONG:
+        case OpCode::OP_NULL:
+        case OpCode::OP_TRUE:
+        case OpCode::OP_FALSE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+Value Optimizer::constantValue(const Instruction &instruction) const
+{
+    switch (instruction.opcode)
+    {
+        case OpCode::OP_TRUE:
+            return Value::boolean(true);
+        case OpCode::OP_FALSE:
+            return Value::boolean(false);
+        case OpCode::OP_CONSTANT:
+        case OpCode::OP_CONSTANT_LONG:
+            return chunk.constants.values[instruction.operand];
+        default:
+            return Value::null();
+    }
+}
+
+Optimizer::Instruction Optimizer::makeConstant(const Value value, const SourceLocation location, const bool jumpTarget)
+{
+    if (value.isNull())
+    {
+        return Instruction{OpCode::OP_NULL, 0, location, jumpTarget};
+    }
+
+    if (value.isBool())
+    {
+        return Instruction{value.asBool() ? OpCode::OP_TRUE : OpCode::OP_FALSE, 0, location, jumpTarget};
+    }
+
+    const auto index = chunk.addConstant(value);
+    const auto opcode = index <= UINT8_MAX ? OpCode::OP_CONSTANT : OpCode::OP_CONSTANT_LONG;
+    return Instruction{opcode, index, location, jumpTarget};
+}
+
+// An instruction some jump lands on, or the one that takes over that role from a removed instruction, starts a new
+// block and is never merged into the instructions before it.
+bool Optimizer::isJumpedTo(const Instruction &instruction) const
+{
+    return instruction.jumpTarget || pendingJumpTarget;
+}
+
+// Superinstructions with two byte operands keep them in one int, first operand in the low byte, so they are encoded
+// like any two-byte operand.
+int Optimizer::packOperands(const int first, const int second)
+{
+    return first | second << 8;
+}
+
+bool Optimizer::isJump(const OpCode opcode)
+{
+    switch (opcode)
+    {
+        case OpCode::OP_LESS_JUMP:
+        case OpCode::OP_LESS_EQUAL_JUMP:
+        case OpCode::OP_GREATER_JUMP:
+        case OpCode::OP_GREATER_EQUAL_JUMP:
+        case OpCode::OP_JUMP:
+        case OpCode::OP_JUMP_IF_FALSE:
+        case OpCode::OP_JUMP_IF_FALSE_OR_POP:
+        case OpCode::OP_JUMP_IF_TRUE_OR_POP:
+        case OpCode::OP_LOOP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Optimizer::isPurePush(const OpCode opcode)
+{
+    switch (opcode)
+    {
+        case OpCode::OP_CONSTANT:
+        case OpCode::OP_CONSTANT_LONG:
+        case OpCode::OP_NULL:
+        case OpCode::OP_TRUE:
+        case OpCode::OP_FALSE:
+        case OpCode::OP_GET_LOCAL:
+        case OpCode::OP_GET_UPVALUE:
+            return true;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,1057 @@
+#include "../include/register_compiler.h"
+
+#include <algorithm>
+#include <format>
+
+#include "../include/token.h"
+
+ObjFunction *RegisterCompiler::compile(const std::string &source)
+{
+    scanner = Scanner{source};
+    parser.panicMode = false;
+    parser.hadError = false;
+
+    auto script = FunctionScope{};
+    current = nullptr;
+    beginRegisterFunction(script, FunctionType::SCRIPT);
+    advance();
+    while (!match(TokenType::FILE_EOF))
+    {
+        declaration();
+    }
+
+    const auto function = endFunction();
+    finishCompilation();
+    return parser.hadError ? nullptr : function;
+}
+
+void RegisterCompiler::beginRegisterFunction(FunctionScope &scope, const FunctionType type)
+{
+    beginFunction(scope, type);
+    scope.nextRegister = scope.localCount;
+    scope.maxRegisters = scope.localCount;
+}
+
+// The register count is what the VM reserves on the value stack for each call, like a stack chunk's maximum depth.
+ObjFunction *RegisterCompiler::endFunction()
+{
+    emitReturn();
+    const auto function = current->function;
+    function->chunk.maxStackDepth = current->maxRegisters;
+    leaveFunction();
+    return function;
+}
+
+void RegisterCompiler::declaration()
+{
+    if (match(TokenType::FUN))
+    {
+        functionDeclaration();
+    }
+    else if (match(TokenType::LET))
+    {
+        variableDeclaration();
+    }
+    else if (match(TokenType::CONST))
+    {
+        constantDeclaration();
+    }
+    else
+    {
+        statement();
+    }
+
+    if (parser.panicMode)
+    {
+        synchronize();
+    }
+}
+
+void RegisterCompiler::functionDeclaration()
+{
+    const auto global = parseVariable("Expect function name.");
+    if (current->scopeDepth > 0)
+    {
+        markInitialized();
+    }
+
+    const auto destination = allocateRegister();
+    function(FunctionType::FUNCTION, destination);
+    defineVariable(global, destination, false);
+}
+
+void RegisterCompiler::function(const FunctionType type, const int destination)
+{
+    auto scope = FunctionScope{};
+    beginRegisterFunction(scope, type);
+    beginScope();
+
+    consume(TokenType::LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(TokenType::RIGHT_PAREN))
+    {
+        do
+        {
+            if (++current->function->arity > UINT8_MAX)
+            {
+                errorAtCurrent("Cannot have more than 255 parameters.");
+            }
+
+            const auto global = parseVariable("Expect parameter name.");
+            defineVariable(global, allocateRegister(), false);
+        } while (match(TokenType::COMMA));
+    }
+
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(TokenType::LEFT_BRACE, "Expect '{' before function body.");
+    block();
+
+    const auto function = endFunction();
+    emit(encodeABx(RegisterOpCode::OP_CLOSURE, destination, makeConstant(Value::object(function))));
+}
+
+void RegisterCompiler::statement()
+{
+    if (match(TokenType::PRINT))
+    {
+        printStatement();
+    }
+    else if (match(TokenType::IF))
+    {
+        ifStatement();
+    }
+    else if (match(TokenType::WHILE))
+    {
+        whileStatement();
+    }
+    else if (match(TokenType::DO))
+    {
+        doWhileStatement();
+    }
+    else if (match(TokenType::FOR))
+    {
+        forStatement();
+    }
+    else if (match(TokenType::BREAK))
+    {
+        breakStatement();
+    }
+    else if (match(TokenType::CONTINUE))
+    {
+        continueStatement();
+    }
+    else if (match(TokenType::RETURN))
+    {
+        returnStatement();
+    }
+    else if (match(TokenType::LEFT_BRACE))
+    {
+        beginScope();
+        block();
+        endScope();
+    }
+    else
+    {
+        expressionStatement();
+    }
+}
+
+// A local's register is allocated before its initializer is compiled, so the value is computed straight into it.
+void RegisterCompiler::variableDeclaration()
+{
+    const auto global = parseVariable("Expect variable name.");
+    const auto destination = allocateRegister();
+    if (match(TokenType::EQUAL))
+    {
+        auto value = expression();
+        freeOperand(value);
+        dischargeTo(value, destination);
+    }
+    else
+    {
+        auto value = constant(Value::null());
+        dischargeTo(value, destination);
+    }
+
+    consume(TokenType::SEMICOLON, "Expect ';' after variable declaration");
+    defineVariable(global, destination, false);
+}
+
+void RegisterCompiler::constantDeclaration()
+{
+    const auto global = parseVariable("Expect variable name.", true);
+    const auto destination = allocateRegister();
+    consume(TokenType::EQUAL, "Expected '=' after constant");
+    auto value = expression();
+    freeOperand(value);
+    dischargeTo(value, destination);
+    consume(TokenType::SEMICOLON, "Expect ';' after constant declaration");
+    defineVariable(global, destination, true);
+}
+
+void RegisterCompiler::defineVariable(const int global, const int source, const bool constant)
+{
+    if (current->scopeDepth > 0)
+    {
+        markInitialized();
+        return;
+    }
+
+    if (global > MAX_BX)
+    {
+        error("Too many global variables.");
+    }
+
+    const auto opcode = constant ? RegisterOpCode::OP_DEFINE_CONSTANT : RegisterOpCode::OP_DEFINE_GLOBAL;
+    emit(encodeABx(opcode, source, global & MAX_BX));
+    freeRegister(source);
+}
+
+void RegisterCompiler::printStatement()
+{
+    auto value = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after value.");
+    emit(encodeABC(RegisterOpCode::OP_PRINT, toAnyRegister(value), 0, 0));
+    freeOperand(value);
+}
+
+void RegisterCompiler::ifStatement()
+{
+    consume(TokenType::LEFT_PAREN, "Expect '(' after if.");
+    auto condition = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after if's condition.");
+
+    const auto thenJump = emitJump(RegisterOpCode::OP_JUMP_IF_FALSE, toAnyRegister(condition));
+    freeOperand(condition);
+    statement();
+    if (match(TokenType::ELSE))
+    {
+        const auto elseJump = emitJump(RegisterOpCode::OP_JUMP, 0);
+        patchJump(thenJump);
+        statement();
+        patchJump(elseJump);
+    }
+    else
+    {
+        patchJump(thenJump);
+    }
+}
+
+void RegisterCompiler::whileStatement()
+{
+    const auto loopStart = currentPosition();
+    consume(TokenType::LEFT_PAREN, "Expect '(' after while.");
+    auto condition = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after while's condition.");
+
+    const auto exitJump = emitJump(RegisterOpCode::OP_JUMP_IF_FALSE, toAnyRegister(condition));
+    freeOperand(condition);
+    auto loop = Loop{current->innermostLoop, current->scopeDepth, loopStart};
+    current->innermostLoop = &loop;
+    statement();
+    emitLoop(loopStart);
+    patchJump(exitJump);
+
+    current->innermostLoop = loop.enclosing;
+    for (const auto jump: loop.breakJumps)
+    {
+        patchJump(jump);
+    }
+}
+
+void RegisterCompiler::doWhileStatement()
+{
+    const auto loopStart = currentPosition();
+    auto loop = Loop{current->innermostLoop, current->scopeDepth, -1};
+    current->innermostLoop = &loop;
+    statement();
+    current->innermostLoop = loop.enclosing;
+
+    for (const auto jump: loop.continueJumps)
+    {
+        patchJump(jump);
+    }
+
+    consume(TokenType::WHILE, "Expect 'while' after do while's statements block.");
+    consume(TokenType::LEFT_PAREN, "Expect '(' after while.");
+    auto condition = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after while's condition.");
+    consume(TokenType::SEMICOLON, "Expect ';' after do while.");
+
+    const auto exitJump = emitJump(RegisterOpCode::OP_JUMP_IF_FALSE, toAnyRegister(condition));
+    freeOperand(condition);
+    emitLoop(loopStart);
+    patchJump(exitJump);
+    for (const auto jump: loop.breakJumps)
+    {
+        patchJump(jump);
+    }
+}
+
+// Laid out like the stack compiler's for loop: the increment precedes the body, which jumps back to it.
+void RegisterCompiler::forStatement()
+{
+    beginScope();
+    consume(TokenType::LEFT_PAREN, "Expect '(' after for.");
+    if (match(TokenType::LET))
+    {
+        variableDeclaration();
+    }
+    else if (!match(TokenType::SEMICOLON))
+    {
+        expressionStatement();
+    }
+
+    auto loopStart = currentPosition();
+    auto exitJump = -1;
+    if (!match(TokenType::SEMICOLON))
+    {
+        auto condition = expression();
+        consume(TokenType::SEMICOLON, "Expect ';' after loop's condition.");
+        exitJump = emitJump(RegisterOpCode::OP_JUMP_IF_FALSE, toAnyRegister(condition));
+        freeOperand(condition);
+    }
+
+    if (!match(TokenType::RIGHT_PAREN))
+    {
+        const auto bodyJump = emitJump(RegisterOpCode::OP_JUMP, 0);
+        const auto incrementStart = currentPosition();
+        auto increment = expression();
+        discard(increment);
+        consume(TokenType::RIGHT_PAREN, "Expect ')' after for clauses.");
+
+        emitLoop(loopStart);
+        loopStart = incrementStart;
+        patchJump(bodyJump);
+    }
+
+    auto loop = Loop{current->innermostLoop, current->scopeDepth, loopStart};
+    current->innermostLoop = &loop;
+    statement();
+    emitLoop(loopStart);
+    current->innermostLoop = loop.enclosing;
+
+    if (exitJump != -1)
+    {
+        patchJump(exitJump);
+    }
+
+    for (const auto jump: loop.breakJumps)
+    {
+        patchJump(jump);
+    }
+
+    endScope();
+}
+
+void RegisterCompiler::breakStatement()
+{
+    consume(TokenType::SEMICOLON, "Expect ';' after break.");
+    if (current->innermostLoop == nullptr)
+    {
+        error("Cannot use 'break' outside of a loop.");
+        return;
+    }
+
+    closeUpvaluesAbove(current->innermostLoop->scopeDepth);
+    current->innermostLoop->breakJumps.push_back(emitJump(RegisterOpCode::OP_JUMP, 0));
+}
+
+void RegisterCompiler::continueStatement()
+{
+    consume(TokenType::SEMICOLON, "Expect ';' after continue.");
+    if (current->innermostLoop == nullptr)
+    {
+        error("Cannot use 'continue' outside of a loop.");
+        return;
+    }
+
+    closeUpvaluesAbove(current->innermostLoop->scopeDepth);
+    if (current->innermostLoop->continueTarget == -1)
+    {
+        current->innermostLoop->continueJumps.push_back(emitJump(RegisterOpCode::OP_JUMP, 0));
+    }
+    else
+    {
+        emitLoop(current->innermostLoop->continueTarget);
+    }
+}
+
+void RegisterCompiler::returnStatement()
+{
+    if (current->type == FunctionType::SCRIPT)
+    {
+        error("Cannot return from top-level code.");
+    }
+
+    if (match(TokenType::SEMICOLON))
+    {
+        emitReturn();
+        return;
+    }
+
+    auto value = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after return value.");
+    emit(encodeABC(RegisterOpCode::OP_RETURN, toAnyRegister(value), 0, 0));
+    freeOperand(value);
+}
+
+void RegisterCompiler::block()
+{
+    while (!check(TokenType::RIGHT_BRACE) && !check(TokenType::FILE_EOF))
+    {
+        declaration();
+    }
+
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
+}
+
+// Locals going out of scope only need their registers back, except captured ones, whose upvalues are closed.
+void RegisterCompiler::endScope()
+{
+    current->scopeDepth--;
+    auto firstCaptured = -1;
+    while (current->localCount > 0 && current->locals[current->localCount - 1].depth > current->scopeDepth)
+    {
+        if (current->locals[current->localCount - 1].captured)
+        {
+            firstCaptured = current->localCount - 1;
+        }
+
+        current->localCount--;
+    }
+
+    if (firstCaptured != -1)
+    {
+        emit(encodeABC(RegisterOpCode::OP_CLOSE_UPVALUES, firstCaptured, 0, 0));
+    }
+
+    current->nextRegister = current->localCount;
+}
+
+void RegisterCompiler::expressionStatement()
+{
+    auto value = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after expression.");
+    discard(value);
+}
+
+RegisterCompiler::Operand RegisterCompiler::expression()
+{
+    return parsePrecedence(Precedence::Assignment);
+}
+
+void RegisterCompiler::number([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    operand = constant(Value::number(std::strtod(parser.previous.lexeme.data(), nullptr)));
+}
+
+void RegisterCompiler::grouping([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    operand = expression();
+    consume(TokenType::RIGHT_PAREN, "Expected ')' after expression.");
+}
+
+void RegisterCompiler::unary([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    const auto operatorType = parser.previous.type;
+    operand = parsePrecedence(Precedence::Unary);
+    const auto source = toRK(operand);
+    freeOperand(operand);
+    const auto opcode = operatorType == TokenType::BANG ? RegisterOpCode::OP_NOT : RegisterOpCode::OP_NEGATE;
+    operand = relocatable(encodeABC(opcode, 0, source, 0));
+}
+
+void RegisterCompiler::binary([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    const auto operatorType = parser.previous.type;
+    const auto precedence = static_cast<Precedence>(static_cast<int>(getRule(operatorType).precedence) + 1);
+    switch (operatorType)
+    {
+        case TokenType::PLUS:
+            arithmetic(operand, RegisterOpCode::OP_ADD, precedence);
+            break;
+        case TokenType::MINUS:
+            arithmetic(operand, RegisterOpCode::OP_SUBTRACT, precedence);
+            break;
+        case TokenType::STAR:
+            arithmetic(operand, RegisterOpCode::OP_MULTIPLY, precedence);
+            break;
+        case TokenType::SLASH:
+            arithmetic(operand, RegisterOpCode::OP_DIVIDE, precedence);
+            break;
+        case TokenType::MODULO:
+            arithmetic(operand, RegisterOpCode::OP_MODULO, precedence);
+            break;
+        case TokenType::EXPONENT:
+            arithmetic(operand, RegisterOpCode::OP_EXPONENT, precedence);
+            break;
+        case TokenType::BANG_EQUAL:
+            arithmetic(operand, RegisterOpCode::OP_NOT_EQUAL, precedence);
+            break;
+        case TokenType::EQUAL_EQUAL:
+            arithmetic(operand, RegisterOpCode::OP_EQUAL, precedence);
+            break;
+        case TokenType::GREATER:
+            arithmetic(operand, RegisterOpCode::OP_GREATER, precedence);
+            break;
+        case TokenType::GREATER_EQUAL:
+            arithmetic(operand, RegisterOpCode::OP_GREATER_EQUAL, precedence);
+            break;
+        case TokenType::LESS:
+            arithmetic(operand, RegisterOpCode::OP_LESS, precedence);
+            break;
+        case TokenType::LESS_EQUAL:
+            arithmetic(operand, RegisterOpCode::OP_LESS_EQUAL, precedence);
+            break;
+        default: break;
+    }
+}
+
+// The left operand is pinned to a register or constant before the right one is compiled, since compiling it emits
+// code that a relocatable left operand would otherwise have to be moved past.
+void RegisterCompiler::arithmetic(Operand &operand, const RegisterOpCode opcode, const Precedence precedence)
+{
+    pinLocal(operand);
+    const auto left = toRK(operand);
+    auto right = parsePrecedence(precedence);
+    const auto rightSource = toRK(right);
+    freeOperand(right);
+    freeOperand(operand);
+    operand = relocatable(encodeABC(opcode, 0, left, rightSource));
+}
+
+// A local read by an instruction is normally used in place, but the stack VM has already pushed its value by the
+// time the next operand runs. When that operand may assign the local, or call a closure that does, the value is
+// copied to a temporary first so the instruction still sees it.
+void RegisterCompiler::pinLocal(Operand &operand)
+{
+    if (operand.kind == Operand::Kind::REGISTER && operand.index < current->localCount && upcomingCodeMayWrite())
+    {
+        dischargeTo(operand, allocateRegister());
+    }
+}
+
+// Scans the tokens ahead for an assignment or a call, up to the end of the enclosing expression. That covers the
+// next operand and possibly more, so the answer errs towards copying, as it does when the expression is too long
+// to scan.
+bool RegisterCompiler::upcomingCodeMayWrite()
+{
+    const auto position = scanner.position();
+    auto previous = parser.previous.type;
+    auto token = parser.current;
+    auto depth = 0;
+    auto mayWrite = true;
+    for (auto scanned = 0; scanned < MAX_LOOKAHEAD; scanned++)
+    {
+        const auto type = token.type;
+        if (type == TokenType::EQUAL || (type == TokenType::LEFT_PAREN
+                                         && (previous == TokenType::IDENTIFIER || previous == TokenType::RIGHT_PAREN
+                                             || previous == TokenType::RIGHT_BRACKET)))
+        {
+            break;
+        }
+
+        if (type == TokenType::LEFT_PAREN || type == TokenType::LEFT_BRACKET)
+        {
+            depth++;
+        }
+        else if (((type == TokenType::RIGHT_PAREN || type == TokenType::RIGHT_BRACKET) && depth-- == 0)
+                 || (type == TokenType::COMMA && depth == 0) || type == TokenType::SEMICOLON
+                 || type == TokenType::LEFT_BRACE || type == TokenType::RIGHT_BRACE || type == TokenType::FILE_EOF
+                 || type == TokenType::ERROR)
+        {
+            mayWrite = false;
+            break;
+        }
+
+        previous = type;
+        token = scanner.scanToken();
+    }
+
+    scanner.rewind(position);
+    return mayWrite;
+}
+
+// The callee and its arguments are placed in consecutive registers, which become the callee's frame. The result
+// is returned in the callee's register.
+void RegisterCompiler::call([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    const auto base = toNextRegister(operand);
+    auto argCount = 0;
+    if (!check(TokenType::RIGHT_PAREN))
+    {
+        do
+        {
+            auto argument = expression();
+            toNextRegister(argument);
+            if (argCount == UINT8_MAX)
+            {
+                error("Cannot have more than 255 arguments.");
+            }
+
+            argCount++;
+        } while (match(TokenType::COMMA));
+    }
+
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
+    emit(encodeABC(RegisterOpCode::OP_CALL, base, argCount & UINT8_MAX, 0));
+    current->nextRegister = base + 1;
+    operand = Operand{Operand::Kind::REGISTER, base};
+}
+
+// The elements are placed in consecutive registers like a call's arguments, and the array replaces the first. A long
+// literal is built in batches, each appended from the registers following the array, so that it never needs more
+// than a batch of registers.
+void RegisterCompiler::arrayLiteral([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    const auto base = current->nextRegister;
+    auto count = 0;
+    auto batch = 0;
+    const auto flush = [&]
+    {
+        const auto opcode = count == batch ? RegisterOpCode::OP_ARRAY : RegisterOpCode::OP_ARRAY_APPEND;
+        emit(encodeABC(opcode, base, batch, 0));
+        current->nextRegister = base + 1;
+        batch = 0;
+    };
+    if (!check(TokenType::RIGHT_BRACKET))
+    {
+        do
+        {
+            auto element = expression();
+            toNextRegister(element);
+            if (count == MAX_LONG_OPERAND)
+            {
+                error("Cannot have more than 16777215 elements in an array literal.");
+            }
+
+            count++;
+            if (++batch == ARRAY_BATCH_SIZE)
+            {
+                flush();
+            }
+        } while (match(TokenType::COMMA));
+    }
+
+    consume(TokenType::RIGHT_BRACKET, "Expect ']' after array elements.");
+    if (count == 0 || batch > 0)
+    {
+        flush();
+    }
+
+    current->nextRegister = base;
+    const auto result = allocateRegister();
+    operand = Operand{Operand::Kind::REGISTER, result};
+}
+
+// An assigned element leaves the assigned value as the result. A value computed into a temporary is moved down to
+// the lowest register freed by the store, so temporaries are still released in stack order.
+void RegisterCompiler::subscript(const bool canAssign, Operand &operand)
+{
+    pinLocal(operand);
+    auto target = toAnyRegister(operand);
+    auto index = expression();
+    const auto indexSource = toRK(index);
+    consume(TokenType::RIGHT_BRACKET, "Expect ']' after index.");
+    if (canAssign && match(TokenType::EQUAL))
+    {
+        pinLocal(operand);
+        target = operand.index;
+        auto value = expression();
+        const auto valueSource = toRK(value);
+        emit(encodeABC(RegisterOpCode::OP_INDEX_SET, target, indexSource, valueSource));
+        freeOperand(value);
+        freeOperand(index);
+        freeOperand(operand);
+        if (value.kind == Operand::Kind::REGISTER && value.index >= current->localCount)
+        {
+            dischargeTo(value, allocateRegister());
+        }
+
+        operand = value;
+        return;
+    }
+
+    freeOperand(index);
+    freeOperand(operand);
+    operand = relocatable(encodeABC(RegisterOpCode::OP_INDEX_GET, 0, target, indexSource));
+}
+
+void RegisterCompiler::dot([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    consume(TokenType::IDENTIFIER, "Expect property name after '.'.");
+    const auto receiver = toAnyRegister(operand);
+    auto name = constant(Value::object(heap.copyString(parser.previous.lexeme)));
+    const auto nameSource = toRK(name);
+    freeOperand(name);
+    freeOperand(operand);
+    operand = relocatable(encodeABC(RegisterOpCode::OP_GET_PROPERTY, 0, receiver, nameSource));
+}
+
+void RegisterCompiler::logicalAnd([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    shortCircuit(operand, RegisterOpCode::OP_JUMP_IF_FALSE, Precedence::And, false);
+}
+
+void RegisterCompiler::logicalOr([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    shortCircuit(operand, RegisterOpCode::OP_JUMP_IF_TRUE, Precedence::Or, false);
+}
+
+void RegisterCompiler::logicalXor([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    arithmetic(operand, RegisterOpCode::OP_XOR, static_cast<Precedence>(static_cast<int>(Precedence::Xor) + 1));
+}
+
+void RegisterCompiler::logicalNand([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    shortCircuit(operand, RegisterOpCode::OP_JUMP_IF_FALSE,
+                 static_cast<Precedence>(static_cast<int>(Precedence::Nand) + 1), true);
+}
+
+void RegisterCompiler::logicalNor([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    shortCircuit(operand, RegisterOpCode::OP_JUMP_IF_TRUE,
+                 static_cast<Precedence>(static_cast<int>(Precedence::Nor) + 1), true);
+}
+
+// Both operands of and/or end up in the same register: the left one stays there when it decides the result,
+// otherwise the right one overwrites it.
+void RegisterCompiler::shortCircuit(Operand &operand, const RegisterOpCode jump, const Precedence precedence,
+                                    const bool negate)
+{
+    const auto target = toNextRegister(operand);
+    const auto endJump = emitJump(jump, target);
+    auto right = parsePrecedence(precedence);
+    freeOperand(right);
+    dischargeTo(right, target);
+    patchJump(endJump);
+    if (negate)
+    {
+        emit(encodeABC(RegisterOpCode::OP_NOT, target, target, 0));
+    }
+
+    operand = Operand{Operand::Kind::REGISTER, target};
+}
+
+void RegisterCompiler::literal([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    switch (parser.previous.type)
+    {
+        case TokenType::FALSE:
+            operand = constant(Value::boolean(false));
+            break;
+        case TokenType::TRUE:
+            operand = constant(Value::boolean(true));
+            break;
+        default:
+            operand = constant(Value::null());
+            break;
+    }
+}
+
+void RegisterCompiler::string([[maybe_unused]] bool canAssign, Operand &operand)
+{
+    const auto content = parser.previous.lexeme.substr(1, parser.previous.lexeme.length() - 2);
+    operand = constant(Value::object(heap.copyString(content)));
+}
+
+void RegisterCompiler::variable(const bool canAssign, Operand &operand)
+{
+    // Copied, since compiling an assigned value moves parser.previous past the name.
+    const auto name = parser.previous;
+    namedVariable(name, canAssign, operand);
+}
+
+// Assignments to locals and upvalues go through checked instructions rather than writing into the variable's
+// register, since the VM has to enforce that a variable keeps its type.
+void RegisterCompiler::namedVariable(const Token &name, const bool canAssign, Operand &operand)
+{
+    if (const auto slot = resolveLocal(current, name); slot != -1)
+    {
+        if (canAssign && match(TokenType::EQUAL))
+        {
+            if (current->locals[slot].constant)
+            {
+                error(std::format("Constant {} cannot be reassigned.", name.lexeme));
+            }
+
+            auto value = expression();
+            const auto source = toRK(value);
+            freeOperand(value);
+            emit(encodeABC(RegisterOpCode::OP_SET_LOCAL, slot, source, 0));
+        }
+
+        operand = Operand{Operand::Kind::REGISTER, slot};
+        return;
+    }
+
+    if (const auto slot = resolveUpvalue(current, name); slot != -1)
+    {
+        if (canAssign && match(TokenType::EQUAL))
+        {
+            if (current->function->upvalues[slot].constant)
+            {
+                error(std::format("Constant {} cannot be reassigned.", name.lexeme));
+            }
+
+            operand = expression();
+            emit(encodeABC(RegisterOpCode::OP_SET_UPVALUE, slot, toRK(operand), 0));
+        }
+        else
+        {
+            operand = relocatable(encodeABC(RegisterOpCode::OP_GET_UPVALUE, 0, slot, 0));
+        }
+
+        return;
+    }
+
+    const auto global = registerGlobalSlot(name);
+    if (canAssign && match(TokenType::EQUAL))
+    {
+        operand = expression();
+        emit(encodeABx(RegisterOpCode::OP_SET_GLOBAL, toAnyRegister(operand), global));
+    }
+    else
+    {
+        operand = relocatable(encodeABx(RegisterOpCode::OP_GET_GLOBAL, 0, global));
+    }
+}
+
+RegisterCompiler::Operand RegisterCompiler::parsePrecedence(const Precedence precedence)
+{
+    auto operand = Operand{Operand::Kind::CONSTANT, 0};
+    advance();
+    const auto prefixRule = getRule(parser.previous.type).prefix;
+    if (prefixRule == nullptr)
+    {
+        error("Expected expression.");
+        return constant(Value::null());
+    }
+
+    const auto canAssign = precedence <= Precedence::Assignment;
+    (this->*prefixRule)(canAssign, operand);
+    while (precedence <= getRule(parser.current.type).precedence)
+    {
+        advance();
+        const auto infixRule = getRule(parser.previous.type).infix;
+        (this->*infixRule)(canAssign, operand);
+    }
+
+    if (canAssign && match(TokenType::EQUAL))
+    {
+        error("Invalid assignment target.");
+    }
+
+    return operand;
+}
+
+int RegisterCompiler::allocateRegister()
+{
+    if (current->nextRegister == MAX_REGISTERS)
+    {
+        error("Too many registers in function.");
+        return MAX_REGISTERS - 1;
+    }
+
+    const auto reg = current->nextRegister++;
+    current->maxRegisters = std::max(current->maxRegisters, current->nextRegister);
+    return reg;
+}
+
+// Only temporaries are freed; registers below localCount belong to locals.
+void RegisterCompiler::freeRegister(const int reg)
+{
+    if (reg >= current->localCount && current->nextRegister > current->localCount)
+    {
+        current->nextRegister--;
+    }
+}
+
+void RegisterCompiler::freeOperand(const Operand &operand)
+{
+    if (operand.kind == Operand::Kind::REGISTER)
+    {
+        freeRegister(operand.index);
+    }
+}
+
+void RegisterCompiler::dischargeTo(Operand &operand, const int reg)
+{
+    switch (operand.kind)
+    {
+        case Operand::Kind::CONSTANT:
+            emit(encodeABx(RegisterOpCode::OP_LOAD_CONSTANT, reg, operand.index));
+            break;
+        case Operand::Kind::RELOCATABLE:
+        {
+            const auto code = currentChunk()->code + operand.index * INSTRUCTION_SIZE;
+            writeInstruction(code, withA(readInstruction(code), reg));
+            break;
+        }
+        case Operand::Kind::REGISTER:
+            if (operand.index != reg)
+            {
+                emit(encodeABC(RegisterOpCode::OP_MOVE, reg, operand.index, 0));
+            }
+
+            break;
+    }
+
+    operand = Operand{Operand::Kind::REGISTER, reg};
+}
+
+int RegisterCompiler::toAnyRegister(Operand &operand)
+{
+    if (operand.kind != Operand::Kind::REGISTER)
+    {
+        dischargeTo(operand, allocateRegister());
+    }
+
+    return operand.index;
+}
+
+// Moves the operand into the next free register, reusing the operand's own register when it is the topmost
+// temporary.
+int RegisterCompiler::toNextRegister(Operand &operand)
+{
+    freeOperand(operand);
+    const auto reg = allocateRegister();
+    dischargeTo(operand, reg);
+    return reg;
+}
+
+int RegisterCompiler::toRK(Operand &operand)
+{
+    if (operand.kind == Operand::Kind::CONSTANT && operand.index <= MAX_RK_CONSTANT)
+    {
+        return operand.index | RK_CONSTANT;
+    }
+
+    return toAnyRegister(operand);
+}
+
+// An expression statement still has to run its instruction, for its side effects and errors, so a relocatable
+// result gets a register before being dropped.
+void RegisterCompiler::discard(Operand &operand)
+{
+    if (operand.kind == Operand::Kind::RELOCATABLE)
+    {
+        toAnyRegister(operand);
+    }
+
+    freeOperand(operand);
+}
+
+RegisterCompiler::Operand RegisterCompiler::constant(const Value value)
+{
+    return Operand{Operand::Kind::CONSTANT, makeConstant(value)};
+}
+
+RegisterCompiler::Operand RegisterCompiler::relocatable(const uint32_t instruction)
+{
+    return Operand{Operand::Kind::RELOCATABLE, emit(instruction)};
+}
+
+int RegisterCompiler::emit(const uint32_t instruction)
+{
+    const auto position = currentPosition();
+    const SourceLocation location{parser.previous.line, parser.previous.column};
+    for (auto i = 0; i < INSTRUCTION_SIZE; i++)
+    {
+        currentChunk()->write(static_cast<uint8_t>(instruction >> 8 * i & 0xff), location);
+    }
+
+    return position;
+}
+
+int RegisterCompiler::currentPosition() const
+{
+    return currentChunk()->count / INSTRUCTION_SIZE;
+}
+
+int RegisterCompiler::emitJump(const RegisterOpCode opcode, const int reg)
+{
+    return emit(encodeAsBx(opcode, reg, 0));
+}
+
+void RegisterCompiler::patchJump(const int position)
+{
+    const auto jump = currentPosition() - position - 1;
+    if (jump > MAX_SBX)
+    {
+        error("Too much code to jump over.");
+        return;
+    }
+
+    const auto code = currentChunk()->code + position * INSTRUCTION_SIZE;
+    const auto instruction = readInstruction(code);
+    writeInstruction(code, encodeAsBx(decodeOpcode(instruction), decodeA(instruction), jump));
+}
+
+void RegisterCompiler::emitLoop(const int loopStart)
+{
+    const auto jump = loopStart - currentPosition() - 1;
+    if (-jump > MAX_SBX)
+    {
+        error("Loop body too large.");
+        return;
+    }
+
+    emit(encodeAsBx(RegisterOpCode::OP_JUMP, 0, jump));
+}
+
+// The register counterpart of popping the locals a break or continue jumps out of: their registers need no
+// cleanup, but upvalues capturing them must be closed.
+void RegisterCompiler::closeUpvaluesAbove(const int depth)
+{
+    auto firstCaptured = -1;
+    for (auto i = current->localCount - 1; i >= 0 && current->locals[i].depth > depth; i--)
+    {
+        if (current->locals[i].captured)
+        {
+            firstCaptured = i;
+        }
+    }
+
+    if (firstCaptured != -1)
+    {
+        emit(encodeABC(RegisterOpCode::OP_CLOSE_UPVALUES, firstCaptured, 0, 0));
+    }
+}
+
+void RegisterCompiler::emitReturn()
+{
+    auto value = constant(Value::null());
+    emit(encodeABC(RegisterOpCode::OP_RETURN, toAnyRegister(value), 0, 0));
+    freeOperand(value);
+}
+
+int RegisterCompiler::makeConstant(const Value value)
+{
+    const auto constant = currentChunk()->addConstant(value);
+    if (constant > MAX_BX)
+    {
+        error("Too many constants in one chunk.");
+        return 0;
+    }
+
+    return constant;
+}
+
+int RegisterCompiler::registerGlobalSlot(const Token &name)
+{
+    const auto slot = globalSlot(name);
+    if (slot > MAX_BX)
+    {
+        error("Too many global variables.");
+        return 0;
+    }
+
+    return slot;
+}
+
+RegisterCompiler::Rule RegisterCompiler::getRule(const TokenType type) const
+{
+    return rules[static_cast<uint8_t>(type)];
+}
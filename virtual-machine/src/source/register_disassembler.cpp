@@ -0,0 +1,75 @@
+#include "../include/register_disassembler.h"
+
+#include <iostream>
+
+#include "../include/register_opcode.h"
+#include "../include/util.h"
+
+namespace
+{
+    void printRK(const Chunk &chunk, const int operand)
+    {
+        if (operand & RK_CONSTANT)
+        {
+            std::cout << "K" << (operand & MAX_RK_CONSTANT) << "(";
+            util::printValue(chunk.constants.values[operand & MAX_RK_CONSTANT]);
+            std::cout << ")";
+        }
+        else
+        {
+            std::cout << "R" << operand;
+        }
+    }
+
+    void printInstruction(const Chunk &chunk, const int position, const uint32_t instruction)
+    {
+        const auto &[name, shape] = registerOpcodeInfo(decodeOpcode(instruction));
+        std::cout << name << " ";
+        switch (shape)
+        {
+            case OperandShape::A:
+                std::cout << "R" << decodeA(instruction);
+                break;
+            case OperandShape::AB:
+                std::cout << "R" << decodeA(instruction) << " " << decodeB(instruction);
+                break;
+            case OperandShape::ARK:
+                std::cout << "R" << decodeA(instruction) << " ";
+                printRK(chunk, decodeB(instruction));
+                break;
+            case OperandShape::ABC:
+                std::cout << "R" << decodeA(instruction) << " ";
+                printRK(chunk, decodeB(instruction));
+                std::cout << " ";
+                printRK(chunk, decodeC(instruction));
+                break;
+            case OperandShape::ABx:
+                std::cout << "R" << decodeA(instruction) << " " << decodeBx(instruction);
+                break;
+            case OperandShape::sBx:
+                std::cout << "(" << position << " -> " << position + 1 + decodeSBx(instruction) << ")";
+                break;
+            case OperandShape::AsBx:
+                std::cout << "R" << decodeA(instruction) << " (" << position << " -> "
+                        << position + 1 + decodeSBx(instruction) << ")";
+                break;
+        }
+
+        std::cout << "\n";
+    }
+}
+
+// Positions are instruction indices rather than byte offsets, matching how jumps are encoded.
+void disassembleRegisterChunk(const Chunk &chunk, const std::string &name)
+{
+    std::cout << "======== " << name << " ========\n";
+    auto cursor = LineTable::Cursor{chunk.lines};
+    auto previousLine = 0;
+    for (auto offset = 0; offset < chunk.count; offset += INSTRUCTION_SIZE)
+    {
+        const auto location = cursor.seek(offset);
+        Chunk::printLocation(offset / INSTRUCTION_SIZE, location, location.line == previousLine);
+        previousLine = location.line;
+        printInstruction(chunk, offset / INSTRUCTION_SIZE, readInstruction(chunk.code + offset));
+    }
+}
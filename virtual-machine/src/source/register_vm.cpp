@@ -0,0 +1,764 @@
+#include "../include/register_vm.h"
+
+#include <algorithm>
+#include <format>
+#include <iostream>
+
+#include "../include/operators.h"
+#include "../include/register_disassembler.h"
+#include "../include/util.h"
+
+#ifdef YAUPL_TRACING
+#define VM_TRACE() if constexpr (Traced) { traceInstruction(); }
+#else
+#define VM_TRACE()
+#endif
+
+// The same dispatch scheme as VM::execute, except that every handler starts with the whole instruction word
+// already fetched into `instruction`.
+#ifdef YAUPL_COMPUTED_GOTO
+#define VM_LABEL(opcode) label_##opcode
+#define VM_DISPATCH() do { VM_TRACE(); instruction = fetch(); goto *dispatchTable[static_cast<uint8_t>(decodeOpcode(instruction))]; } while (false)
+#define VM_LOOP_BEGIN VM_DISPATCH(); {
+#define VM_LOOP_END }
+#define VM_CASE(opcode) VM_LABEL(opcode):
+#define VM_UNKNOWN VM_LABEL(UNKNOWN):
+#define VM_NEXT() VM_DISPATCH()
+#else
+#define VM_LOOP_BEGIN for (;;) { VM_TRACE(); instruction = fetch(); switch (decodeOpcode(instruction)) {
+#define VM_LOOP_END } }
+#define VM_CASE(opcode) case RegisterOpCode::opcode:
+#define VM_UNKNOWN default:
+#define VM_NEXT() continue
+#endif
+
+using namespace operators;
+
+RegisterVM::~RegisterVM()
+{
+    heap.removeRoots(this);
+    freeArray(stack, stackCapacity);
+}
+
+void RegisterVM::markRoots(Heap &heap)
+{
+    for (auto slot = stack; slot < stackTop; slot++)
+    {
+        heap.markValue(*slot);
+    }
+
+    for (auto i = 0; i < frameCount; i++)
+    {
+        heap.markObject(frames[i].closure);
+    }
+
+    for (auto upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen)
+    {
+        heap.markObject(upvalue);
+    }
+
+    env.markRoots(heap);
+}
+
+namespace
+{
+    void disassembleFunction(const ObjFunction *function)
+    {
+        disassembleRegisterChunk(function->chunk,
+                                 function->name == nullptr ? "script" : std::string{function->name->view()});
+        for (auto i = 0; i < function->chunk.constants.count; i++)
+        {
+            if (const auto constant = function->chunk.constants.values[i]; isObjType(constant, ObjType::FUNCTION))
+            {
+                disassembleFunction(asFunction(constant));
+            }
+        }
+    }
+}
+
+InterpretResult RegisterVM::interpret(const std::string &source)
+{
+    const auto function = compiler.compile(source);
+    if (function == nullptr)
+    {
+        return InterpretResult::COMPILE_ERROR;
+    }
+
+    if (dumpBytecode)
+    {
+        disassembleFunction(function);
+    }
+
+    resetStack();
+    stack[0] = Value::object(function);
+    stackTop = stack + 1;
+    const auto closure = heap.newClosure(function);
+    stack[0] = Value::object(closure);
+    auto const result = call(closure, stack, 0) ? run() : InterpretResult::RUNTIME_ERROR;
+    if (tracer != nullptr)
+    {
+        tracer->flush();
+    }
+
+    return result;
+}
+
+InterpretResult RegisterVM::run()
+{
+#ifdef YAUPL_TRACING
+    if (tracer != nullptr)
+    {
+        return execute<true>();
+    }
+#endif
+
+    return execute<false>();
+}
+
+// registers is a copy of frame->slots, reloaded whenever the frame changes or a call may have moved the stack.
+template<bool Traced>
+InterpretResult RegisterVM::execute()
+{
+    uint32_t instruction;
+    auto registers = frame->slots;
+#ifdef YAUPL_COMPUTED_GOTO
+    void *dispatchTable[1 << 6];
+    std::fill_n(dispatchTable, 1 << 6, &&VM_LABEL(UNKNOWN));
+#define VM_REGISTER_LABEL(opcode, shape) dispatchTable[static_cast<uint8_t>(RegisterOpCode::opcode)] = &&VM_LABEL(opcode);
+    YAUPL_REGISTER_OPCODES(VM_REGISTER_LABEL)
+#undef VM_REGISTER_LABEL
+#endif
+
+    VM_LOOP_BEGIN
+        VM_CASE(OP_MOVE)
+        {
+            registers[decodeA(instruction)] = registers[decodeB(instruction)];
+            VM_NEXT();
+        }
+        VM_CASE(OP_LOAD_CONSTANT)
+        {
+            registers[decodeA(instruction)] = chunk->constants.values[decodeBx(instruction)];
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_GLOBAL)
+        {
+            if (!getGlobal(decodeBx(instruction), registers[decodeA(instruction)]))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_SET_GLOBAL)
+        {
+            if (!setGlobal(decodeBx(instruction), registers[decodeA(instruction)]))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_DEFINE_GLOBAL)
+        {
+            if (!defineGlobal(decodeBx(instruction), registers[decodeA(instruction)], false))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_DEFINE_CONSTANT)
+        {
+            if (!defineGlobal(decodeBx(instruction), registers[decodeA(instruction)], true))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_SET_LOCAL)
+        {
+            const auto slot = decodeA(instruction);
+            auto &local = registers[slot];
+            const auto value = rk(registers, decodeB(instruction));
+            if (!isAssignable(typeOf(local), typeOf(value)))
+            {
+                const auto offset = static_cast<int>(instructionPointer - chunk->code - INSTRUCTION_SIZE);
+                runtimeError(std::format("Type mismatch for variable {}.", chunk->localName(offset, slot)));
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            local = value;
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_UPVALUE)
+        {
+            registers[decodeA(instruction)] = *frame->closure->upvalues[decodeB(instruction)]->location;
+            VM_NEXT();
+        }
+        VM_CASE(OP_SET_UPVALUE)
+        {
+            const auto upvalue = frame->closure->upvalues[decodeA(instruction)];
+            const auto value = rk(registers, decodeB(instruction));
+            if (!isAssignable(typeOf(*upvalue->location), typeOf(value)))
+            {
+                runtimeError("Type mismatch for captured variable.");
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            *upvalue->location = value;
+            heap.writeBarrier(upvalue, value);
+            VM_NEXT();
+        }
+        VM_CASE(OP_CLOSE_UPVALUES)
+        {
+            closeUpvalues(registers + decodeA(instruction));
+            VM_NEXT();
+        }
+        VM_CASE(OP_ADD)
+        {
+            const auto b = rk(registers, decodeB(instruction));
+            const auto c = rk(registers, decodeC(instruction));
+            if (b.isNumber() && c.isNumber())
+            {
+                registers[decodeA(instruction)] = add(b.asNumber(), c.asNumber());
+                VM_NEXT();
+            }
+
+            if (isString(b) && isString(c))
+            {
+                registers[decodeA(instruction)] = Value::object(heap.concatenate(asString(b), asString(c)));
+                VM_NEXT();
+            }
+
+            runtimeError("Operands must be numbers.");
+            return InterpretResult::RUNTIME_ERROR;
+        }
+        VM_CASE(OP_SUBTRACT)
+        {
+            if (!arithmetic(registers, instruction, subtract))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_MULTIPLY)
+        {
+            if (!arithmetic(registers, instruction, multiply))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_DIVIDE)
+        {
+            if (!arithmetic(registers, instruction, divide))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_EXPONENT)
+        {
+            if (!arithmetic(registers, instruction, exponent))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_MODULO)
+        {
+            if (!arithmetic(registers, instruction, modulo))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_EQUAL)
+        {
+            const auto equal = valuesEqual(rk(registers, decodeB(instruction)), rk(registers, decodeC(instruction)));
+            registers[decodeA(instruction)] = Value::boolean(equal);
+            VM_NEXT();
+        }
+        VM_CASE(OP_NOT_EQUAL)
+        {
+            const auto equal = valuesEqual(rk(registers, decodeB(instruction)), rk(registers, decodeC(instruction)));
+            registers[decodeA(instruction)] = Value::boolean(!equal);
+            VM_NEXT();
+        }
+        VM_CASE(OP_LESS)
+        {
+            if (!arithmetic(registers, instruction, less))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_LESS_EQUAL)
+        {
+            if (!arithmetic(registers, instruction, lessEqual))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_GREATER)
+        {
+            if (!arithmetic(registers, instruction, greater))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_GREATER_EQUAL)
+        {
+            if (!arithmetic(registers, instruction, greaterEqual))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_XOR)
+        {
+            const auto b = rk(registers, decodeB(instruction));
+            const auto c = rk(registers, decodeC(instruction));
+            registers[decodeA(instruction)] = Value::boolean(isFalsey(b) != isFalsey(c));
+            VM_NEXT();
+        }
+        VM_CASE(OP_NEGATE)
+        {
+            const auto operand = rk(registers, decodeB(instruction));
+            if (!operand.isNumber())
+            {
+                runtimeError("Operand must be a number.");
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            registers[decodeA(instruction)] = Value::number(-operand.asNumber());
+            VM_NEXT();
+        }
+        VM_CASE(OP_NOT)
+        {
+            registers[decodeA(instruction)] = Value::boolean(isFalsey(rk(registers, decodeB(instruction))));
+            VM_NEXT();
+        }
+        VM_CASE(OP_JUMP)
+        {
+            instructionPointer += decodeSBx(instruction) * INSTRUCTION_SIZE;
+            VM_NEXT();
+        }
+        VM_CASE(OP_JUMP_IF_FALSE)
+        {
+            if (isFalsey(registers[decodeA(instruction)]))
+            {
+                instructionPointer += decodeSBx(instruction) * INSTRUCTION_SIZE;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_JUMP_IF_TRUE)
+        {
+            if (!isFalsey(registers[decodeA(instruction)]))
+            {
+                instructionPointer += decodeSBx(instruction) * INSTRUCTION_SIZE;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_CALL)
+        {
+            const auto base = registers + decodeA(instruction);
+            if (!callValue(*base, base, decodeB(instruction)))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            registers = frame->slots;
+            VM_NEXT();
+        }
+        VM_CASE(OP_CLOSURE)
+        {
+            const auto function = asFunction(chunk->constants.values[decodeBx(instruction)]);
+            makeClosure(function, registers[decodeA(instruction)]);
+            VM_NEXT();
+        }
+        VM_CASE(OP_PRINT)
+        {
+            util::printValue(registers[decodeA(instruction)]);
+            std::cout << "\n";
+            VM_NEXT();
+        }
+        VM_CASE(OP_RETURN)
+        {
+            const auto result = registers[decodeA(instruction)];
+            if (frameCount == 1)
+            {
+                resetStack();
+                return InterpretResult::OK;
+            }
+
+            closeUpvalues(frame->slots);
+            frame->slots[0] = result;
+            frameCount--;
+            frame = &frames[frameCount - 1];
+            chunk = &frame->closure->function->chunk;
+            instructionPointer = frame->ip;
+            stackTop = frame->slots + chunk->maxStackDepth;
+            if (tracer != nullptr)
+            {
+                traceCursor.emplace(chunk->lines);
+            }
+
+            registers = frame->slots;
+            VM_NEXT();
+        }
+        VM_CASE(OP_ARRAY)
+        {
+            const auto base = decodeA(instruction);
+            const auto count = decodeB(instruction);
+            const auto array = heap.newArray(count);
+            std::copy_n(registers + base, count, array->values);
+            registers[base] = Value::object(array);
+            VM_NEXT();
+        }
+        VM_CASE(OP_ARRAY_APPEND)
+        {
+            const auto base = decodeA(instruction);
+            const auto count = decodeB(instruction);
+            const auto array = asSequence(registers[base]);
+            array->values = growArray(array->values, array->count, array->count + count);
+            for (auto i = 1; i <= count; i++)
+            {
+                array->values[array->count++] = registers[base + i];
+                heap.writeBarrier(array, registers[base + i]);
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_INDEX_GET)
+        {
+            const auto target = rk(registers, decodeB(instruction));
+            if (!builtins.getIndex(target, rk(registers, decodeC(instruction)), registers[decodeA(instruction)]))
+            {
+                runtimeError(builtins.error());
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_INDEX_SET)
+        {
+            const auto index = rk(registers, decodeB(instruction));
+            if (!builtins.setIndex(registers[decodeA(instruction)], index, rk(registers, decodeC(instruction))))
+            {
+                runtimeError(builtins.error());
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_PROPERTY)
+        {
+            const auto receiver = rk(registers, decodeB(instruction));
+            const auto name = asString(rk(registers, decodeC(instruction)));
+            if (!builtins.getProperty(receiver, name, registers[decodeA(instruction)]))
+            {
+                runtimeError(builtins.error());
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_UNKNOWN
+        {
+            runtimeError(std::format("Unknown opcode {}.", static_cast<int>(decodeOpcode(instruction))));
+            return InterpretResult::RUNTIME_ERROR;
+        }
+    VM_LOOP_END
+}
+
+void RegisterVM::traceInstruction()
+{
+    const auto offset = instructionPointer - chunk->code;
+    const auto line = traceCursor->seek(static_cast<int>(offset)).line;
+    const auto opcode = decodeOpcode(readInstruction(instructionPointer));
+    tracer->record(offset, registerOpcodeInfo(opcode).name, stackTop - stack, line);
+}
+
+void RegisterVM::resetStack()
+{
+    closeUpvalues(stack);
+    stackTop = stack;
+    frameCount = 0;
+    frame = nullptr;
+}
+
+bool RegisterVM::reserveStack(const int slots)
+{
+    if (slots > stackLimit)
+    {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    if (slots <= stackCapacity)
+    {
+        return true;
+    }
+
+    const auto oldStack = stack;
+    const auto oldCapacity = stackCapacity;
+    stackCapacity = std::min(std::max(growCapacity(oldCapacity), slots), stackLimit);
+    stack = growArray(stack, oldCapacity, stackCapacity);
+
+    // Only offsets are taken from the old pointers, the old block itself is never read again.
+    const auto rebase = [&](const Value *pointer)
+    {
+        return stack + (reinterpret_cast<uintptr_t>(pointer) - reinterpret_cast<uintptr_t>(oldStack)) / sizeof(Value);
+    };
+
+    stackTop = rebase(stackTop);
+    for (auto i = 0; i < frameCount; i++)
+    {
+        frames[i].slots = rebase(frames[i].slots);
+    }
+
+    for (auto upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen)
+    {
+        upvalue->location = rebase(upvalue->location);
+    }
+
+    return true;
+}
+
+bool RegisterVM::callValue(const Value callee, Value *base, const int argCount)
+{
+    if (isClosure(callee))
+    {
+        return call(asClosure(callee), base, argCount);
+    }
+
+    if (isNative(callee))
+    {
+        if (!builtins.callNative(callee, base, argCount))
+        {
+            runtimeError(builtins.error());
+            return false;
+        }
+
+        return true;
+    }
+
+    runtimeError("Can only call functions.");
+    return false;
+}
+
+// The callee's registers above its arguments are cleared, so no register ever holds a value left over from an
+// earlier call.
+bool RegisterVM::call(ObjClosure *closure, Value *base, const int argCount)
+{
+    const auto function = closure->function;
+    if (argCount != function->arity)
+    {
+        runtimeError(std::format("Expected {} arguments but got {}.", function->arity, argCount));
+        return false;
+    }
+
+    if (frameCount == FRAMES_MAX)
+    {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    if (frame != nullptr)
+    {
+        frame->ip = instructionPointer;
+    }
+
+    const auto baseIndex = static_cast<int>(base - stack);
+    frame = &frames[frameCount++];
+    frame->closure = closure;
+    frame->slots = base;
+    chunk = &function->chunk;
+    instructionPointer = chunk->code;
+    frame->ip = instructionPointer;
+    if (tracer != nullptr)
+    {
+        traceCursor.emplace(chunk->lines);
+    }
+
+    if (!reserveStack(baseIndex + chunk->maxStackDepth))
+    {
+        return false;
+    }
+
+    stackTop = frame->slots + chunk->maxStackDepth;
+    std::fill(frame->slots + 1 + argCount, stackTop, Value::null());
+    return true;
+}
+
+// The closure is stored in its register before it captures anything, since capturing allocates upvalues.
+void RegisterVM::makeClosure(ObjFunction *function, Value &target)
+{
+    const auto closure = heap.newClosure(function);
+    target = Value::object(closure);
+    for (auto i = 0; i < closure->upvalueCount; i++)
+    {
+        const auto [index, isLocal, constant] = function->upvalues[i];
+        closure->upvalues[i] = isLocal ? captureUpvalue(frame->slots + index) : frame->closure->upvalues[index];
+        heap.writeBarrier(closure, closure->upvalues[i]);
+    }
+}
+
+ObjUpvalue *RegisterVM::captureUpvalue(Value *local)
+{
+    ObjUpvalue *previous = nullptr;
+    auto upvalue = openUpvalues;
+    while (upvalue != nullptr && upvalue->location > local)
+    {
+        previous = upvalue;
+        upvalue = upvalue->nextOpen;
+    }
+
+    if (upvalue != nullptr && upvalue->location == local)
+    {
+        return upvalue;
+    }
+
+    const auto created = heap.newUpvalue(local);
+    created->nextOpen = upvalue;
+    if (previous == nullptr)
+    {
+        openUpvalues = created;
+    }
+    else
+    {
+        previous->nextOpen = created;
+    }
+
+    return created;
+}
+
+void RegisterVM::closeUpvalues(const Value *last)
+{
+    while (openUpvalues != nullptr && openUpvalues->location >= last)
+    {
+        const auto upvalue = openUpvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        heap.writeBarrier(upvalue, upvalue->closed);
+        openUpvalues = upvalue->nextOpen;
+    }
+}
+
+uint32_t RegisterVM::fetch()
+{
+    const auto instruction = readInstruction(instructionPointer);
+    instructionPointer += INSTRUCTION_SIZE;
+    return instruction;
+}
+
+Value RegisterVM::rk(const Value *registers, const int operand) const
+{
+    return operand & RK_CONSTANT ? chunk->constants.values[operand & MAX_RK_CONSTANT] : registers[operand];
+}
+
+bool RegisterVM::defineGlobal(const int index, const Value value, const bool constant)
+{
+    if (env.declare(index, value, constant) == EnvironmentDeclareResult::ALREADY_DEFINED)
+    {
+        runtimeError(std::format("Cannot redeclare variable {}.", env.get(index).name->view()));
+        return false;
+    }
+
+    return true;
+}
+
+bool RegisterVM::getGlobal(const int index, Value &value)
+{
+    const auto &global = env.get(index);
+    if (!global.defined)
+    {
+        runtimeError(std::format("Undefined variable {}.", global.name->view()));
+        return false;
+    }
+
+    value = global.value;
+    return true;
+}
+
+bool RegisterVM::setGlobal(const int index, const Value value)
+{
+    switch (env.set(index, value))
+    {
+        case EnvironmentSetResult::NOT_DEFINED:
+            runtimeError(std::format("Undefined variable {}.", env.get(index).name->view()));
+            return false;
+
+        case EnvironmentSetResult::TYPE_MISMATCH:
+            runtimeError(std::format("Type mismatch for variable {}.", env.get(index).name->view()));
+            return false;
+
+        case EnvironmentSetResult::CONSTANT_NOT_REASSIGNABLE:
+            runtimeError(std::format("Constant {} cannot be reassigned.", env.get(index).name->view()));
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+template<typename Op>
+bool RegisterVM::arithmetic(Value *registers, const uint32_t instruction, const Op op)
+{
+    const auto b = rk(registers, decodeB(instruction));
+    const auto c = rk(registers, decodeC(instruction));
+    if (!b.isNumber() || !c.isNumber())
+    {
+        runtimeError("Operands must be numbers.");
+        return false;
+    }
+
+    registers[decodeA(instruction)] = op(b.asNumber(), c.asNumber());
+    return true;
+}
+
+void RegisterVM::runtimeError(const std::string &message)
+{
+    std::cerr << message << "\n";
+
+    for (auto i = frameCount - 1; i >= 0; i--)
+    {
+        if (frameCount - i > MAX_TRACE_FRAMES && i >= MAX_TRACE_FRAMES)
+        {
+            std::cerr << std::format("... {} more frames\n", i - MAX_TRACE_FRAMES + 1);
+            i = MAX_TRACE_FRAMES;
+            continue;
+        }
+
+        const auto &callFrame = frames[i];
+        const auto function = callFrame.closure->function;
+        const auto ip = i == frameCount - 1 ? instructionPointer : callFrame.ip;
+        const auto instruction = std::max<long>(ip - function->chunk.code - INSTRUCTION_SIZE, 0);
+        const auto [line, column] = function->chunk.lines.lookup(static_cast<int>(instruction));
+        if (function->name == nullptr)
+        {
+            std::cerr << std::format("[line {}:{}] in script\n", line, column);
+        }
+        else
+        {
+            std::cerr << std::format("[line {}:{}] in {}()\n", line, column, function->name->view());
+        }
+    }
+
+    resetStack();
+}
@@ -6,6 +6,7 @@ Token Scanner::scanToken()
 {
     skipWhitespacesAndComments();
     start = current;
+    column = start - lineStart + 1;
     if (isAtEnd())
     {
         return makeToken(TokenType::FILE_EOF);
@@ -29,6 +30,8 @@ Token Scanner::scanToken()
         case ')': return makeToken(TokenType::RIGHT_PAREN);
         case '{': return makeToken(TokenType::LEFT_BRACE);
         case '}': return makeToken(TokenType::RIGHT_BRACE);
+        case '[': return makeToken(TokenType::LEFT_BRACKET);
+        case ']': return makeToken(TokenType::RIGHT_BRACKET);
         case ':': return makeToken(TokenType::COLON);
         case ',': return makeToken(TokenType::COMMA);
         case '.': return makeToken(TokenType::DOT);
@@ -84,12 +87,33 @@ bool Scanner::isLetterOrUnderscore(const char c)
 Token Scanner::makeToken(const TokenType type) const
 {
     const auto lexeme = std::string_view{source.begin() + start, source.begin() + current};
-    return Token{type, lexeme, line};
+    return Token{type, lexeme, line, column};
 }
 
 Token Scanner::errorToken(const std::string_view &message) const
 {
-    return Token{TokenType::ERROR, message, line};
+    return Token{TokenType::ERROR, message, line, column};
+}
+
+// Called while the newline is still the current character, so the next line starts right after it.
+Scanner::Position Scanner::position() const
+{
+    return Position{start, current, line, lineStart, column};
+}
+
+void Scanner::rewind(const Position &position)
+{
+    start = position.start;
+    current = position.current;
+    line = position.line;
+    lineStart = position.lineStart;
+    column = position.column;
+}
+
+void Scanner::nextLine()
+{
+    line++;
+    lineStart = current + 1;
 }
 
 char Scanner::advance()
@@ -135,7 +159,7 @@ Token Scanner::string()
     {
         if (peek() == '\n')
         {
-            line++;
+            nextLine();
         }
 
         advance();
@@ -224,7 +248,7 @@ void Scanner::skipWhitespacesAndComments()
                 advance();
                 break;
             case '\n':
-                line++;
+                nextLine();
                 advance();
                 break;
             case '/':
@@ -244,7 +268,7 @@ void Scanner::skipWhitespacesAndComments()
                     {
                         if (peek() == '\n')
                         {
-                            line++;
+                            nextLine();
                         }
 
                         advance();
@@ -0,0 +1,66 @@
+#include "../include/tracer.h"
+
+#include <charconv>
+#include <cstring>
+
+Tracer::Tracer(const std::string &path): file(std::fopen(path.c_str(), "w"))
+{
+    if (file != nullptr)
+    {
+        append("offset,opcode,stack_depth,line\n");
+    }
+}
+
+Tracer::~Tracer()
+{
+    if (file != nullptr)
+    {
+        flush();
+        std::fclose(file);
+    }
+}
+
+bool Tracer::isOpen() const
+{
+    return file != nullptr;
+}
+
+void Tracer::append(const std::string_view &text)
+{
+    std::memcpy(buffer.data() + used, text.data(), text.length());
+    used += text.length();
+}
+
+void Tracer::append(const long number)
+{
+    const auto [end, error] = std::to_chars(buffer.data() + used, buffer.data() + BUFFER_SIZE, number);
+    used = end - buffer.data();
+}
+
+void Tracer::record(const long offset, const OpCode opcode, const long stackDepth, const int line)
+{
+    record(offset, opcodeName(opcode), stackDepth, line);
+}
+
+void Tracer::record(const long offset, const std::string_view opcode, const long stackDepth, const int line)
+{
+    if (BUFFER_SIZE - used < MAX_RECORD_SIZE)
+    {
+        flush();
+    }
+
+    append(offset);
+    append(",");
+    append(opcode);
+    append(",");
+    append(stackDepth);
+    append(",");
+    append(line);
+    append("\n");
+}
+
+void Tracer::flush()
+{
+    std::fwrite(buffer.data(), 1, used, file);
+    used = 0;
+}
@@ -3,343 +3,1035 @@
 #include "../include/util.h"
 #include "../include/vm.h"
 
+#include <algorithm>
 #include <format>
 #include <iostream>
-#include <valarray>
 
 #include "../include/compiler.h"
+#include "../include/operators.h"
 
-VM::~VM() = default;
+#ifdef YAUPL_TRACING
+#define VM_TRACE() if constexpr (Traced) { traceInstruction(); }
+#else
+#define VM_TRACE()
+#endif
+
+// VM::run is written once against these macros. With YAUPL_COMPUTED_GOTO every handler jumps straight to the
+// next one through a table of label addresses; otherwise the handlers are the cases of a portable switch.
+#ifdef YAUPL_COMPUTED_GOTO
+#define VM_LABEL(opcode) label_##opcode
+#define VM_DISPATCH() do { VM_TRACE(); goto *dispatchTable[readByte()]; } while (false)
+#define VM_LOOP_BEGIN VM_DISPATCH(); {
+#define VM_LOOP_END }
+#define VM_CASE(opcode) VM_LABEL(opcode):
+#define VM_UNKNOWN VM_LABEL(UNKNOWN):
+#define VM_NEXT() VM_DISPATCH()
+#else
+#define VM_LOOP_BEGIN for (;;) { VM_TRACE(); switch (readByte()) {
+#define VM_LOOP_END } }
+#define VM_CASE(opcode) case static_cast<uint8_t>(OpCode::opcode):
+#define VM_UNKNOWN default:
+#define VM_NEXT() continue
+#endif
+
+using namespace operators;
 
-InterpretResult VM::interpret(const std::string &source)
+VM::~VM()
 {
-    chunk = std::make_unique<Chunk>();
-    instructionPointer = chunk->code;
-    if (!compiler.compile(source, chunk.get()))
+    heap.removeRoots(this);
+    freeArray(stack, stackCapacity);
+}
+
+void VM::markRoots(Heap &heap)
+{
+    for (auto slot = stack; slot < stackTop; slot++)
+    {
+        heap.markValue(*slot);
+    }
+
+    for (auto i = 0; i < frameCount; i++)
+    {
+        heap.markObject(frames[i].closure);
+    }
+
+    for (auto upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen)
+    {
+        heap.markObject(upvalue);
+    }
+
+    env.markRoots(heap);
+}
+
+namespace
+{
+    void disassembleFunction(const ObjFunction *function)
+    {
+        function->chunk.disassemble(function->name == nullptr ? "script" : std::string{function->name->view()});
+        for (auto i = 0; i < function->chunk.constants.count; i++)
+        {
+            if (const auto constant = function->chunk.constants.values[i]; isObjType(constant, ObjType::FUNCTION))
+            {
+                disassembleFunction(asFunction(constant));
+            }
+        }
+    }
+}
+
+InterpretResult VM::interpret(const std::string &source, const CompilePipeline pipeline)
+{
+    const auto function = pipeline == CompilePipeline::IR ? irCompiler.compile(source) : compiler.compile(source);
+    if (function == nullptr)
     {
         return InterpretResult::COMPILE_ERROR;
     }
 
-    this->instructionPointer = chunk->code;
-    auto const result = run();
+    if (dumpBytecode)
+    {
+        disassembleFunction(function);
+    }
+
+    resetStack();
+    push(Value::object(function));
+    const auto closure = heap.newClosure(function);
+    pop();
+    push(Value::object(closure));
+    auto const result = call(closure, 0) ? run() : InterpretResult::RUNTIME_ERROR;
+    if (tracer != nullptr)
+    {
+        tracer->flush();
+    }
+
     return result;
 }
 
 InterpretResult VM::run()
 {
-    for (;;)
+#ifdef YAUPL_TRACING
+    if (tracer != nullptr)
     {
-#ifdef DEBUG_TRACE_EXECUTION
-        std::cout << "          ";
-
-        for (auto slot = stack; slot < stackTop; slot++)
-        {
-            std::cout << "[  ";
-            util::printValue(*slot);
-            std::cout << "  ]";
-        }
+        return execute<true>();
+    }
+#endif
 
+    return execute<false>();
+}
 
-        chunk->disassembleInstruction(static_cast<int>(instructionPointer - chunk->code));
+template<bool Traced>
+InterpretResult VM::execute()
+{
+#ifdef YAUPL_COMPUTED_GOTO
+    void *dispatchTable[UINT8_MAX + 1];
+    std::fill_n(dispatchTable, UINT8_MAX + 1, &&VM_LABEL(UNKNOWN));
+#define VM_REGISTER_LABEL(opcode, operandBytes, stackEffect) dispatchTable[static_cast<uint8_t>(OpCode::opcode)] = &&VM_LABEL(opcode);
+    YAUPL_OPCODES(VM_REGISTER_LABEL)
+#undef VM_REGISTER_LABEL
 #endif
 
-        uint8_t instruction;
-        switch (instruction = readByte())
+    VM_LOOP_BEGIN
+        VM_CASE(OP_CONSTANT)
+        {
+            auto const constant = readConstant();
+            push(constant);
+            VM_NEXT();
+        }
+        VM_CASE(OP_CONSTANT_LONG)
         {
-            case static_cast<uint8_t>(OpCode::OP_CONSTANT):
+            push(chunk->constants.values[readLong()]);
+            VM_NEXT();
+        }
+        VM_CASE(OP_NULL)
+        {
+            push(Value::null());
+            VM_NEXT();
+        }
+        VM_CASE(OP_TRUE)
+        {
+            push(Value::boolean(true));
+            VM_NEXT();
+        }
+        VM_CASE(OP_FALSE)
+        {
+            push(Value::boolean(false));
+            VM_NEXT();
+        }
+        VM_CASE(OP_NOT)
+        {
+            push(Value::boolean(isFalsey(pop())));
+            VM_NEXT();
+        }
+        VM_CASE(OP_NEGATE)
+        {
+            if (!peek(0).isNumber())
             {
-                auto const constant = readConstant();
-                push(constant);
-                util::printValue(constant);
-                std::cout << "\n";
-                break;
+                runtimeError("Operand must be a number.");
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_NULL):
+
+            push(Value::number(-pop().asNumber()));
+            VM_NEXT();
+        }
+        VM_CASE(OP_ADD)
+        {
+            if (isString(peek(0)) && isString(peek(1)))
             {
-                push(std::monostate{});
-                break;
+                concatenate();
+                quicken(OpCode::OP_ADD_STR);
+                VM_NEXT();
             }
-            case static_cast<uint8_t>(OpCode::OP_TRUE):
+
+            if (!binaryOp(add))
             {
-                push(true);
-                break;
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_FALSE):
+
+            quicken(OpCode::OP_ADD_NUM);
+            VM_NEXT();
+        }
+        VM_CASE(OP_ADD_NUM)
+        {
+            if (!numberBinaryOp(add))
             {
-                push(false);
-                break;
+                dequicken(OpCode::OP_ADD);
             }
-            case static_cast<uint8_t>(OpCode::OP_NOT):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_ADD_STR)
+        {
+            if (!isString(peek(0)) || !isString(peek(1)))
             {
-                push(isFalsey(pop()));
-                break;
+                dequicken(OpCode::OP_ADD);
+                VM_NEXT();
             }
-            case static_cast<uint8_t>(OpCode::OP_NEGATE):
-            {
-                if (!std::holds_alternative<double>(peek(0)))
-                {
-                    runtimeError("Operand must be a number.");
-                    return InterpretResult::RUNTIME_ERROR;
-                }
 
-                push(-std::get<double>(pop()));
-                break;
-            }
-            case static_cast<uint8_t>(OpCode::OP_ADD):
+            concatenate();
+            VM_NEXT();
+        }
+        VM_CASE(OP_SUBTRACT)
+        {
+            if (!binaryOp(subtract))
             {
-                auto result = false;
-                if (std::holds_alternative<double>(peek(0)) && std::holds_alternative<double>(peek(1)))
-                {
-                    result = binaryOp<double>([](const double a, const double b) { return a + b; });
-                }
-                else if (std::holds_alternative<std::string>(peek(0)) && std::holds_alternative<std::string>(peek(1)))
-                {
-                    result = binaryOp<std::string>([](const std::string &a, const std::string &b)
-                    {
-                        return a + b;
-                    });
-                }
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                if (!result)
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            quicken(OpCode::OP_SUBTRACT_NUM);
+            VM_NEXT();
+        }
+        VM_CASE(OP_SUBTRACT_NUM)
+        {
+            if (!numberBinaryOp(subtract))
+            {
+                dequicken(OpCode::OP_SUBTRACT);
+            }
 
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_MULTIPLY)
+        {
+            if (!binaryOp(multiply))
+            {
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_SUBTRACT):
+
+            quicken(OpCode::OP_MULTIPLY_NUM);
+            VM_NEXT();
+        }
+        VM_CASE(OP_MULTIPLY_NUM)
+        {
+            if (!numberBinaryOp(multiply))
             {
-                const auto result = binaryOp<double>([](const double a, const double b) { return a - b; });
-                if (!result)
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+                dequicken(OpCode::OP_MULTIPLY);
+            }
 
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_DIVIDE)
+        {
+            if (!binaryOp(divide))
+            {
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_MULTIPLY):
+
+            quicken(OpCode::OP_DIVIDE_NUM);
+            VM_NEXT();
+        }
+        VM_CASE(OP_DIVIDE_NUM)
+        {
+            if (!numberBinaryOp(divide))
             {
-                const auto result = binaryOp<double>([](const double a, const double b) { return a * b; });
-                if (!result)
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+                dequicken(OpCode::OP_DIVIDE);
+            }
 
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_EXPONENT)
+        {
+            if (!binaryOp(exponent))
+            {
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_DIVIDE):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_LSHIFT)
+        {
+            if (!binaryOp(leftShift))
             {
-                const auto result = binaryOp<double>([](const double a, const double b) { return a / b; });
-                if (!result)
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_RSHIFT)
+        {
+            if (!binaryOp(rightShift))
+            {
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_EXPONENT):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_MODULO)
+        {
+            if (!binaryOp(modulo))
             {
-                const auto result = binaryOp<double>([](const double a, const double b)
-                {
-                    return std::pow(a, b);
-                });
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                if (!result)
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            VM_NEXT();
+        }
+        VM_CASE(OP_EQUAL)
+        {
+            const auto a = pop();
+            const auto b = pop();
+            push(Value::boolean(valuesEqual(a, b)));
+            VM_NEXT();
+        }
+        VM_CASE(OP_GREATER)
+        {
+            if (!binaryOp(greater))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                break;
+            quicken(OpCode::OP_GREATER_NUM);
+            VM_NEXT();
+        }
+        VM_CASE(OP_GREATER_NUM)
+        {
+            if (!numberBinaryOp(greater))
+            {
+                dequicken(OpCode::OP_GREATER);
             }
-            case static_cast<uint8_t>(OpCode::OP_LSHIFT):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_LESS)
+        {
+            if (!binaryOp(less))
             {
-                const auto result = binaryOp<double>([](const double a, const double b)
-                {
-                    return static_cast<double>(static_cast<long>(a) << static_cast<long>(b));
-                });
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                if (!result)
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            quicken(OpCode::OP_LESS_NUM);
+            VM_NEXT();
+        }
+        VM_CASE(OP_LESS_NUM)
+        {
+            if (!numberBinaryOp(less))
+            {
+                dequicken(OpCode::OP_LESS);
+            }
 
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_GREATER_EQUAL)
+        {
+            if (!binaryOp(greaterEqual))
+            {
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_RSHIFT):
+
+            quicken(OpCode::OP_GREATER_EQUAL_NUM);
+            VM_NEXT();
+        }
+        VM_CASE(OP_GREATER_EQUAL_NUM)
+        {
+            if (!numberBinaryOp(greaterEqual))
             {
-                const auto result = binaryOp<double>([](const double a, const double b)
-                {
-                    return static_cast<double>(static_cast<long>(a) >> static_cast<long>(b));
-                });
+                dequicken(OpCode::OP_GREATER_EQUAL);
+            }
 
-                if (!result)
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            VM_NEXT();
+        }
+        VM_CASE(OP_LESS_EQUAL)
+        {
+            if (!binaryOp(lessEqual))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                break;
+            quicken(OpCode::OP_LESS_EQUAL_NUM);
+            VM_NEXT();
+        }
+        VM_CASE(OP_LESS_EQUAL_NUM)
+        {
+            if (!numberBinaryOp(lessEqual))
+            {
+                dequicken(OpCode::OP_LESS_EQUAL);
             }
-            case static_cast<uint8_t>(OpCode::OP_MODULO):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_NUM_NEGATE)
+        {
+            stackTop[-1] = Value::number(-stackTop[-1].asNumber());
+            VM_NEXT();
+        }
+        VM_CASE(OP_NUM_ADD)
+        {
+            uncheckedBinaryOp(add);
+            VM_NEXT();
+        }
+        VM_CASE(OP_NUM_SUBTRACT)
+        {
+            uncheckedBinaryOp(subtract);
+            VM_NEXT();
+        }
+        VM_CASE(OP_NUM_MULTIPLY)
+        {
+            uncheckedBinaryOp(multiply);
+            VM_NEXT();
+        }
+        VM_CASE(OP_NUM_DIVIDE)
+        {
+            uncheckedBinaryOp(divide);
+            VM_NEXT();
+        }
+        VM_CASE(OP_NUM_GREATER)
+        {
+            uncheckedBinaryOp(greater);
+            VM_NEXT();
+        }
+        VM_CASE(OP_NUM_LESS)
+        {
+            uncheckedBinaryOp(less);
+            VM_NEXT();
+        }
+        VM_CASE(OP_NUM_GREATER_EQUAL)
+        {
+            uncheckedBinaryOp(greaterEqual);
+            VM_NEXT();
+        }
+        VM_CASE(OP_NUM_LESS_EQUAL)
+        {
+            uncheckedBinaryOp(lessEqual);
+            VM_NEXT();
+        }
+        VM_CASE(OP_LESS_JUMP)
+        {
+            if (!compareAndJump(less))
             {
-                const auto result = binaryOp<double>([](const double a, const double b)
-                {
-                    return static_cast<double>(static_cast<long>(a) % static_cast<long>(b));
-                });
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                if (!result)
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            VM_NEXT();
+        }
+        VM_CASE(OP_LESS_EQUAL_JUMP)
+        {
+            if (!compareAndJump(lessEqual))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_GREATER_JUMP)
+        {
+            if (!compareAndJump(greater))
+            {
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_EQUAL):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_GREATER_EQUAL_JUMP)
+        {
+            if (!compareAndJump(greaterEqual))
             {
-                const auto a = pop();
-                const auto b = pop();
-                push(valuesEqual(a, b));
-                break;
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_GREATER):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_NOT_EQUAL)
+        {
+            const auto a = pop();
+            const auto b = pop();
+            push(Value::boolean(!valuesEqual(a, b)));
+            VM_NEXT();
+        }
+        VM_CASE(OP_PRINT)
+        {
+            util::printValue(pop());
+            std::cout << "\n";
+            VM_NEXT();
+        }
+        VM_CASE(OP_POP)
+        {
+            pop();
+            VM_NEXT();
+        }
+        VM_CASE(OP_DEFINE_GLOBAL)
+        {
+            if (!defineGlobal(readByte(), false))
             {
-                const auto result = binaryOp<bool>([](const double a, const double b)
-                {
-                    return a > b;
-                });
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                if (!result)
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            VM_NEXT();
+        }
+        VM_CASE(OP_DEFINE_GLOBAL_LONG)
+        {
+            if (!defineGlobal(readLong(), false))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_DEFINE_CONSTANT)
+        {
+            if (!defineGlobal(readByte(), true))
+            {
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_LESS):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_DEFINE_CONSTANT_LONG)
+        {
+            if (!defineGlobal(readLong(), true))
             {
-                const auto result = binaryOp<bool>([](const double a, const double b)
-                {
-                    return a < b;
-                });
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                if (!result)
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            VM_NEXT();
+        }
+        VM_CASE(OP_JUMP)
+        {
+            const auto offset = readShort();
+            instructionPointer += offset;
+            VM_NEXT();
+        }
+        VM_CASE(OP_JUMP_IF_FALSE)
+        {
+            const auto offset = readShort();
+            if (isFalsey(pop()))
+            {
+                instructionPointer += offset;
+            }
 
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_JUMP_IF_FALSE_OR_POP)
+        {
+            const auto offset = readShort();
+            if (isFalsey(peek()))
+            {
+                instructionPointer += offset;
             }
-            case static_cast<uint8_t>(OpCode::OP_PRINT):
+            else
             {
-                util::printValue(pop());
-                std::cout << "\n";
-                break;
+                pop();
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_JUMP_IF_TRUE_OR_POP)
+        {
+            const auto offset = readShort();
+            if (!isFalsey(peek()))
+            {
+                instructionPointer += offset;
             }
-            case static_cast<uint8_t>(OpCode::OP_POP):
+            else
             {
                 pop();
-                break;
             }
-            case static_cast<uint8_t>(OpCode::OP_DEFINE_GLOBAL):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_XOR)
+        {
+            const auto b = pop();
+            const auto a = pop();
+            push(Value::boolean(isFalsey(a) != isFalsey(b)));
+            VM_NEXT();
+        }
+        VM_CASE(OP_LOOP)
+        {
+            const auto offset = readShort();
+            instructionPointer -= offset;
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_LOCAL)
+        {
+            push(frame->slots[readByte()]);
+            VM_NEXT();
+        }
+        VM_CASE(OP_SET_LOCAL)
+        {
+            const auto slot = readByte();
+            auto &local = frame->slots[slot];
+            if (!isAssignable(typeOf(local), typeOf(peek())))
             {
-                auto constant = chunk->constants.values[readByte()];
-                if (!std::holds_alternative<std::string>(constant))
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+                const auto offset = static_cast<int>(instructionPointer - chunk->code - 2);
+                runtimeError(std::format("Type mismatch for variable {}.", chunk->localName(offset, slot)));
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                const auto name = std::get<std::string>(constant);
-                const auto declarationResult = env.declare(name, peek());
-                if (declarationResult == EnvironmentDeclareResult::ALREADY_DEFINED)
-                {
-                    runtimeError(std::format("Cannot redeclare variable {}.", name));
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            local = peek();
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_GLOBAL_ADD_CONST)
+        {
+            if (!getGlobal(readByte()))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                pop();
-                break;
+            // The constant is combined with the global in place: the instruction only grows the stack by one slot,
+            // which is all the stack depth analysis reserves for it.
+            const auto constant = readConstant();
+            const auto global = peek();
+            if (global.isNumber() && constant.isNumber())
+            {
+                stackTop[-1] = add(global.asNumber(), constant.asNumber());
+                VM_NEXT();
             }
-            case static_cast<uint8_t>(OpCode::OP_DEFINE_CONSTANT):
+
+            if (isString(global) && isString(constant))
             {
-                auto constant = chunk->constants.values[readByte()];
-                if (!std::holds_alternative<std::string>(constant))
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+                stackTop[-1] = Value::object(heap.concatenate(asString(global), asString(constant)));
+                VM_NEXT();
+            }
 
-                const auto name = std::get<std::string>(constant);
-                const auto declarationResult = env.declare(name, peek(), true);
-                if (declarationResult == EnvironmentDeclareResult::ALREADY_DEFINED)
-                {
-                    runtimeError(std::format("Cannot redeclare variable {}.", name));
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            runtimeError("Operands must be numbers.");
+            return InterpretResult::RUNTIME_ERROR;
+        }
+        VM_CASE(OP_INCREMENT_LOCAL)
+        {
+            auto &local = frame->slots[readByte()];
+            const auto constant = readConstant();
+            if (!local.isNumber())
+            {
+                runtimeError("Operands must be numbers.");
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                pop();
-                break;
+            local = add(local.asNumber(), constant.asNumber());
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_GLOBAL)
+        {
+            if (!getGlobal(readByte()))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_GLOBAL_LONG)
+        {
+            if (!getGlobal(readLong()))
+            {
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_GET_GLOBAL):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_SET_GLOBAL)
+        {
+            if (!setGlobal(readByte()))
             {
-                auto constant = chunk->constants.values[readByte()];
-                if (!std::holds_alternative<std::string>(constant))
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                const auto name = std::get<std::string>(constant);
-                const auto retrievedValue = env.get(name);
-                if (!retrievedValue.has_value())
-                {
-                    runtimeError(std::format("Undefined variable {}.", name));
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            VM_NEXT();
+        }
+        VM_CASE(OP_SET_GLOBAL_LONG)
+        {
+            if (!setGlobal(readLong()))
+            {
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                push(retrievedValue.value());
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_CALL)
+        {
+            const auto argCount = readByte();
+            if (!callValue(peek(argCount), argCount))
+            {
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_SET_GLOBAL):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_TAIL_CALL)
+        {
+            const auto argCount = readByte();
+            if (!tailCall(peek(argCount), argCount))
             {
-                auto constant = chunk->constants.values[readByte()];
-                if (!std::holds_alternative<std::string>(constant))
-                {
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                const auto &name = std::get<std::string>(constant);
-                switch (env.set(name, peek()))
-                {
-                    case EnvironmentSetResult::NOT_DEFINED:
-                        runtimeError(std::format("Undefined variable {}.", name));
-                        return InterpretResult::RUNTIME_ERROR;
+            VM_NEXT();
+        }
+        VM_CASE(OP_CLOSURE)
+        {
+            makeClosure(asFunction(readConstant()));
+            VM_NEXT();
+        }
+        VM_CASE(OP_CLOSURE_LONG)
+        {
+            makeClosure(asFunction(chunk->constants.values[readLong()]));
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_UPVALUE)
+        {
+            push(*frame->closure->upvalues[readByte()]->location);
+            VM_NEXT();
+        }
+        VM_CASE(OP_SET_UPVALUE)
+        {
+            const auto upvalue = frame->closure->upvalues[readByte()];
+            if (!isAssignable(typeOf(*upvalue->location), typeOf(peek())))
+            {
+                runtimeError("Type mismatch for captured variable.");
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                    case EnvironmentSetResult::TYPE_MISMATCH:
-                        runtimeError(std::format("Type mismatch for variable {}.", name));
-                        return InterpretResult::RUNTIME_ERROR;
+            *upvalue->location = peek();
+            heap.writeBarrier(upvalue, peek());
+            VM_NEXT();
+        }
+        VM_CASE(OP_CLOSE_UPVALUE)
+        {
+            closeUpvalues(stackTop - 1);
+            pop();
+            VM_NEXT();
+        }
+        VM_CASE(OP_ARRAY)
+        {
+            makeArray(readByte());
+            VM_NEXT();
+        }
+        VM_CASE(OP_ARRAY_LONG)
+        {
+            makeArray(readLong());
+            VM_NEXT();
+        }
+        VM_CASE(OP_INDEX_GET)
+        {
+            if (!builtins.getIndex(peek(1), peek(0), stackTop[-2]))
+            {
+                runtimeError(builtins.error());
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                    case EnvironmentSetResult::CONSTANT_NOT_REASSIGNABLE:
-                        runtimeError(std::format("Constant {} cannot be reassigned.", name));
-                        return InterpretResult::RUNTIME_ERROR;
+            stackTop--;
+            VM_NEXT();
+        }
+        VM_CASE(OP_INDEX_SET)
+        {
+            if (!builtins.setIndex(peek(2), peek(1), peek(0)))
+            {
+                runtimeError(builtins.error());
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                    default:
-                        break;
-                }
+            stackTop[-3] = peek(0);
+            stackTop -= 2;
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_PROPERTY)
+        {
+            if (!builtins.getProperty(peek(), asString(readConstant()), stackTop[-1]))
+            {
+                runtimeError(builtins.error());
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(OP_GET_PROPERTY_LONG)
+        {
+            if (!builtins.getProperty(peek(), asString(chunk->constants.values[readLong()]), stackTop[-1]))
+            {
+                runtimeError(builtins.error());
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case static_cast<uint8_t>(OpCode::OP_RETURN):
+
+            VM_NEXT();
+        }
+        VM_CASE(OP_RETURN)
+        {
+            if (frameCount == 1)
             {
+                resetStack();
                 return InterpretResult::OK;
             }
-            default: ;
+
+            returnFrom();
+            VM_NEXT();
         }
-    }
+        VM_UNKNOWN
+        {
+            runtimeError(std::format("Unknown opcode {}.", instructionPointer[-1]));
+            return InterpretResult::RUNTIME_ERROR;
+        }
+    VM_LOOP_END
+}
+
+void VM::traceInstruction()
+{
+    const auto offset = instructionPointer - chunk->code;
+    const auto line = traceCursor->seek(static_cast<int>(offset)).line;
+    tracer->record(offset, static_cast<OpCode>(*instructionPointer), stackTop - stack, line);
 }
 
 void VM::resetStack()
 {
+    closeUpvalues(stack);
     stackTop = stack;
+    frameCount = 0;
+    frame = nullptr;
+}
+
+// Pushes are unchecked: every call grows the stack to hold the callee's maximum depth, or stops with a stack overflow
+// if that would exceed the configured limit. Growing may move the stack, so frames and open upvalues are rebased.
+bool VM::reserveStack(const int slots)
+{
+    if (slots > stackLimit)
+    {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    if (slots <= stackCapacity)
+    {
+        return true;
+    }
+
+    const auto oldStack = stack;
+    const auto oldCapacity = stackCapacity;
+    stackCapacity = std::min(std::max(growCapacity(oldCapacity), slots), stackLimit);
+    stack = growArray(stack, oldCapacity, stackCapacity);
+
+    // Only offsets are taken from the old pointers, the old block itself is never read again.
+    const auto rebase = [&](const Value *pointer)
+    {
+        return stack + (reinterpret_cast<uintptr_t>(pointer) - reinterpret_cast<uintptr_t>(oldStack)) / sizeof(Value);
+    };
+
+    stackTop = rebase(stackTop);
+    for (auto i = 0; i < frameCount; i++)
+    {
+        frames[i].slots = rebase(frames[i].slots);
+    }
+
+    for (auto upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen)
+    {
+        upvalue->location = rebase(upvalue->location);
+    }
+
+    return true;
+}
+
+bool VM::callValue(const Value callee, const int argCount)
+{
+    if (isClosure(callee))
+    {
+        return call(asClosure(callee), argCount);
+    }
+
+    if (isNative(callee))
+    {
+        if (!builtins.callNative(callee, stackTop - argCount - 1, argCount))
+        {
+            runtimeError(builtins.error());
+            return false;
+        }
+
+        stackTop -= argCount;
+        return true;
+    }
+
+    runtimeError("Can only call functions.");
+    return false;
+}
+
+bool VM::call(ObjClosure *closure, const int argCount)
+{
+    const auto function = closure->function;
+    if (!checkArity(function, argCount))
+    {
+        return false;
+    }
+
+    if (frameCount == FRAMES_MAX)
+    {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    if (frame != nullptr)
+    {
+        frame->ip = instructionPointer;
+    }
+
+    const auto base = static_cast<int>(stackTop - stack) - argCount - 1;
+    frame = &frames[frameCount++];
+    frame->closure = closure;
+    frame->slots = stack + base;
+    chunk = &function->chunk;
+    instructionPointer = chunk->code;
+    frame->ip = instructionPointer;
+    if (tracer != nullptr)
+    {
+        traceCursor.emplace(chunk->lines);
+    }
+
+    return reserveStack(base + function->chunk.maxStackDepth);
+}
+
+// A call in tail position replaces the frame of its caller instead of pushing one: the caller's upvalues are closed
+// and the callee and its arguments moved down over its slots, so chains of tail calls run in constant stack space.
+// The replaced callers are gone from the stack trace of a later runtime error. A native returns without a frame of
+// its own, so it is called like any other.
+bool VM::tailCall(const Value callee, const int argCount)
+{
+    if (!isClosure(callee))
+    {
+        return callValue(callee, argCount);
+    }
+
+    const auto closure = asClosure(callee);
+    const auto function = closure->function;
+    if (!checkArity(function, argCount))
+    {
+        return false;
+    }
+
+    closeUpvalues(frame->slots);
+    std::copy(stackTop - argCount - 1, stackTop, frame->slots);
+    stackTop = frame->slots + argCount + 1;
+    frame->closure = closure;
+    chunk = &function->chunk;
+    instructionPointer = chunk->code;
+    frame->ip = instructionPointer;
+    if (tracer != nullptr)
+    {
+        traceCursor.emplace(chunk->lines);
+    }
+
+    return reserveStack(static_cast<int>(frame->slots - stack) + function->chunk.maxStackDepth);
 }
 
-void VM::push(const Value &value)
+bool VM::checkArity(const ObjFunction *function, const int argCount)
+{
+    if (argCount != function->arity)
+    {
+        runtimeError(std::format("Expected {} arguments but got {}.", function->arity, argCount));
+        return false;
+    }
+
+    return true;
+}
+
+void VM::returnFrom()
+{
+    const auto result = pop();
+    closeUpvalues(frame->slots);
+    stackTop = frame->slots;
+    push(result);
+
+    frameCount--;
+    frame = &frames[frameCount - 1];
+    chunk = &frame->closure->function->chunk;
+    instructionPointer = frame->ip;
+    if (tracer != nullptr)
+    {
+        traceCursor.emplace(chunk->lines);
+    }
+}
+
+void VM::makeClosure(ObjFunction *function)
+{
+    const auto closure = heap.newClosure(function);
+    push(Value::object(closure));
+    for (auto i = 0; i < closure->upvalueCount; i++)
+    {
+        const auto [index, isLocal, constant] = function->upvalues[i];
+        closure->upvalues[i] = isLocal ? captureUpvalue(frame->slots + index) : frame->closure->upvalues[index];
+        heap.writeBarrier(closure, closure->upvalues[i]);
+    }
+}
+
+// The elements are the count values on top of the stack, which the array replaces.
+void VM::makeArray(const int count)
+{
+    const auto array = heap.newArray(count);
+    std::copy(stackTop - count, stackTop, array->values);
+    stackTop -= count;
+    push(Value::object(array));
+}
+
+// Open upvalues are kept sorted by stack slot, highest first, so closures capturing the same variable share one.
+ObjUpvalue *VM::captureUpvalue(Value *local)
+{
+    ObjUpvalue *previous = nullptr;
+    auto upvalue = openUpvalues;
+    while (upvalue != nullptr && upvalue->location > local)
+    {
+        previous = upvalue;
+        upvalue = upvalue->nextOpen;
+    }
+
+    if (upvalue != nullptr && upvalue->location == local)
+    {
+        return upvalue;
+    }
+
+    const auto created = heap.newUpvalue(local);
+    created->nextOpen = upvalue;
+    if (previous == nullptr)
+    {
+        openUpvalues = created;
+    }
+    else
+    {
+        previous->nextOpen = created;
+    }
+
+    return created;
+}
+
+void VM::closeUpvalues(const Value *last)
+{
+    while (openUpvalues != nullptr && openUpvalues->location >= last)
+    {
+        const auto upvalue = openUpvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        heap.writeBarrier(upvalue, upvalue->closed);
+        openUpvalues = upvalue->nextOpen;
+    }
+}
+
+void VM::push(const Value value)
 {
     *stackTop = value;
     stackTop++;
@@ -361,49 +1053,178 @@ uint8_t VM::readByte()
     return *instructionPointer++;
 }
 
+int VM::readShort()
+{
+    const auto operand = readShortOperand(instructionPointer);
+    instructionPointer += 2;
+    return operand;
+}
+
+int VM::readLong()
+{
+    const auto operand = readLongOperand(instructionPointer);
+    instructionPointer += 3;
+    return operand;
+}
+
 Value VM::readConstant()
 {
     return chunk->constants.values[readByte()];
 }
 
 
-template<AllowedType T>
-bool VM::binaryOp(const std::function<Value(T, T)> &op)
+bool VM::defineGlobal(const int index, const bool constant)
 {
-    if (!std::holds_alternative<T>(peek(0)) || !std::holds_alternative<T>(peek(1)))
+    if (env.declare(index, peek(), constant) == EnvironmentDeclareResult::ALREADY_DEFINED)
     {
-        if (std::is_same_v<T, double>)
-        {
-            runtimeError("Operands must be numbers.");
-        }
-        if (std::is_same_v<T, bool>)
-        {
-            runtimeError("Operands must be numbers.");
-        }
-        else if (std::is_same_v<T, std::string>)
-        {
-            runtimeError("Operands must be strings.");
-        }
-        else
-        {
-            runtimeError("Operands must be of the correct type.");
-        }
+        runtimeError(std::format("Cannot redeclare variable {}.", env.get(index).name->view()));
+        return false;
+    }
+
+    pop();
+    return true;
+}
 
+bool VM::getGlobal(const int index)
+{
+    const auto &global = env.get(index);
+    if (!global.defined)
+    {
+        runtimeError(std::format("Undefined variable {}.", global.name->view()));
         return false;
     }
 
-    const Value b = pop();
-    const Value a = pop();
-    push(op(std::get<T>(a), std::get<T>(b)));
+    push(global.value);
     return true;
 }
 
+bool VM::setGlobal(const int index)
+{
+    switch (env.set(index, peek()))
+    {
+        case EnvironmentSetResult::NOT_DEFINED:
+            runtimeError(std::format("Undefined variable {}.", env.get(index).name->view()));
+            return false;
+
+        case EnvironmentSetResult::TYPE_MISMATCH:
+            runtimeError(std::format("Type mismatch for variable {}.", env.get(index).name->view()));
+            return false;
+
+        case EnvironmentSetResult::CONSTANT_NOT_REASSIGNABLE:
+            runtimeError(std::format("Constant {} cannot be reassigned.", env.get(index).name->view()));
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+template<typename Op>
+bool VM::binaryOp(const Op op)
+{
+    if (!peek(0).isNumber() || !peek(1).isNumber())
+    {
+        runtimeError("Operands must be numbers.");
+        return false;
+    }
+
+    const auto b = pop().asNumber();
+    const auto a = pop().asNumber();
+    push(op(a, b));
+    return true;
+}
+
+template<typename Op>
+bool VM::numberBinaryOp(const Op op)
+{
+    const auto b = stackTop[-1];
+    const auto a = stackTop[-2];
+    if (!a.isNumber() || !b.isNumber())
+    {
+        return false;
+    }
+
+    stackTop--;
+    stackTop[-1] = op(a.asNumber(), b.asNumber());
+    return true;
+}
+
+// For the OP_NUM_ operators, whose operands the compiler proved to be numbers.
+template<typename Op>
+void VM::uncheckedBinaryOp(const Op op)
+{
+    stackTop--;
+    stackTop[-1] = op(stackTop[-1].asNumber(), stackTop[0].asNumber());
+}
+
+// The fused form of a comparison and the OP_JUMP_IF_FALSE after it: the operands are popped and the jump is taken
+// when the comparison is false.
+template<typename Op>
+bool VM::compareAndJump(const Op op)
+{
+    const auto offset = readShort();
+    if (!peek(0).isNumber() || !peek(1).isNumber())
+    {
+        runtimeError("Operands must be numbers.");
+        return false;
+    }
+
+    const auto b = pop().asNumber();
+    const auto a = pop().asNumber();
+    if (!op(a, b).asBool())
+    {
+        instructionPointer += offset;
+    }
+
+    return true;
+}
+
+void VM::concatenate()
+{
+    const auto result = heap.concatenate(asString(peek(1)), asString(peek(0)));
+    stackTop -= 2;
+    push(Value::object(result));
+}
+
+void VM::quicken(const OpCode opcode)
+{
+    instructionPointer[-1] = static_cast<uint8_t>(opcode);
+}
+
+void VM::dequicken(const OpCode opcode)
+{
+    instructionPointer--;
+    *instructionPointer = static_cast<uint8_t>(opcode);
+}
+
 void VM::runtimeError(const std::string &message)
 {
     std::cerr << message << "\n";
 
-    const auto instruction = instructionPointer - chunk->code - 1;
-    int line = chunk->lines[instruction];
-    std::cerr << std::format("[line {}] in script\n", line); // C++20
+    for (auto i = frameCount - 1; i >= 0; i--)
+    {
+        // Deep recursion would bury the message, so only the innermost and outermost frames are listed.
+        if (frameCount - i > MAX_TRACE_FRAMES && i >= MAX_TRACE_FRAMES)
+        {
+            std::cerr << std::format("... {} more frames\n", i - MAX_TRACE_FRAMES + 1);
+            i = MAX_TRACE_FRAMES;
+            continue;
+        }
+
+        const auto &callFrame = frames[i];
+        const auto function = callFrame.closure->function;
+        const auto ip = i == frameCount - 1 ? instructionPointer : callFrame.ip;
+        const auto instruction = std::max<long>(ip - function->chunk.code - 1, 0);
+        const auto [line, column] = function->chunk.lines.lookup(static_cast<int>(instruction));
+        if (function->name == nullptr)
+        {
+            std::cerr << std::format("[line {}:{}] in script\n", line, column);
+        }
+        else
+        {
+            std::cerr << std::format("[line {}:{}] in {}()\n", line, column, function->name->view());
+        }
+    }
+
     resetStack();
 }